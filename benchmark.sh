@@ -0,0 +1,199 @@
+#!/bin/bash
+
+# Compares the cost per step of computed goto and switch dispatch in the
+# bytecode engine, then that of the tree walker and the node engine (which
+# take the same steps), and finally that of the node engine with and without
+# its JIT. Each workload is run a few times and the fastest run
+# is reported, so that the numbers are not skewed by a noisy machine. The
+# cases_* workloads are microbenchmarks of cases dispatch, they step through
+# a cycle of dense or sparse primitive keys, or walk a long linked list.
+# Finally a few loops that never end are soaked for SOAK_STEPS steps (100M by
+# default) to check that the memory they use stays flat, the script fails
+# if one of them peaks at more than 10% above its peak after a tenth of the
+# steps. Peaks are read from /proc, so the soak only runs on Linux.
+
+mkdir -p build
+
+SRC_FILES="src/Main.cpp src/Lexer.cpp src/Term.cpp src/Parser.cpp src/Resolver.cpp src/Program.cpp src/Optimizer.cpp src/Bytecode.cpp src/NodeTree.cpp src/NodeJit.cpp src/CppEmitter.cpp src/CallTrace.cpp src/Machine.cpp src/Utils.cpp"
+RUNS=${RUNS:-5}
+
+echo 'Compiling...'
+c++ -std=c++20 -O2 -o build/cfmc_goto $SRC_FILES
+c++ -std=c++20 -O2 -DCFMC_NO_COMPUTED_GOTO -o build/cfmc_switch $SRC_FILES
+
+# church_lists.fmc only takes a handful of steps, so its functions are reused
+# to build and fold a long list instead
+CHURCH_SRC="$(sed '/^main/,$d' church_lists.fmc)
+build = (<n> . [n] . (0 -> [nil], otherwise -> [n] . [1] . - . build . <l> . [[l] . [n] . cons]))
+sum = (<l> . [0] . [<h> . <t> . [t] . sum . [h] . square . +] . l)
+main = (in<n> . [n] . build . sum . <r> . [r]out)"
+
+CASES_LOOP_SRC='loop = (<n> . <s> . [n] . (0 -> [s]out, otherwise -> [s] . next . [n] . [1] . - . loop))
+main = (in<n> . [0] . [n] . loop)'
+
+CASES_DENSE_SRC="$CASES_LOOP_SRC
+next = (<s> . [s] . (0 -> [1], 1 -> [2], 2 -> [3], 3 -> [4], 4 -> [5], 5 -> [6], 6 -> [7], otherwise -> [0]))"
+
+CASES_SPARSE_SRC="$CASES_LOOP_SRC
+next = (<s> . [s] . (0 -> [10], 10 -> [1000], 1000 -> [70000], 70000 -> [123456], 123456 -> [999999], 999999 -> [5000000], 5000000 -> [77777777], otherwise -> [0]))"
+
+CASES_LOC_SRC='build = (<n> . <@tail> . [n] . (0 -> [#tail], otherwise -> new<@p> . [#tail]p . [#p] . [n] . [1] . - . build))
+walk = (<c> . <@p> . [#p] . (null -> [c]out, otherwise -> p<@q> . [#q] . [c] . [1] . + . walk))
+main = (in<n> . [#null] . [n] . build . <@h> . [#h] . [0] . walk)'
+
+# Prints the steps and the best time in nanoseconds per step
+measure() {
+	local input=$1; local engine=$2; shift 2
+	local best=""
+	local steps=""
+
+	for ((run = 0; run < RUNS; ++run)); do
+		local stats
+		stats=$(echo "$input" | "$@" --engine "$engine" --stats 2>&1 >/dev/null)
+		steps=$(echo "$stats" | awk '/Steps     :/ { print $3 }')
+		local secs=$(echo "$stats" | awk '/Time \(s\)  :/ { print $4 }')
+		local ns=$(awk -v s="$secs" -v n="$steps" 'BEGIN { printf "%.2f", s * 1e9 / n }')
+
+		if [ -z "$best" ] || awk -v a="$ns" -v b="$best" 'BEGIN { exit !(a < b) }'; then
+			best=$ns
+		fi
+	done
+
+	printf "%12s %10s" "$steps" "$best"
+}
+
+printf "%-14s %12s %10s %12s %10s\n" "Workload" "Steps" "goto ns" "Steps" "switch ns"
+
+bench() {
+	local name=$1; local input=$2; shift 2
+
+	printf "%-14s " "$name"
+	measure "$input" bytecode build/cfmc_goto "$@"
+	printf " "
+	measure "$input" bytecode build/cfmc_switch "$@"
+	printf "\n"
+}
+
+bench "fibonacci"     ""         --max-steps 20000000 --file fibonacci.fmc
+bench "arithmetic"    "300000 7" --file arithmetic.fmc
+bench "church_lists"  "2000"     --source "$CHURCH_SRC"
+bench "cases_dense"   "300000"   --source "$CASES_DENSE_SRC"
+bench "cases_sparse"  "300000"   --source "$CASES_SPARSE_SRC"
+bench "cases_loc"     "200000"   --source "$CASES_LOC_SRC"
+
+printf "\n%-14s %12s %10s %12s %10s\n" "Workload" "Steps" "tree ns" "Steps" "nodes ns"
+
+bench_nodes() {
+	local name=$1; local input=$2; shift 2
+
+	printf "%-14s " "$name"
+	measure "$input" tree build/cfmc_goto "$@"
+	printf " "
+	measure "$input" nodes build/cfmc_goto "$@"
+	printf "\n"
+}
+
+bench_nodes "fibonacci"     ""        --max-steps 5000000 --file fibonacci.fmc
+bench_nodes "arithmetic"    "50000 7" --file arithmetic.fmc
+bench_nodes "church_lists"  "500"     --source "$CHURCH_SRC"
+bench_nodes "cases_dense"   "50000"   --source "$CASES_DENSE_SRC"
+bench_nodes "cases_loc"     "50000"   --source "$CASES_LOC_SRC"
+
+printf "\n%-14s %12s %10s %12s %10s\n" "Workload" "Steps" "nodes ns" "Steps" "jit ns"
+
+bench_jit() {
+	local name=$1; local input=$2; shift 2
+
+	printf "%-14s " "$name"
+	measure "$input" nodes build/cfmc_goto "$@"
+	printf " "
+	measure "$input" nodes build/cfmc_goto --jit "$@"
+	printf "\n"
+}
+
+bench_jit "fibonacci"     ""         --max-steps 20000000 --file fibonacci.fmc
+bench_jit "arithmetic"    "300000 7" --file arithmetic.fmc
+
+printf "\n%-14s %12s %10s %12s %10s\n" "Workload" "Steps" "nodes ns" "Steps" "tiered ns"
+
+# Functions start in the tree walker and are promoted after the default
+# threshold of calls, so the tiered engine should keep up with the node engine
+bench_tiered() {
+	local name=$1; local input=$2; shift 2
+
+	printf "%-14s " "$name"
+	measure "$input" nodes build/cfmc_goto "$@"
+	printf " "
+	measure "$input" tiered build/cfmc_goto "$@"
+	printf "\n"
+}
+
+bench_tiered "fibonacci"     ""         --max-steps 5000000 --file fibonacci.fmc
+bench_tiered "arithmetic"    "300000 7" --file arithmetic.fmc
+bench_tiered "church_lists"  "500"      --source "$CHURCH_SRC"
+bench_tiered "cases_dense"   "50000"    --source "$CASES_DENSE_SRC"
+
+# fibonacci.fmc leaves two values on the stack every iteration, this variant
+# drops them so that only the arithmetic results and output are left
+SOAK_ARITH_SRC='fib_aux = (<b> . <a> . [a] . [b] . + . <c> . [c]out . [b] . [c] . fib_aux)
+main = ([0] . [1] . fib_aux)'
+
+SOAK_NEW_SRC='loop = (new<@p> . [#null]p . [#p] . <@q> . q<@r> . loop)
+main = (loop)'
+
+# Reads closures forever, each of which is garbage once it has run
+SOAK_IN_SRC='loop = (in<c> . c . <x> . [x]null . loop)
+main = (loop)'
+
+SOAK_STEPS=${SOAK_STEPS:-100000000}
+SOAK_FAILED=0
+
+# Prints the peak resident memory in KB of a command, fed by the output of
+# the command given as input
+peak_rss() {
+	local input=$1; shift
+
+	"$@" >/dev/null 2>&1 < <(eval "$input") &
+	local pid=$!
+	local peak=0
+
+	# The high water mark only rises, so the last one read is the peak
+	while kill -0 $pid 2>/dev/null; do
+		local hwm=$(awk '/VmHWM/ { print $2 }' /proc/$pid/status 2>/dev/null)
+		[ -n "$hwm" ] && peak=$hwm
+		sleep 0.1
+	done
+
+	wait $pid
+	echo $peak
+}
+
+soak() {
+	local name=$1; local input=$2; local engine=$3; shift 3
+
+	local early=$(peak_rss "$input" "$@" --engine "$engine" --max-steps $((SOAK_STEPS / 10)))
+	local late=$(peak_rss "$input" "$@" --engine "$engine" --max-steps $SOAK_STEPS)
+	local verdict="flat"
+
+	if ((late * 10 > early * 11)); then
+		verdict="GROWS"
+		SOAK_FAILED=1
+	fi
+
+	printf "%-14s %-9s %12s %12s %8s\n" "$name" "$engine" "$early" "$late" "$verdict"
+}
+
+if [ -r /proc/self/status ]; then
+	printf "\n%-14s %-9s %12s %12s %8s\n" "Soak" "Engine" "Early KB" "Peak KB" ""
+
+	soak "soak_arith"  "true"        tree     build/cfmc_goto --source "$SOAK_ARITH_SRC"
+	soak "soak_arith"  "true"        bytecode build/cfmc_goto --source "$SOAK_ARITH_SRC"
+	soak "soak_new"    "true"        tree     build/cfmc_goto --source "$SOAK_NEW_SRC"
+	soak "soak_new"    "true"        bytecode build/cfmc_goto --source "$SOAK_NEW_SRC"
+	soak "soak_new"    "true"        nodes    build/cfmc_goto --source "$SOAK_NEW_SRC"
+	# Only the tree walker releases input terms, the other engines keep the
+	# code they made of them
+	soak "soak_in"     "yes '[5]'"   tree     build/cfmc_goto --source "$SOAK_IN_SRC"
+fi
+
+exit $SOAK_FAILED
@@ -2,7 +2,7 @@
 
 mkdir -p build
 
-SRC_FILES="src/Main.cpp src/Lexer.cpp src/Term.cpp src/Parser.cpp src/Program.cpp src/Machine.cpp src/Utils.cpp"
+SRC_FILES="src/Main.cpp src/Lexer.cpp src/Term.cpp src/Parser.cpp src/Resolver.cpp src/Program.cpp src/Optimizer.cpp src/Bytecode.cpp src/NodeTree.cpp src/NodeJit.cpp src/CppEmitter.cpp src/CallTrace.cpp src/Machine.cpp src/Utils.cpp"
 
 echo 'Compiling...'
 c++ -std=c++20 -g -o build/cfmc $SRC_FILES
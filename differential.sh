@@ -0,0 +1,75 @@
+#!/bin/bash
+
+# Runs every example under each engine and compares what it prints and its
+# exit status with those of the tree walker. The bytecode engine is built
+# with both computed goto and switch dispatch, and the tiered engine and the
+# JIT are given thresholds of 1 so that every function is promoted or
+# compiled on its first call. Any extra arguments (such as '--inline 16
+# --fold') are passed to every run. Programs that never end are stopped
+# after MAX_STEPS steps, and INPUT is fed to each run. The script fails if
+# any engine differs.
+
+mkdir -p build
+
+SRC_FILES="src/Main.cpp src/Lexer.cpp src/Term.cpp src/Parser.cpp src/Resolver.cpp src/Program.cpp src/Optimizer.cpp src/Bytecode.cpp src/NodeTree.cpp src/NodeJit.cpp src/CppEmitter.cpp src/CallTrace.cpp src/Machine.cpp src/Utils.cpp"
+MAX_STEPS=${MAX_STEPS:-1000000}
+INPUT=${INPUT:-"6 7"}
+
+echo 'Compiling...'
+c++ -std=c++20 -O2 -o build/cfmc_goto $SRC_FILES
+c++ -std=c++20 -O2 -DCFMC_NO_COMPUTED_GOTO -o build/cfmc_switch $SRC_FILES
+
+ENGINES=("bytecode goto" "bytecode switch" "nodes" "tiered" "jit")
+FAILED=0
+
+# Prints the output of a run followed by its exit status
+run() {
+	local file=$1; shift
+
+	echo "$INPUT" | "$@" --max-steps "$MAX_STEPS" --file "$file" 2>/dev/null
+	echo "[exit $?]"
+}
+
+run_engine() {
+	local engine=$1; local file=$2; shift 2
+
+	case $engine in
+		"tree")            run "$file" build/cfmc_goto --engine tree "$@" ;;
+		"bytecode goto")   run "$file" build/cfmc_goto --engine bytecode "$@" ;;
+		"bytecode switch") run "$file" build/cfmc_switch --engine bytecode "$@" ;;
+		"nodes")           run "$file" build/cfmc_goto --engine nodes "$@" ;;
+		"tiered")          run "$file" build/cfmc_goto --engine tiered --tier-threshold 1 "$@" ;;
+		"jit")             run "$file" build/cfmc_goto --engine nodes --jit --jit-threshold 1 "$@" ;;
+	esac
+}
+
+printf "%-26s" "Example"
+for engine in "${ENGINES[@]}"; do
+	printf " %-16s" "$engine"
+done
+printf "\n"
+
+for file in *.fmc; do
+	expected=$(run_engine "tree" "$file" "$@")
+	diffs=""
+
+	printf "%-26s" "$file"
+
+	for engine in "${ENGINES[@]}"; do
+		actual=$(run_engine "$engine" "$file" "$@")
+
+		if [ "$actual" == "$expected" ]; then
+			printf " %-16s" "same"
+		else
+			printf " %-16s" "DIFFERS"
+			diffs+="--- $file: tree against $engine"$'\n'
+			diffs+=$(diff <(echo "$expected") <(echo "$actual") | head -10)$'\n'
+			FAILED=1
+		fi
+	done
+
+	printf "\n"
+	printf "%s" "$diffs"
+done
+
+exit $FAILED
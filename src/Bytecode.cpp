@@ -0,0 +1,1055 @@
+#include "Bytecode.hpp"
+
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "Utils.hpp"
+
+namespace
+{
+	// What is known when code is entered, the sorts of the values on top of
+	// named locations (the last is the top) and of the innermost variables
+	// (the last is index zero), anything further down or out is unknown
+	struct StackState
+	{
+		std::map<Loc_t, std::vector<Sorts_t>> Stacks;
+		std::vector<Sorts_t> Vars;
+	};
+
+	// Keeps the values both agree are on top, which may be of either's sorts
+	bool meetSorts(std::vector<Sorts_t> &sorts, const std::vector<Sorts_t> &other)
+	{
+		size_t size = std::min(sorts.size(), other.size());
+
+		std::vector<Sorts_t> met(sorts.end() - size, sorts.end());
+		for (size_t i = 0; i < size; ++i)
+		{
+			met[i] |= other[other.size() - size + i];
+		}
+
+		bool isChanged = met != sorts;
+		sorts = std::move(met);
+		return isChanged;
+	}
+
+	bool meetState(StackState &state, const StackState &other)
+	{
+		bool isChanged = meetSorts(state.Vars, other.Vars);
+
+		for (auto it = state.Stacks.begin(); it != state.Stacks.end(); )
+		{
+			auto itOther = other.Stacks.find(it->first);
+			if (itOther == other.Stacks.end())
+			{
+				it = state.Stacks.erase(it);
+				isChanged = true;
+				continue;
+			}
+
+			isChanged |= meetSorts(it->second, itOther->second);
+			++it;
+		}
+
+		return isChanged;
+	}
+}
+
+const char *getOpName(OpCode op)
+{
+	static const char *const k_Names[] = {
+		"Ret", "Call", "CallVar", "TailCall", "TailCallVar",
+		"PushPrim", "PushLoc", "PushLocVar", "PushVar", "PushClosure",
+		"Pop", "PopBind", "PopLoc", "PopLocBind",
+		"Add", "Sub",
+		"PrimCases", "LocCases", "TailPrimCases", "TailLocCases",
+		"Fail",
+		"PushVarVar", "PushVarCall", "PushPrimCall", "PushLocCall",
+		"PushVarTailCall", "PushPrimTailCall", "PushLocTailCall", "PushVarRet",
+		"AddVarVar", "SubVarVar", "AddVarPrim", "SubVarPrim",
+		"PopBindTwice", "PeekBind", "BindVar"
+	};
+	static_assert(sizeof(k_Names) / sizeof(k_Names[0]) == k_NumOpCodes);
+
+	return k_Names[static_cast<size_t>(op)];
+}
+
+size_t getOpLength(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::AddVarVar:
+	case OpCode::SubVarVar:
+	case OpCode::AddVarPrim:
+	case OpCode::SubVarPrim:
+		return 3;
+	case OpCode::PushVarVar:
+	case OpCode::PushVarCall:
+	case OpCode::PushPrimCall:
+	case OpCode::PushLocCall:
+	case OpCode::PushVarTailCall:
+	case OpCode::PushPrimTailCall:
+	case OpCode::PushLocTailCall:
+	case OpCode::PushVarRet:
+	case OpCode::PopBindTwice:
+	case OpCode::PeekBind:
+	case OpCode::BindVar:
+		return 2;
+	default:
+		return 1;
+	}
+}
+
+bool isBlockBoundary(OpCode op)
+{
+	switch (op)
+	{
+	case OpCode::Ret:
+	case OpCode::Call:
+	case OpCode::CallVar:
+	case OpCode::TailCall:
+	case OpCode::TailCallVar:
+	case OpCode::PrimCases:
+	case OpCode::LocCases:
+	case OpCode::TailPrimCases:
+	case OpCode::TailLocCases:
+	case OpCode::Fail:
+		return true;
+	default:
+		return false;
+	}
+}
+
+Bytecode::Bytecode(const Program &program, bool isFused)
+	: m_Program(program)
+	, m_IsFused(isFused)
+	, m_FuncIndices(program.getNumFuncs())
+{
+	if (auto mainOpt = m_Program.findFunc("main"))
+	{
+		requestFunction(mainOpt.value());
+		compilePending();
+		analyzeStacks();
+	}
+}
+
+std::optional<CodeAddr_t> Bytecode::getEntry() const
+{
+	if (m_Funcs.empty())
+	{
+		return std::nullopt;
+	}
+	return m_Funcs.front().Entry;
+}
+
+CodeAddr_t Bytecode::compile(const TermHandle_t &term)
+{
+	auto it = m_Blocks.find(term.get());
+	if (it != m_Blocks.end())
+	{
+		return it->second;
+	}
+
+	m_ExternalTerms.push_back(term);
+
+	CodeAddr_t addr = compileBlock(term);
+	compilePending();
+	analyzeStacks();
+
+	return addr;
+}
+
+const Instr *Bytecode::getCode() const
+{
+	return m_Code.data();
+}
+
+size_t Bytecode::getCodeSize() const
+{
+	return m_Code.size();
+}
+
+const Instr &Bytecode::getOriginal(CodeAddr_t addr) const
+{
+	return m_Original[addr];
+}
+
+const Function &Bytecode::getFunction(uint32_t index) const
+{
+	return m_Funcs[index];
+}
+
+const TermHandle_t &Bytecode::getTerm(uint32_t index) const
+{
+	return m_Terms[index];
+}
+
+const CasesTable<Prim_t> &Bytecode::getPrimCases(uint32_t index) const
+{
+	return m_PrimCases[index];
+}
+
+const CasesTable<Loc_t> &Bytecode::getLocCases(uint32_t index) const
+{
+	return m_LocCases[index];
+}
+
+const TermHandle_t &Bytecode::getSource(CodeAddr_t addr) const
+{
+	return m_Sources[addr];
+}
+
+std::optional<size_t> Bytecode::getMaxDepth(Loc_t loc) const
+{
+	if (m_IsIndexUnbounded)
+	{
+		return std::nullopt;
+	}
+
+	// Locations that no block names are only ever pushed to through variables
+	if (loc >= m_MaxDepths.size())
+	{
+		return m_MaxIndexDepth;
+	}
+
+	if (auto depthOpt = m_MaxDepths[loc])
+	{
+		return std::max(depthOpt.value(), m_MaxIndexDepth);
+	}
+
+	return std::nullopt;
+}
+
+void Bytecode::compilePending()
+{
+	while (!m_PendingFuncs.empty())
+	{
+		uint32_t index = m_PendingFuncs.back();
+		m_PendingFuncs.pop_back();
+
+		// Compiling may request more functions, so don't hold on to a reference
+		TermHandle_t term = m_Funcs[index].Term;
+		m_Funcs[index].Entry = compileBlock(term);
+	}
+}
+
+CodeAddr_t Bytecode::compileBlock(const TermHandle_t &term)
+{
+	auto it = m_Blocks.find(term.get());
+	if (it != m_Blocks.end())
+	{
+		return it->second;
+	}
+
+	// Nested blocks are compiled first so that their addresses are known by
+	// the time this block refers to them, this only recurses as deep as terms
+	// are nested and never along the body of a block
+	for (TermHandle_t t = term; t; )
+	{
+		if (t->isApp())
+		{
+			const AppTerm &app = t->asApp();
+			TermHandle_t arg = app.getArg();
+
+			bool isBoundVar = arg->isVar() && arg->asVar().getIndex();
+			if (!arg->isVal() && !isBoundVar)
+			{
+				compileBlock(arg);
+			}
+			t = app.getBody();
+		}
+		else if (t->isPrimCases())
+		{
+			const CasesTerm<Prim_t> &cases = t->asPrimCases();
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				compileBlock(itCases->second);
+			}
+			compileBlock(cases.getOtherwise());
+			t = cases.getBody();
+		}
+		else if (t->isLocCases())
+		{
+			const CasesTerm<Loc_t> &cases = t->asLocCases();
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				compileBlock(itCases->second);
+			}
+			compileBlock(cases.getOtherwise());
+			t = cases.getBody();
+		}
+		else if (t->isVar())
+		{
+			t = t->asVar().getBody();
+		}
+		else if (t->isAbs())
+		{
+			t = t->asAbs().getBody();
+		}
+		else if (t->isLocAbs())
+		{
+			t = t->asLocAbs().getBody();
+		}
+		else if (t->isLocApp())
+		{
+			t = t->asLocApp().getBody();
+		}
+		else if (t->isBinOp())
+		{
+			t = t->asBinOp().getBody();
+		}
+		else
+		{
+			t = nullptr;
+		}
+	}
+
+	CodeAddr_t addr = static_cast<CodeAddr_t>(m_Code.size());
+	m_Blocks[term.get()] = addr;
+
+	for (TermHandle_t t = term; t; )
+	{
+		if (t->isNil())
+		{
+			emit(OpCode::Ret, t);
+			t = nullptr;
+		}
+		else if (t->isVar())
+		{
+			const VarTerm &var = t->asVar();
+
+			bool isTail = var.getBody()->isNil();
+
+			if (auto indexOpt = var.getIndex())
+			{
+				emit(isTail ? OpCode::TailCallVar : OpCode::CallVar, t, indexOpt.value());
+			}
+			else
+			{
+				// The resolver only leaves names unbound when they are linked to functions
+				emit(isTail ? OpCode::TailCall : OpCode::Call, t, requestFunction(var.getFuncIndex().value()));
+			}
+			t = var.getBody();
+		}
+		else if (t->isApp())
+		{
+			const AppTerm &app = t->asApp();
+			TermHandle_t arg = app.getArg();
+
+			if (arg->isVal() && arg->asVal().isPrim())
+			{
+				emitWithLoc(OpCode::PushPrim, t, app.getLocIndex(), app.getLoc(), static_cast<uint32_t>(arg->asVal().asPrim()));
+			}
+			else if (arg->isVal())
+			{
+				emitWithLoc(OpCode::PushLoc, t, app.getLocIndex(), app.getLoc(), arg->asVal().asLoc());
+			}
+			else if (arg->isVar() && arg->asVar().getIndex())
+			{
+				emitWithLoc(OpCode::PushVar, t, app.getLocIndex(), app.getLoc(), app.getCaptures()[arg->asVar().getIndex().value()]);
+			}
+			else
+			{
+				emitWithLoc(OpCode::PushClosure, t, app.getLocIndex(), app.getLoc(), addTerm(t));
+			}
+			t = app.getBody();
+		}
+		else if (t->isAbs())
+		{
+			const AbsTerm &abs = t->asAbs();
+			emitWithLoc(abs.isBinding() ? OpCode::PopBind : OpCode::Pop, t, abs.getLocIndex(), abs.getLoc());
+			t = abs.getBody();
+		}
+		else if (t->isLocApp())
+		{
+			const LocAppTerm &locApp = t->asLocApp();
+
+			if (auto indexOpt = locApp.getArgIndex())
+			{
+				emitWithLoc(OpCode::PushLocVar, t, locApp.getLocIndex(), locApp.getLoc(), indexOpt.value());
+			}
+			else
+			{
+				emitWithLoc(OpCode::PushLoc, t, locApp.getLocIndex(), locApp.getLoc(), locApp.getArg());
+			}
+			t = locApp.getBody();
+		}
+		else if (t->isLocAbs())
+		{
+			const LocAbsTerm &locAbs = t->asLocAbs();
+			emitWithLoc(locAbs.getLocVar() ? OpCode::PopLocBind : OpCode::PopLoc, t, locAbs.getLocIndex(), locAbs.getLoc());
+			t = locAbs.getBody();
+		}
+		else if (t->isVal())
+		{
+			emit(OpCode::Fail, t);
+			t = nullptr;
+		}
+		else if (t->isBinOp())
+		{
+			const BinOpTerm &binOp = t->asBinOp();
+			emit(binOp.isOp(BinOpTerm::Plus) ? OpCode::Add : OpCode::Sub, t);
+			t = binOp.getBody();
+		}
+		else if (t->isPrimCases())
+		{
+			const CasesTerm<Prim_t> &cases = t->asPrimCases();
+
+			std::vector<std::pair<Prim_t, CodeAddr_t>> branches;
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				branches.emplace_back(itCases->first, m_Blocks.at(itCases->second.get()));
+			}
+
+			emit(cases.getBody()->isNil() ? OpCode::TailPrimCases : OpCode::PrimCases, t, static_cast<uint32_t>(m_PrimCases.size()));
+			m_PrimCases.emplace_back(branches, m_Blocks.at(cases.getOtherwise().get()));
+			t = cases.getBody();
+		}
+		else if (t->isLocCases())
+		{
+			const CasesTerm<Loc_t> &cases = t->asLocCases();
+
+			std::vector<std::pair<Loc_t, CodeAddr_t>> branches;
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				branches.emplace_back(itCases->first, m_Blocks.at(itCases->second.get()));
+			}
+
+			emit(cases.getBody()->isNil() ? OpCode::TailLocCases : OpCode::LocCases, t, static_cast<uint32_t>(m_LocCases.size()));
+			m_LocCases.emplace_back(branches, m_Blocks.at(cases.getOtherwise().get()));
+			t = cases.getBody();
+		}
+	}
+
+	if (m_IsFused)
+	{
+		fuse(addr, static_cast<CodeAddr_t>(m_Code.size()));
+	}
+
+	return addr;
+}
+
+struct Bytecode::StackAnalysis
+{
+	std::map<CodeAddr_t, StackState> Entries;
+	std::vector<CodeAddr_t> Pending;
+
+	// Where returning from code entered at an address goes to, and the
+	// variables each of those continuations restores
+	std::map<CodeAddr_t, std::set<CodeAddr_t>> Returns;
+	std::map<CodeAddr_t, std::vector<Sorts_t>> ContinuationVars;
+
+	void enter(CodeAddr_t addr, const StackState &state)
+	{
+		auto [it, isNew] = Entries.emplace(addr, state);
+		if (isNew || meetState(it->second, state))
+		{
+			Pending.push_back(addr);
+		}
+	}
+
+	void addReturns(CodeAddr_t addr, const std::set<CodeAddr_t> &returns)
+	{
+		std::set<CodeAddr_t> &known = Returns[addr];
+		size_t size = known.size();
+		known.insert(returns.begin(), returns.end());
+
+		// Code that was already analyzed has to return to the new places as well
+		if (known.size() != size && Entries.count(addr))
+		{
+			Pending.push_back(addr);
+		}
+	}
+
+	void addContinuation(CodeAddr_t addr, const std::vector<Sorts_t> &vars, const std::set<CodeAddr_t> &returns)
+	{
+		auto [it, isNew] = ContinuationVars.emplace(addr, vars);
+		if (!isNew && meetSorts(it->second, vars) && Entries.count(addr))
+		{
+			meetSorts(Entries.at(addr).Vars, vars);
+			Pending.push_back(addr);
+		}
+
+		addReturns(addr, returns);
+	}
+};
+
+void Bytecode::analyzeStacks()
+{
+	// Code is analyzed knowing what is on top of each named location and the
+	// sorts of the variables whenever it is entered. Functions and branches
+	// of cases are only entered from the calls and cases that were compiled,
+	// and the code after a call is only entered by returning from it, so each
+	// knows what all the ways of getting there agree on. Closures can be
+	// called from anywhere and know nothing, as does anything compiled from
+	// input and anything a closure returns to. Where nothing is known about a
+	// pop, it may take any sort that is ever pushed to its location, which is
+	// settled by repeating the analysis until no location gains a sort.
+	// This is redone from scratch when input is compiled, which can only
+	// lower what is known, so a pop is never marked safe after the fact.
+	m_LocSorts.assign(getNumLocs(), 0);
+	m_IndexSorts = 0;
+
+	while (true)
+	{
+		m_PushedSorts.assign(getNumLocs(), 0);
+		m_PushedIndexSorts = 0;
+
+		for (Instr &instr : m_Original)
+		{
+			instr.IsSafe = false;
+			instr.IsSorted = false;
+		}
+
+		StackAnalysis analysis;
+
+		if (auto entryOpt = getEntry())
+		{
+			analysis.enter(entryOpt.value(), {});
+		}
+		for (const TermHandle_t &term : m_Terms)
+		{
+			analysis.enter(m_Blocks.at(term->asApp().getArg().get()), {});
+		}
+		for (const TermHandle_t &term : m_ExternalTerms)
+		{
+			analysis.enter(m_Blocks.at(term.get()), {});
+		}
+
+		while (!analysis.Pending.empty())
+		{
+			CodeAddr_t addr = analysis.Pending.back();
+			analysis.Pending.pop_back();
+
+			analyzeBlock(addr, analysis);
+		}
+
+		if (m_PushedSorts == m_LocSorts && m_PushedIndexSorts == m_IndexSorts)
+		{
+			break;
+		}
+
+		m_LocSorts = std::move(m_PushedSorts);
+		m_IndexSorts = m_PushedIndexSorts;
+	}
+
+	// The first instruction of a fused sequence stands for the ones after it
+	for (CodeAddr_t addr = 0; addr < m_Code.size(); ++addr)
+	{
+		Instr &instr = m_Code[addr];
+		instr.IsSafe = m_Original[addr].IsSafe;
+		instr.IsSorted = m_Original[addr].IsSorted;
+
+		switch (instr.Op)
+		{
+		case OpCode::PopBindTwice:
+			instr.IsSafe = m_Original[addr].IsSafe && m_Original[addr + 1].IsSafe;
+			break;
+		case OpCode::AddVarVar:
+		case OpCode::SubVarVar:
+		case OpCode::AddVarPrim:
+		case OpCode::SubVarPrim:
+			instr.IsSorted = m_Original[addr + 2].IsSorted;
+			break;
+		default:
+			break;
+		}
+	}
+
+	boundStacks();
+}
+
+void Bytecode::analyzeBlock(CodeAddr_t begin, StackAnalysis &analysis)
+{
+	// A pop is safe when its stack is known to hold the values it takes, and
+	// sorted when those values are known to be of the sort it expects as
+	// well. Locations are told apart by their operand, but a location
+	// variable can be bound to any location, so pushing or popping through
+	// one might move the top of any other stack and the other way round.
+	// The walk stops at anything that leaves this code, what follows a call
+	// is analyzed once the call is known to return to it.
+	using Key_t = std::pair<bool, uint32_t>;
+
+	auto isStack = [](const Key_t &key) {
+		return key.first || key.second == k_LambdaLoc || key.second >= k_NumReservedLocs;
+	};
+
+	auto mayAlias = [](const Key_t &a, const Key_t &b) {
+		return a == b || a.first || b.first;
+	};
+
+	const StackState &entry = analysis.Entries.at(begin);
+	const std::set<CodeAddr_t> returns = analysis.Returns[begin];
+
+	// The sorts of the values each location is known to hold, the last is the top
+	std::map<Key_t, std::vector<Sorts_t>> stacks;
+	for (const auto &[loc, sorts] : entry.Stacks)
+	{
+		stacks[{false, loc}] = sorts;
+	}
+
+	// The sorts of the variables bound so far, the last is index zero
+	std::vector<Sorts_t> vars = entry.Vars;
+
+	// Location variables are left out when leaving, calls start without any
+	// and they would need to be renumbered for branches
+	auto getState = [&](std::vector<Sorts_t> stateVars) {
+		StackState state;
+		for (const auto &[key, sorts] : stacks)
+		{
+			if (!key.first && !sorts.empty())
+			{
+				state.Stacks[key.second] = sorts;
+			}
+		}
+		state.Vars = std::move(stateVars);
+		return state;
+	};
+
+	auto enterCases = [&](CodeAddr_t addr, const std::set<CodeAddr_t> &branchReturns) {
+		std::vector<CodeAddr_t> branches;
+		const TermHandle_t &source = m_Sources[addr];
+
+		if (source->isPrimCases())
+		{
+			const CasesTerm<Prim_t> &cases = source->asPrimCases();
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				branches.push_back(m_Blocks.at(itCases->second.get()));
+			}
+			branches.push_back(m_Blocks.at(cases.getOtherwise().get()));
+		}
+		else
+		{
+			const CasesTerm<Loc_t> &cases = source->asLocCases();
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				branches.push_back(m_Blocks.at(itCases->second.get()));
+			}
+			branches.push_back(m_Blocks.at(cases.getOtherwise().get()));
+		}
+
+		for (CodeAddr_t branch : branches)
+		{
+			analysis.addReturns(branch, branchReturns);
+			analysis.enter(branch, getState(vars));
+		}
+	};
+
+	// What a pop may take when nothing is known about the top of its stack
+	auto getSorts = [&](const Key_t &key) -> Sorts_t {
+		// A location variable may even be bound to 'in'
+		if (key.first)
+		{
+			return k_AnySort;
+		}
+		else if (key.second == k_NewLoc)
+		{
+			return k_LocSort;
+		}
+		else if (key.second == k_InputLoc)
+		{
+			return k_PrimSort | k_ClosureSort;
+		}
+		else if (!isStack(key))
+		{
+			return k_AnySort;
+		}
+
+		return m_LocSorts[key.second] | m_IndexSorts;
+	};
+
+	auto push = [&](const Key_t &key, Sorts_t sorts) {
+		if (!isStack(key))
+		{
+			return;
+		}
+
+		// If they are the same location each of its values may have moved up one
+		for (auto &[other, known] : stacks)
+		{
+			if (other != key && mayAlias(other, key) && !known.empty())
+			{
+				for (size_t i = 0; i + 1 < known.size(); ++i)
+				{
+					known[i] |= known[i + 1];
+				}
+				known.back() |= sorts;
+			}
+		}
+
+		stacks[key].push_back(sorts);
+
+		if (key.first)
+		{
+			m_PushedIndexSorts |= sorts;
+		}
+		else
+		{
+			m_PushedSorts[key.second] |= sorts;
+		}
+	};
+
+	// The sorts of the value taken, if it is known to be there
+	auto pop = [&](const Key_t &key) -> std::optional<Sorts_t> {
+		if (!isStack(key))
+		{
+			return std::nullopt;
+		}
+
+		std::optional<Sorts_t> sortsOpt;
+
+		std::vector<Sorts_t> &own = stacks[key];
+		if (!own.empty())
+		{
+			sortsOpt = own.back();
+			own.pop_back();
+		}
+
+		// If they are the same location each of its values may have moved down one
+		for (auto &[other, known] : stacks)
+		{
+			if (other != key && mayAlias(other, key) && !known.empty())
+			{
+				for (size_t i = 0; i + 1 < known.size(); ++i)
+				{
+					known[i] |= known[i + 1];
+				}
+				known.pop_back();
+			}
+		}
+
+		return sortsOpt;
+	};
+
+	const Key_t lambda{false, k_LambdaLoc};
+
+	for (CodeAddr_t addr = begin; ; ++addr)
+	{
+		Instr &instr = m_Original[addr];
+		Key_t key{instr.IsLocIndex, instr.Loc};
+
+		switch (instr.Op)
+		{
+		case OpCode::PushPrim:
+			push(key, k_PrimSort);
+			break;
+		case OpCode::PushLoc:
+		case OpCode::PushLocVar:
+			push(key, k_LocSort);
+			break;
+		case OpCode::PushVar:
+			push(key, instr.Arg < vars.size() ? vars[vars.size() - 1 - instr.Arg] : k_AnySort);
+			break;
+		case OpCode::PushClosure:
+			push(key, k_ClosureSort);
+			break;
+		case OpCode::Pop:
+		case OpCode::PopBind:
+		{
+			auto sortsOpt = pop(key);
+			instr.IsSafe = sortsOpt.has_value();
+
+			if (instr.Op == OpCode::PopBind)
+			{
+				vars.push_back(sortsOpt.value_or(getSorts(key)));
+			}
+			break;
+		}
+		case OpCode::PopLoc:
+		case OpCode::PopLocBind:
+		{
+			auto sortsOpt = pop(key);
+			instr.IsSafe = sortsOpt.has_value();
+			instr.IsSorted = sortsOpt == k_LocSort;
+
+			// Binding shifts the index of every location variable
+			if (instr.Op == OpCode::PopLocBind)
+			{
+				for (auto it = stacks.begin(); it != stacks.end(); )
+				{
+					it = it->first.first ? stacks.erase(it) : std::next(it);
+				}
+			}
+			break;
+		}
+		case OpCode::Add:
+		case OpCode::Sub:
+		{
+			auto sorts1Opt = pop(lambda);
+			auto sorts2Opt = pop(lambda);
+			instr.IsSafe = sorts1Opt && sorts2Opt;
+			instr.IsSorted = sorts1Opt == k_PrimSort && sorts2Opt == k_PrimSort;
+
+			push(lambda, k_PrimSort);
+			break;
+		}
+		case OpCode::Ret:
+			for (CodeAddr_t target : returns)
+			{
+				analysis.enter(target, getState(analysis.ContinuationVars.at(target)));
+			}
+			return;
+		case OpCode::Call:
+		case OpCode::TailCall:
+		{
+			CodeAddr_t entryAddr = m_Funcs[instr.Arg].Entry;
+
+			if (instr.Op == OpCode::Call)
+			{
+				analysis.addContinuation(addr + 1, vars, returns);
+				analysis.addReturns(entryAddr, {addr + 1});
+			}
+			else
+			{
+				analysis.addReturns(entryAddr, returns);
+			}
+
+			analysis.enter(entryAddr, getState({}));
+			return;
+		}
+		case OpCode::CallVar:
+			// The closure may return with anything on the stacks
+			analysis.addContinuation(addr + 1, vars, returns);
+			analysis.enter(addr + 1, {{}, vars});
+			return;
+		case OpCode::TailCallVar:
+			for (CodeAddr_t target : returns)
+			{
+				analysis.enter(target, {{}, analysis.ContinuationVars.at(target)});
+			}
+			return;
+		case OpCode::PrimCases:
+		case OpCode::LocCases:
+		case OpCode::TailPrimCases:
+		case OpCode::TailLocCases:
+		{
+			bool isPrim = instr.Op == OpCode::PrimCases || instr.Op == OpCode::TailPrimCases;
+
+			auto sortsOpt = pop(lambda);
+			instr.IsSafe = sortsOpt.has_value();
+			instr.IsSorted = sortsOpt == (isPrim ? k_PrimSort : k_LocSort);
+
+			if (instr.Op == OpCode::PrimCases || instr.Op == OpCode::LocCases)
+			{
+				analysis.addContinuation(addr + 1, vars, returns);
+				enterCases(addr, {addr + 1});
+			}
+			else
+			{
+				enterCases(addr, returns);
+			}
+			return;
+		}
+		default:
+			return;
+		}
+	}
+}
+
+void Bytecode::boundStacks()
+{
+	// A location is bounded when no block holds values pushed to it across a
+	// call or leaves them behind when it ends, it then never holds more than
+	// the most any one block pushes. Pushes through location variables count
+	// towards every location.
+	m_MaxDepths.assign(getNumLocs(), std::optional<size_t>(0));
+	m_MaxIndexDepth = 0;
+	m_IsIndexUnbounded = false;
+
+	// Pushes less pops since the block started
+	std::map<Loc_t, int64_t> nets;
+	int64_t indexNet = 0;
+
+	auto isStack = [](Loc_t loc) {
+		return loc == k_LambdaLoc || loc >= k_NumReservedLocs;
+	};
+
+	auto push = [&](const Instr &instr) {
+		if (instr.IsLocIndex)
+		{
+			indexNet++;
+			m_MaxIndexDepth = std::max(m_MaxIndexDepth, static_cast<size_t>(indexNet));
+		}
+		else if (isStack(instr.Loc))
+		{
+			nets[instr.Loc]++;
+		}
+
+		for (const auto &[loc, net] : nets)
+		{
+			if (m_MaxDepths[loc] && net + indexNet > 0)
+			{
+				m_MaxDepths[loc] = std::max(m_MaxDepths[loc].value(), static_cast<size_t>(net + indexNet));
+			}
+		}
+	};
+
+	auto leave = [&]() {
+		for (const auto &[loc, net] : nets)
+		{
+			if (net + indexNet > 0)
+			{
+				m_MaxDepths[loc] = std::nullopt;
+			}
+		}
+
+		if (indexNet > 0)
+		{
+			m_IsIndexUnbounded = true;
+		}
+	};
+
+	for (const Instr &instr : m_Original)
+	{
+		switch (instr.Op)
+		{
+		case OpCode::PushPrim:
+		case OpCode::PushLoc:
+		case OpCode::PushLocVar:
+		case OpCode::PushVar:
+		case OpCode::PushClosure:
+			push(instr);
+			break;
+		case OpCode::Pop:
+		case OpCode::PopBind:
+		case OpCode::PopLoc:
+		case OpCode::PopLocBind:
+			if (!instr.IsLocIndex && isStack(instr.Loc))
+			{
+				nets[instr.Loc]--;
+			}
+			break;
+		case OpCode::Add:
+		case OpCode::Sub:
+			nets[k_LambdaLoc]--;
+			break;
+		case OpCode::Call:
+		case OpCode::CallVar:
+		case OpCode::PrimCases:
+		case OpCode::LocCases:
+			leave();
+			break;
+		default:
+			// The block ends here and the next one starts
+			leave();
+			nets.clear();
+			indexNet = 0;
+			break;
+		}
+	}
+}
+
+void Bytecode::fuse(CodeAddr_t begin, CodeAddr_t end)
+{
+	// The sequences fused here are the most frequently executed pairs of
+	// adjacent instructions across the bundled examples (see --profile-ops):
+	//
+	//   PushVar -> PushVar    PopBind -> PushVar    PushVar -> Call
+	//   PushVar -> Ret        PushVar -> Add        PopBind -> PopBind
+	//   PushLoc -> Call       PushPrim -> Sub
+	//
+	// together with the idioms they usually come from, such as 'get' which
+	// peeks at a location and '[x]a . a<y>' which rebinds a variable. Calls,
+	// returns and cases only ever end a sequence, as the instruction after
+	// them can be returned to.
+
+	auto isLambdaPush = [&](CodeAddr_t addr, OpCode op) {
+		const Instr &instr = m_Code[addr];
+		return instr.Op == op && !instr.IsLocIndex && instr.Loc == k_LambdaLoc;
+	};
+
+	auto isSameLoc = [&](const Instr &a, const Instr &b) {
+		return a.IsLocIndex == b.IsLocIndex && a.Loc == b.Loc;
+	};
+
+	for (CodeAddr_t addr = begin; addr < end; )
+	{
+		const Instr &first = m_Code[addr];
+		const Instr *second = addr + 1 < end ? &m_Code[addr + 1] : nullptr;
+		const Instr *third = addr + 2 < end ? &m_Code[addr + 2] : nullptr;
+
+		Instr fused = first;
+
+		if (third && isLambdaPush(addr, OpCode::PushVar) && isLambdaPush(addr + 1, OpCode::PushVar)
+			&& (third->Op == OpCode::Add || third->Op == OpCode::Sub))
+		{
+			fused = {third->Op == OpCode::Add ? OpCode::AddVarVar : OpCode::SubVarVar, false, false, false, first.Arg, second->Arg};
+		}
+		else if (third && isLambdaPush(addr, OpCode::PushVar) && isLambdaPush(addr + 1, OpCode::PushPrim)
+			&& (third->Op == OpCode::Add || third->Op == OpCode::Sub))
+		{
+			fused = {third->Op == OpCode::Add ? OpCode::AddVarPrim : OpCode::SubVarPrim, false, false, false, first.Arg, second->Arg};
+		}
+		else if (second && isLambdaPush(addr, OpCode::PushVar) && isLambdaPush(addr + 1, OpCode::PushVar))
+		{
+			fused = {OpCode::PushVarVar, false, false, false, first.Arg, second->Arg};
+		}
+		else if (second && (second->Op == OpCode::Call || second->Op == OpCode::TailCall) && isLambdaPush(addr, OpCode::PushVar))
+		{
+			fused = {second->Op == OpCode::Call ? OpCode::PushVarCall : OpCode::PushVarTailCall, false, false, false, second->Arg, first.Arg};
+		}
+		else if (second && (second->Op == OpCode::Call || second->Op == OpCode::TailCall) && isLambdaPush(addr, OpCode::PushPrim))
+		{
+			fused = {second->Op == OpCode::Call ? OpCode::PushPrimCall : OpCode::PushPrimTailCall, false, false, false, second->Arg, first.Arg};
+		}
+		else if (second && (second->Op == OpCode::Call || second->Op == OpCode::TailCall) && isLambdaPush(addr, OpCode::PushLoc))
+		{
+			fused = {second->Op == OpCode::Call ? OpCode::PushLocCall : OpCode::PushLocTailCall, false, false, false, second->Arg, first.Arg};
+		}
+		else if (second && first.Op == OpCode::PushVar && second->Op == OpCode::Ret)
+		{
+			fused.Op = OpCode::PushVarRet;
+		}
+		else if (second && first.Op == OpCode::PopBind && second->Op == OpCode::PopBind && isSameLoc(first, *second))
+		{
+			fused.Op = OpCode::PopBindTwice;
+		}
+		else if (second && first.Op == OpCode::PopBind && second->Op == OpCode::PushVar && second->Arg == 0
+			&& isSameLoc(first, *second))
+		{
+			fused.Op = OpCode::PeekBind;
+		}
+		else if (second && first.Op == OpCode::PushVar && second->Op == OpCode::PopBind && isSameLoc(first, *second))
+		{
+			fused.Op = OpCode::BindVar;
+		}
+
+		m_Code[addr] = fused;
+		addr += static_cast<CodeAddr_t>(getOpLength(fused.Op));
+	}
+}
+
+uint32_t Bytecode::requestFunction(FuncIndex_t funcIndex)
+{
+	std::optional<uint32_t> &index = m_FuncIndices[funcIndex];
+
+	if (!index)
+	{
+		index = static_cast<uint32_t>(m_Funcs.size());
+		m_Funcs.push_back({m_Program.getFuncName(funcIndex), m_Program.getFunc(funcIndex), 0});
+		m_PendingFuncs.push_back(index.value());
+	}
+
+	return index.value();
+}
+
+uint32_t Bytecode::addTerm(const TermHandle_t &term)
+{
+	m_Terms.push_back(term);
+	return static_cast<uint32_t>(m_Terms.size() - 1);
+}
+
+void Bytecode::emit(OpCode op, const TermHandle_t &source, uint32_t arg)
+{
+	m_Code.push_back({op, false, false, false, 0, arg});
+	m_Original.push_back(m_Code.back());
+	m_Sources.push_back(source);
+}
+
+void Bytecode::emitWithLoc(OpCode op, const TermHandle_t &source, std::optional<Index_t> locIndex, Loc_t loc, uint32_t arg)
+{
+	m_Code.push_back({op, locIndex.has_value(), false, false, locIndex.value_or(loc), arg});
+	m_Original.push_back(m_Code.back());
+	m_Sources.push_back(source);
+}
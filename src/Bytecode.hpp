@@ -0,0 +1,196 @@
+#pragma once
+
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Config.hpp"
+#include "CaseDispatch.hpp"
+#include "Term.hpp"
+#include "Program.hpp"
+
+using CodeAddr_t = uint32_t;
+
+enum class OpCode : uint8_t
+{
+	Ret,         // Return to the most recent continuation
+	Call,        // Call program function 'Arg'
+	CallVar,     // Call the closure bound at variable index 'Arg'
+	TailCall,    // Calls in tail position (followed by 'Ret') don't push a continuation
+	TailCallVar,
+
+	PushPrim,    // Push primitive 'Arg' to 'Loc'
+	PushLoc,     // Push location 'Arg' to 'Loc'
+	PushLocVar,  // Push the location bound at location variable index 'Arg' to 'Loc'
+	PushVar,     // Push the value bound at variable index 'Arg' to 'Loc'
+	PushClosure, // Push a closure of the argument of application 'Arg' to 'Loc'
+
+	Pop,         // Pop from 'Loc' and discard it
+	PopBind,     // Pop from 'Loc' and bind it as a variable
+	PopLoc,      // Pop a location from 'Loc' and discard it
+	PopLocBind,  // Pop a location from 'Loc' and bind it as a location variable
+
+	Add,
+	Sub,
+
+	PrimCases,   // Pop a primitive and call the matching branch of table 'Arg'
+	LocCases,    // Pop a location and call the matching branch of table 'Arg'
+	TailPrimCases,
+	TailLocCases,
+
+	Fail,        // Values cannot be executed
+
+	// Superinstructions, these replace the first instruction of a sequence and
+	// leave the rest of it in place. When the fast path does not apply (e.g. a
+	// location variable turns out to be 'out') the original first instruction
+	// is executed instead and the sequence runs unfused.
+	PushVarVar,  // Push variables 'Loc' then 'Arg' to lambda
+	PushVarCall, // Push variable 'Arg' to lambda and call function 'Loc'
+	PushPrimCall,// Push primitive 'Arg' to lambda and call function 'Loc'
+	PushLocCall, // Push location 'Arg' to lambda and call function 'Loc'
+	PushVarTailCall,
+	PushPrimTailCall,
+	PushLocTailCall,
+	PushVarRet,  // Push variable 'Arg' to 'Loc' and return
+	AddVarVar,   // Push variables 'Loc' and 'Arg' to lambda and add them
+	SubVarVar,
+	AddVarPrim,  // Push variable 'Loc' and primitive 'Arg' to lambda and add them
+	SubVarPrim,
+	PopBindTwice,// Pop from 'Loc' and bind it, twice
+	PeekBind,    // Pop from 'Loc', bind it and push it straight back
+	BindVar      // Push variable 'Arg' to 'Loc' and pop it straight back
+};
+
+constexpr size_t k_NumOpCodes = static_cast<size_t>(OpCode::BindVar) + 1;
+
+const char *getOpName(OpCode op);
+
+// The number of instructions a superinstruction stands for
+size_t getOpLength(OpCode op);
+
+// Whether execution never falls through to the next instruction, i.e. the
+// next instruction can only be reached by returning to it (or not at all)
+bool isBlockBoundary(OpCode op);
+
+// The sorts of value a stack or variable may hold, as a set of bits
+using Sorts_t = uint8_t;
+
+constexpr Sorts_t k_PrimSort = 1;
+constexpr Sorts_t k_LocSort = 2;
+constexpr Sorts_t k_ClosureSort = 4;
+constexpr Sorts_t k_AnySort = k_PrimSort | k_LocSort | k_ClosureSort;
+
+struct Instr
+{
+	OpCode Op;
+	// The location operand is a location variable index rather than a location
+	bool IsLocIndex;
+	// The stack this pops from is known to hold enough values (see analyzeStacks)
+	bool IsSafe;
+	// The values this takes are known to be of the sort it expects as well
+	bool IsSorted;
+	uint32_t Loc;
+	uint32_t Arg;
+};
+
+template<typename Case_t>
+using CasesTable = CaseDispatch<Case_t, CodeAddr_t>;
+
+struct Function
+{
+	std::string Name;
+	TermHandle_t Term;
+	CodeAddr_t Entry;
+};
+
+// A program compiled to linear code. Every term that can be executed on its
+// own (function bodies, arguments of applications and branches of cases) is
+// compiled to a block which ends with 'Ret', so a closure is simply an
+// environment paired with the address of its block.
+class Bytecode
+{
+public:
+	explicit Bytecode(const Program &program, bool isFused = true);
+
+	std::optional<CodeAddr_t> getEntry() const;
+
+	// Finds the block of a term, compiling it if it was not part of the program
+	// (e.g. a term that was read as input)
+	CodeAddr_t compile(const TermHandle_t &term);
+
+	const Instr *getCode() const;
+	size_t getCodeSize() const;
+
+	// The instruction at an address before it was fused
+	const Instr &getOriginal(CodeAddr_t addr) const;
+
+	const Function &getFunction(uint32_t index) const;
+	// The applications whose arguments are pushed as closures
+	const TermHandle_t &getTerm(uint32_t index) const;
+	const CasesTable<Prim_t> &getPrimCases(uint32_t index) const;
+	const CasesTable<Loc_t> &getLocCases(uint32_t index) const;
+
+	// The term an instruction was compiled from, used for output and errors
+	const TermHandle_t &getSource(CodeAddr_t addr) const;
+
+	// The most values a location can hold while running the program's code,
+	// if that is bounded at all
+	std::optional<size_t> getMaxDepth(Loc_t loc) const;
+
+private:
+	void compilePending();
+	CodeAddr_t compileBlock(const TermHandle_t &term);
+
+	uint32_t requestFunction(FuncIndex_t funcIndex);
+	uint32_t addTerm(const TermHandle_t &term);
+
+	struct StackAnalysis;
+
+	void analyzeStacks();
+	void analyzeBlock(CodeAddr_t begin, StackAnalysis &analysis);
+	void boundStacks();
+
+	void fuse(CodeAddr_t begin, CodeAddr_t end);
+
+	void emit(OpCode op, const TermHandle_t &source, uint32_t arg = 0);
+	void emitWithLoc(OpCode op, const TermHandle_t &source, std::optional<Index_t> locIndex, Loc_t loc, uint32_t arg = 0);
+
+private:
+	const Program &m_Program;
+	bool m_IsFused;
+
+	std::vector<Instr> m_Code;
+	std::vector<Instr> m_Original;
+	std::vector<TermHandle_t> m_Sources;
+
+	// Functions are compiled on demand, in the order they are first called,
+	// so each program function maps to its compiled function once it has one
+	std::vector<Function> m_Funcs;
+	std::vector<std::optional<uint32_t>> m_FuncIndices;
+
+	std::vector<TermHandle_t> m_Terms;
+	std::vector<CasesTable<Prim_t>> m_PrimCases;
+	std::vector<CasesTable<Loc_t>> m_LocCases;
+
+	// Blocks are keyed by the term they start at, terms compiled from outside
+	// of the program are kept alive so their address is never reused
+	std::unordered_map<const Term *, CodeAddr_t> m_Blocks;
+	std::vector<TermHandle_t> m_ExternalTerms;
+	std::vector<uint32_t> m_PendingFuncs;
+
+	// The most values each location is pushed above the depth it had when a
+	// block started, no value once a block can leave values behind on it.
+	// Pushes through location variables count towards every location.
+	std::vector<std::optional<size_t>> m_MaxDepths;
+	size_t m_MaxIndexDepth = 0;
+	bool m_IsIndexUnbounded = false;
+
+	// The sorts each location may ever hold, and the sorts pushed through
+	// location variables which any location may hold, along with those
+	// gathered while analyzing which the next round assumes
+	std::vector<Sorts_t> m_LocSorts;
+	Sorts_t m_IndexSorts = 0;
+	std::vector<Sorts_t> m_PushedSorts;
+	Sorts_t m_PushedIndexSorts = 0;
+};
@@ -0,0 +1,70 @@
+#include "CallTrace.hpp"
+
+#include <sstream>
+
+#include "Utils.hpp"
+
+CallTrace::CallTrace(size_t capacity)
+	: m_Records(capacity)
+{}
+
+void CallTrace::clear()
+{
+	// Release the terms held by old records as well
+	m_Records.assign(m_Records.size(), Record{});
+	m_IsTail.clear();
+	m_Depth = 0;
+	m_NumKept = 0;
+}
+
+std::string CallTrace::format() const
+{
+	std::stringstream ss;
+
+	ss << "---- Call Stack ----" << '\n';
+
+	if (!isEnabled())
+	{
+		ss << "(not recorded, run with '--debug' or '--call-trace n' to record it)" << '\n';
+	}
+
+	for (size_t i = 0; i < m_NumKept; ++i)
+	{
+		const Record &record = m_Records[(m_Depth - 1 - i) % m_Records.size()];
+
+		ss << std::string(i, ' ') << "> ";
+
+		switch (record.Kind)
+		{
+		case CallKind::Main:
+			ss << "main";
+			break;
+		case CallKind::Func:
+			ss << record.Site->asVar().getVar();
+			break;
+		case CallKind::Binding:
+			ss << "Binding of '" << record.Site->asVar().getVar() << "'";
+			break;
+		case CallKind::PrimCase:
+			ss << "Case '" << static_cast<Prim_t>(record.Value) << "'";
+			break;
+		case CallKind::LocCase:
+			ss << "Case '" << getLocName(record.Value) << "'";
+			break;
+		case CallKind::Otherwise:
+			ss << "Case 'otherwise'";
+			break;
+		}
+
+		ss << " => " << stringifyTerm(record.Term) << "\n";
+	}
+
+	if (m_Depth > m_NumKept)
+	{
+		ss << std::string(m_NumKept, ' ') << "(" << m_Depth - m_NumKept << " more)" << "\n";
+	}
+
+	ss << "---------------";
+
+	return ss.str();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Config.hpp"
+#include "Term.hpp"
+
+// Records the most recent calls so that machine errors can show where they
+// happened. Recording is off unless a capacity is given, in which case only
+// that many of the innermost calls are kept (as a ring buffer) so programs
+// which recurse forever don't grow it. Records are only formatted into text
+// when they are actually printed.
+class CallTrace
+{
+public:
+	enum class CallKind : uint8_t
+	{
+		Main,      // The entry point
+		Func,      // A program function, named by the variable at the call site
+		Binding,   // A closure bound to the variable at the call site
+		PrimCase,  // A branch of primitive cases, 'Value' is the primitive
+		LocCase,   // A branch of location cases, 'Value' is the location
+		Otherwise  // The otherwise branch of cases
+	};
+
+	struct Record
+	{
+		CallKind Kind;
+		uint32_t Value;
+		TermHandle_t Site;
+		TermHandle_t Term;
+	};
+
+public:
+	explicit CallTrace(size_t capacity = 0);
+
+	bool isEnabled() const
+	{
+		return !m_Records.empty();
+	}
+
+	// A branch of cases in tail position has no continuation to return to, so
+	// it ends along with the call it belongs to, which stays on the trace
+	void push(CallKind kind, const TermHandle_t &site, const TermHandle_t &term, uint32_t value = 0, bool isTail = false)
+	{
+		if (isEnabled())
+		{
+			m_Records[m_Depth % m_Records.size()] = {kind, value, site, term};
+			m_IsTail.push_back(isTail);
+			m_Depth++;
+
+			if (m_NumKept < m_Records.size())
+			{
+				m_NumKept++;
+			}
+		}
+	}
+
+	// Ends the innermost call, along with the calls its tail branches belong to
+	void pop()
+	{
+		bool isTail = true;
+
+		while (isTail && m_Depth > 0)
+		{
+			isTail = m_IsTail.back();
+			m_IsTail.pop_back();
+			m_Depth--;
+
+			// Calls which were pushed out of the buffer can't be shown again
+			if (m_NumKept > 0)
+			{
+				m_NumKept--;
+			}
+		}
+	}
+
+	void clear();
+
+	std::string format() const;
+
+	// Visits the terms of the records that can still be printed
+	template<typename Visit_t>
+	void visitTerms(Visit_t visit) const
+	{
+		for (size_t i = 0; i < m_NumKept; ++i)
+		{
+			const Record &record = m_Records[(m_Depth - 1 - i) % m_Records.size()];
+
+			visit(record.Site.get());
+			visit(record.Term.get());
+		}
+	}
+
+private:
+	std::vector<Record> m_Records;
+	// Whether each call on the actual call stack is a tail branch, kept for
+	// every call (not just those in the buffer) so that the depth stays exact
+	std::vector<bool> m_IsTail;
+	// The depth of the actual call stack, which may be more than is kept
+	size_t m_Depth = 0;
+	size_t m_NumKept = 0;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Maps the keys of a cases term to branch targets, falling back to the
+// target of 'otherwise' for any other key. Keys that are compact (as most
+// primitive cases and every interned location are) are looked up in a jump
+// table with a single bounds check, sparse keys are found with a branchless
+// binary search over a sorted array.
+template<typename Case_t, typename Target_t>
+class CaseDispatch
+{
+public:
+	CaseDispatch() = default;
+
+	// Cases must be given in ascending order of their keys without duplicates,
+	// which is the order they are kept in by cases terms
+	CaseDispatch(const std::vector<std::pair<Case_t, Target_t>> &cases, Target_t otherwise)
+		: m_Otherwise(otherwise)
+	{
+		if (cases.empty())
+		{
+			return;
+		}
+
+		m_Min = cases.front().first;
+
+		int64_t range = static_cast<int64_t>(cases.back().first) - static_cast<int64_t>(m_Min) + 1;
+
+		// A jump table is used as long as it is at most about twice the size of
+		// the sorted arrays, small tables are always fine
+		if (range <= std::max<int64_t>(k_MinJumpTable, 2 * static_cast<int64_t>(cases.size())))
+		{
+			m_Targets.assign(static_cast<size_t>(range), otherwise);
+
+			for (const auto &[key, target] : cases)
+			{
+				m_Targets[getOffset(key)] = target;
+			}
+		}
+		else
+		{
+			m_IsSorted = true;
+
+			for (const auto &[key, target] : cases)
+			{
+				m_Keys.push_back(key);
+				m_Targets.push_back(target);
+			}
+		}
+	}
+
+	Target_t find(Case_t key) const
+	{
+		if (!m_IsSorted)
+		{
+			uint32_t offset = getOffset(key);
+			return offset < m_Targets.size() ? m_Targets[offset] : m_Otherwise;
+		}
+
+		// Halve the range without branching on the comparison, the compiler
+		// turns the select into a conditional move
+		const Case_t *base = m_Keys.data();
+		size_t size = m_Keys.size();
+
+		while (size > 1)
+		{
+			size_t half = size / 2;
+			base = (base[half] <= key) ? base + half : base;
+			size -= half;
+		}
+
+		return *base == key ? m_Targets[base - m_Keys.data()] : m_Otherwise;
+	}
+
+	Target_t getOtherwise() const
+	{
+		return m_Otherwise;
+	}
+
+private:
+	// Wraps around for keys below the minimum, so one comparison checks both bounds
+	uint32_t getOffset(Case_t key) const
+	{
+		return static_cast<uint32_t>(key) - static_cast<uint32_t>(m_Min);
+	}
+
+private:
+	static constexpr int64_t k_MinJumpTable = 16;
+
+	bool m_IsSorted = false;
+	Case_t m_Min = 0;
+	std::vector<Case_t> m_Keys;
+	std::vector<Target_t> m_Targets;
+	Target_t m_Otherwise{};
+};
@@ -5,13 +5,42 @@
 #include <cinttypes>
 
 using Var_t = std::string;
-using LocVar_t = std::string;
 
-using Loc_t = std::string;
+// Location names and location variables are interned to dense integer IDs
+// at parse time (see internLoc), the reserved locations always have the
+// first few IDs so they can be matched without any lookup
+using Loc_t = uint32_t;
+using LocVar_t = Loc_t;
+
+// Variable names are interned the same way (see internVar), but have IDs of
+// their own
+using VarId_t = uint32_t;
+
 using Prim_t = int32_t;
 
-const Loc_t k_LambdaLoc = "lambda";
-const Loc_t k_NewLoc     = "new";
-const Loc_t k_InputLoc   = "in";
-const Loc_t k_OutputLoc  = "out";
-const Loc_t k_NullLoc    = "null";
\ No newline at end of file
+// Arithmetic on primitives wraps around on overflow. It is done in the unsigned
+// type, where wrapping is defined, so that every engine, constant folding and
+// translated programs agree on the result
+constexpr Prim_t addPrims(Prim_t prim1, Prim_t prim2)
+{
+	return static_cast<Prim_t>(static_cast<uint32_t>(prim1) + static_cast<uint32_t>(prim2));
+}
+
+constexpr Prim_t subPrims(Prim_t prim1, Prim_t prim2)
+{
+	return static_cast<Prim_t>(static_cast<uint32_t>(prim1) - static_cast<uint32_t>(prim2));
+}
+
+// Lexical (de Bruijn) index of a bound variable or location variable
+using Index_t = uint32_t;
+
+// Index of a function in the program's function table
+using FuncIndex_t = uint32_t;
+
+constexpr Loc_t k_LambdaLoc = 0;
+constexpr Loc_t k_NewLoc    = 1;
+constexpr Loc_t k_InputLoc  = 2;
+constexpr Loc_t k_OutputLoc = 3;
+constexpr Loc_t k_NullLoc   = 4;
+
+constexpr Loc_t k_NumReservedLocs = 5;
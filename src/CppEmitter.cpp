@@ -0,0 +1,582 @@
+#include "CppEmitter.hpp"
+
+#include <cctype>
+
+#include "Utils.hpp"
+
+namespace
+{
+	std::string escapeString(const std::string &text)
+	{
+		std::string escaped;
+
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+
+		return escaped;
+	}
+
+	// Comments only need to hint at where a block came from
+	std::string getComment(const std::string &text)
+	{
+		constexpr size_t k_MaxLength = 60;
+		return text.size() > k_MaxLength ? text.substr(0, k_MaxLength) + " ..." : text;
+	}
+
+	bool isStackLoc(Loc_t loc)
+	{
+		return loc == k_LambdaLoc || loc >= k_NumReservedLocs;
+	}
+
+	bool isIdentChar(char c)
+	{
+		return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+	}
+
+	// Whether the emitted code refers to the name outside of string literals
+	bool usesName(const std::string &code, const std::string &name)
+	{
+		for (size_t i = 0; i < code.size(); )
+		{
+			if (code[i] == '"' || code[i] == '\'')
+			{
+				char quote = code[i++];
+				while (i < code.size() && code[i] != quote)
+				{
+					i += (code[i] == '\\') ? 2 : 1;
+				}
+				i++;
+			}
+			else if (isIdentChar(code[i]))
+			{
+				size_t begin = i;
+				while (i < code.size() && isIdentChar(code[i]))
+				{
+					i++;
+				}
+
+				if (code.compare(begin, i - begin, name) == 0 && i - begin == name.size())
+				{
+					return true;
+				}
+			}
+			else
+			{
+				i++;
+			}
+		}
+
+		return false;
+	}
+
+	// Parameters a block does not use are marked, so the translation builds
+	// without warnings about them
+	std::string getParam(const std::string &code, const std::string &type, const std::string &name)
+	{
+		return (usesName(code, name) ? "" : "[[maybe_unused]] ") + type + " &" + name;
+	}
+}
+
+std::optional<Index_t> CppEmitter::ShowScope::findVar(Index_t index) const
+{
+	if (index < NumVarBinders)
+	{
+		return std::nullopt;
+	}
+
+	index -= static_cast<Index_t>(NumVarBinders);
+	return Vars ? Vars.value()[index] : index;
+}
+
+std::optional<Index_t> CppEmitter::ShowScope::findLocVar(Index_t index) const
+{
+	if (index < NumLocVarBinders)
+	{
+		return std::nullopt;
+	}
+
+	index -= static_cast<Index_t>(NumLocVarBinders);
+	return LocVars ? LocVars.value()[index] : index;
+}
+
+CppEmitter::CppEmitter(const Program &program)
+	: m_Program(program)
+{}
+
+std::optional<std::string> CppEmitter::emit()
+{
+	auto mainOpt = m_Program.load("main");
+	if (!mainOpt)
+	{
+		return std::nullopt;
+	}
+
+	request(mainOpt.value(), "main");
+
+	// Blocks are requested as the code referring to them is emitted
+	std::stringstream code;
+
+	for (size_t index = 0; index < m_Blocks.size(); ++index)
+	{
+		std::stringstream body;
+		emitCode(body, index);
+
+		code << "// " << m_Blocks[index].Comment << '\n';
+		code << "static const NativeBlock *code" << index << "(" << getParam(body.str(), "NativeMachine", "m")
+			<< ", " << getParam(body.str(), "NativeEnv_t", "env") << ")\n";
+		code << "{\n";
+		code << body.str();
+		code << "}\n\n";
+	}
+
+	for (size_t index = 0; index < m_Blocks.size(); ++index)
+	{
+		if (m_Blocks[index].IsArg)
+		{
+			std::stringstream body;
+			emitShow(body, m_Blocks[index].Term, ShowScope{});
+			flushText(body);
+
+			code << "static void show" << index << "(" << getParam(body.str(), "NativeMachine", "m")
+				<< ", " << getParam(body.str(), "std::ostream", "os")
+				<< ", " << getParam(body.str(), "const NativeEnv_t", "env") << ")\n";
+			code << "{\n";
+			code << body.str();
+			code << "}\n\n";
+		}
+	}
+
+	std::stringstream ss;
+
+	ss << "// Translated by 'cfmc --emit-cpp', compile it with the cfmc sources on the include path:\n";
+	ss << "//   c++ -std=c++20 -O2 -I <cfmc>/src <this file>\n\n";
+	ss << "#include \"NativeRuntime.hpp\"\n\n";
+
+	for (size_t index = 0; index < m_Blocks.size(); ++index)
+	{
+		ss << "static const NativeBlock *code" << index << "(NativeMachine &m, NativeEnv_t &env);\n";
+
+		if (m_Blocks[index].IsArg)
+		{
+			ss << "static void show" << index << "(NativeMachine &m, std::ostream &os, const NativeEnv_t &env);\n";
+		}
+	}
+	ss << '\n';
+
+	for (size_t index = 0; index < m_Blocks.size(); ++index)
+	{
+		ss << "static const NativeBlock b" << index << " = {code" << index << ", ";
+		ss << (m_Blocks[index].IsArg ? "show" + std::to_string(index) : "nullptr") << "};\n";
+	}
+	ss << '\n';
+
+	ss << code.str();
+
+	ss << "int main()\n";
+	ss << "{\n";
+	ss << "\tNativeMachine machine({";
+	for (Loc_t loc = 0; loc < getNumLocs(); ++loc)
+	{
+		ss << (loc > 0 ? ", " : "") << '"' << escapeString(getLocName(loc)) << '"';
+	}
+	ss << "});\n";
+	ss << "\tmachine.run(&b0);\n";
+	ss << "}\n";
+
+	return ss.str();
+}
+
+size_t CppEmitter::request(const TermHandle_t &term, const std::string &comment)
+{
+	auto it = m_BlockIndices.find(term.get());
+	if (it != m_BlockIndices.end())
+	{
+		return it->second;
+	}
+
+	size_t index = m_Blocks.size();
+	m_Blocks.push_back({term, false, getComment(comment.empty() ? stringifyTerm(term) : comment)});
+	m_BlockIndices.emplace(term.get(), index);
+
+	return index;
+}
+
+size_t CppEmitter::requestArg(const TermHandle_t &term)
+{
+	size_t index = request(term);
+	m_Blocks[index].IsArg = true;
+	return index;
+}
+
+void CppEmitter::emitCode(std::ostream &os, size_t index)
+{
+	// Requests may add blocks, so the term is held on to rather than the block
+	TermHandle_t term = m_Blocks[index].Term;
+
+	for (TermHandle_t t = term; t; )
+	{
+		if (t->isNil())
+		{
+			os << "\treturn nullptr;\n";
+			t = nullptr;
+		}
+		else if (t->isVal())
+		{
+			os << "\tm.error(\"Value '" << escapeString(stringifyTerm(t)) << "' cannot be executed by machine !\");\n";
+			t = nullptr;
+		}
+		else if (t->isVar())
+		{
+			const VarTerm &var = t->asVar();
+
+			if (auto indexOpt = var.getIndex())
+			{
+				os << "\treturn m.callVar(env, " << indexOpt.value() << ", " << getContinuation(var.getBody()) << ");\n";
+			}
+			else if (auto funcIndexOpt = var.getFuncIndex())
+			{
+				size_t func = request(m_Program.getFunc(funcIndexOpt.value()), m_Program.getFuncName(funcIndexOpt.value()));
+				os << "\treturn m.call(env, &b" << func << ", " << getContinuation(var.getBody()) << ");\n";
+			}
+			else
+			{
+				os << "\tm.error(\"Variable '" << escapeString(var.getVar()) << "' is not bound to anything !\");\n";
+			}
+			t = nullptr;
+		}
+		else if (t->isApp())
+		{
+			const AppTerm &app = t->asApp();
+			TermHandle_t arg = app.getArg();
+			std::string value;
+
+			if (arg->isVal() && arg->asVal().isPrim())
+			{
+				value = "NativeValue_t(Prim_t(" + std::to_string(arg->asVal().asPrim()) + "))";
+			}
+			else if (arg->isVal())
+			{
+				value = "NativeValue_t(Loc_t(" + std::to_string(arg->asVal().asLoc()) + "))";
+			}
+			else if (arg->isVar() && arg->asVar().getIndex())
+			{
+				// The argument is resolved on its own, so the variable is its only capture
+				value = "*env.first.find(" + std::to_string(app.getCaptures()[arg->asVar().getIndex().value()]) + ")";
+			}
+			else
+			{
+				auto joinIndices = [](std::span<const Index_t> indices) {
+					std::string joined;
+					for (Index_t index : indices)
+					{
+						joined += (joined.empty() ? "" : ", ") + std::to_string(index);
+					}
+					return "{" + joined + "}";
+				};
+
+				value = "m.closure(env, " + joinIndices(app.getCaptures()) + ", " + joinIndices(app.getLocCaptures())
+					+ ", &b" + std::to_string(requestArg(arg)) + ")";
+			}
+
+			emitPush(os, app.getLocIndex(), app.getLoc(), value, false);
+			t = app.getBody();
+		}
+		else if (t->isAbs())
+		{
+			const AbsTerm &abs = t->asAbs();
+			std::string loc = getLocExpr(abs.getLocIndex(), abs.getLoc());
+
+			if (abs.isBinding())
+			{
+				os << "\tenv.first = env.first.bind(m.pop(" << loc << "));\n";
+			}
+			else
+			{
+				os << "\tm.pop(" << loc << ");\n";
+			}
+			t = abs.getBody();
+		}
+		else if (t->isLocApp())
+		{
+			const LocAppTerm &locApp = t->asLocApp();
+			std::string value = "NativeValue_t(Loc_t(" + getLocExpr(locApp.getArgIndex(), locApp.getArg()) + "))";
+
+			emitPush(os, locApp.getLocIndex(), locApp.getLoc(), value, true);
+			t = locApp.getBody();
+		}
+		else if (t->isLocAbs())
+		{
+			const LocAbsTerm &locAbs = t->asLocAbs();
+			std::string loc = getLocExpr(locAbs.getLocIndex(), locAbs.getLoc());
+
+			if (locAbs.getLocVar())
+			{
+				os << "\tenv.second = env.second.bind(m.popLoc(" << loc << "));\n";
+			}
+			else
+			{
+				os << "\tm.popLoc(" << loc << ");\n";
+			}
+			t = locAbs.getBody();
+		}
+		else if (t->isBinOp())
+		{
+			const BinOpTerm &binOp = t->asBinOp();
+
+			os << (binOp.isOp(BinOpTerm::Plus) ? "\tm.add();\n" : "\tm.sub();\n");
+			t = binOp.getBody();
+		}
+		else if (t->isPrimCases())
+		{
+			const CasesTerm<Prim_t> &cases = t->asPrimCases();
+			std::string cont = getContinuation(cases.getBody());
+
+			os << "\tswitch (m.popPrim(\"Primitive cases cannot match a non-primitive value !\"))\n";
+			os << "\t{\n";
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				os << "\tcase " << itCases->first << ":\n";
+				os << "\t\treturn m.branch(env, &b" << request(itCases->second) << ", " << cont << ");\n";
+			}
+			os << "\tdefault:\n";
+			os << "\t\treturn m.branch(env, &b" << request(cases.getOtherwise()) << ", " << cont << ");\n";
+			os << "\t}\n";
+			t = nullptr;
+		}
+		else if (t->isLocCases())
+		{
+			const CasesTerm<Loc_t> &cases = t->asLocCases();
+			std::string cont = getContinuation(cases.getBody());
+
+			os << "\tswitch (m.popLocValue(\"Location cases cannot match a non-location value !\"))\n";
+			os << "\t{\n";
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				os << "\tcase " << itCases->first << ": // " << getLocName(itCases->first) << '\n';
+				os << "\t\treturn m.branch(env, &b" << request(itCases->second) << ", " << cont << ");\n";
+			}
+			os << "\tdefault:\n";
+			os << "\t\treturn m.branch(env, &b" << request(cases.getOtherwise()) << ", " << cont << ");\n";
+			os << "\t}\n";
+			t = nullptr;
+		}
+	}
+}
+
+void CppEmitter::emitPush(std::ostream &os, std::optional<Index_t> locIndex, Loc_t loc, const std::string &value, bool isLocApp)
+{
+	if (!locIndex && isStackLoc(loc))
+	{
+		os << "\tm.getStack(" << getLocExpr(locIndex, loc) << ").push_back(" << value << ");\n";
+	}
+	// Pushing to null has no effect
+	else if (locIndex || loc != k_NullLoc)
+	{
+		os << "\tm.push(" << getLocExpr(locIndex, loc) << ", " << value << (isLocApp ? ", true" : "") << ");\n";
+	}
+}
+
+std::string CppEmitter::getLocExpr(std::optional<Index_t> locIndex, Loc_t loc) const
+{
+	if (locIndex)
+	{
+		return "*env.second.find(" + std::to_string(locIndex.value()) + ")";
+	}
+
+	return std::to_string(loc) + " /* " + getLocName(loc) + " */";
+}
+
+std::string CppEmitter::getContinuation(const TermHandle_t &body)
+{
+	return body->isNil() ? "nullptr" : "&b" + std::to_string(request(body));
+}
+
+// Follows stringifyClosure, except that whether a variable has a value is known
+// ahead of time so only the values themselves are looked up when printing
+void CppEmitter::emitShow(std::ostream &os, TermHandle_t term, ShowScope scope)
+{
+	for (int i = 0; term; ++i)
+	{
+		if (i > 0 && !term->isNil())
+		{
+			emitText(os, " . ");
+		}
+
+		if (term->isNil())
+		{
+			term = nullptr;
+		}
+		else if (term->isVar())
+		{
+			const VarTerm &var = term->asVar();
+			auto indexOpt = var.getIndex() ? scope.findVar(var.getIndex().value()) : std::nullopt;
+
+			if (indexOpt)
+			{
+				flushText(os);
+				os << "\tm.show(os, *env.first.find(" << indexOpt.value() << "));\n";
+			}
+			else
+			{
+				emitText(os, var.getVar());
+			}
+
+			term = var.getBody();
+		}
+		else if (term->isApp())
+		{
+			const AppTerm &app = term->asApp();
+
+			ShowScope argScope;
+			argScope.Vars.emplace();
+			argScope.LocVars.emplace();
+
+			for (Index_t index : app.getCaptures())
+			{
+				argScope.Vars->push_back(scope.findVar(index));
+			}
+			for (Index_t index : app.getLocCaptures())
+			{
+				argScope.LocVars->push_back(scope.findLocVar(index));
+			}
+
+			emitText(os, "[");
+			emitShow(os, app.getArg(), std::move(argScope));
+			emitText(os, "]");
+			emitShowLoc(os, scope, app.getLocIndex(), app.getLoc(), true);
+
+			term = app.getBody();
+		}
+		else if (term->isAbs())
+		{
+			const AbsTerm &abs = term->asAbs();
+
+			emitShowLoc(os, scope, abs.getLocIndex(), abs.getLoc(), true);
+			emitText(os, "<" + abs.getVar().value_or("_") + ">");
+
+			if (abs.isBinding())
+			{
+				scope.NumVarBinders++;
+			}
+
+			term = abs.getBody();
+		}
+		else if (term->isLocApp())
+		{
+			const LocAppTerm &locApp = term->asLocApp();
+
+			emitText(os, "[#");
+			emitShowLoc(os, scope, locApp.getArgIndex(), locApp.getArg(), false);
+			emitText(os, "]");
+			emitShowLoc(os, scope, locApp.getLocIndex(), locApp.getLoc(), true);
+
+			term = locApp.getBody();
+		}
+		else if (term->isLocAbs())
+		{
+			const LocAbsTerm &locAbs = term->asLocAbs();
+
+			emitShowLoc(os, scope, locAbs.getLocIndex(), locAbs.getLoc(), true);
+
+			if (locAbs.getLocVar())
+			{
+				scope.NumLocVarBinders++;
+			}
+
+			emitText(os, "<@" + (locAbs.getLocVar() ? getLocName(locAbs.getLocVar().value()) : "_") + ">");
+
+			term = locAbs.getBody();
+		}
+		else if (term->isVal())
+		{
+			const ValTerm &val = term->asVal();
+
+			emitText(os, val.isPrim() ? std::to_string(val.asPrim()) : "#" + getLocName(val.asLoc()));
+			term = nullptr;
+		}
+		else if (term->isBinOp())
+		{
+			const BinOpTerm &binOp = term->asBinOp();
+
+			emitText(os, binOp.isOp(BinOpTerm::Plus) ? "+" : "-");
+			term = binOp.getBody();
+		}
+		else if (term->isPrimCases())
+		{
+			const CasesTerm<Prim_t> &cases = term->asPrimCases();
+
+			emitText(os, "(");
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				emitText(os, std::to_string(itCases->first) + " -> ");
+				emitShow(os, itCases->second, scope);
+				emitText(os, ", ");
+			}
+			emitText(os, "otherwise -> ");
+			emitShow(os, cases.getOtherwise(), scope);
+			emitText(os, ")");
+
+			term = cases.getBody();
+		}
+		else if (term->isLocCases())
+		{
+			const CasesTerm<Loc_t> &cases = term->asLocCases();
+
+			emitText(os, "(");
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				emitText(os, getLocName(itCases->first) + " -> ");
+				emitShow(os, itCases->second, scope);
+				emitText(os, ", ");
+			}
+			emitText(os, "otherwise -> ");
+			emitShow(os, cases.getOtherwise(), scope);
+			emitText(os, ")");
+
+			term = cases.getBody();
+		}
+	}
+}
+
+void CppEmitter::emitShowLoc(std::ostream &os, const ShowScope &scope, std::optional<Index_t> locIndex, Loc_t loc, bool omitLambda)
+{
+	auto indexOpt = locIndex ? scope.findLocVar(locIndex.value()) : std::nullopt;
+
+	if (indexOpt)
+	{
+		flushText(os);
+
+		if (omitLambda)
+		{
+			os << "\tif (Loc_t loc = *env.second.find(" << indexOpt.value() << "); loc != k_LambdaLoc) os << m.getLocName(loc);\n";
+		}
+		else
+		{
+			os << "\tos << m.getLocName(*env.second.find(" << indexOpt.value() << "));\n";
+		}
+	}
+	else if (!omitLambda || loc != k_LambdaLoc)
+	{
+		emitText(os, getLocName(loc));
+	}
+}
+
+void CppEmitter::emitText(std::ostream &, const std::string &text)
+{
+	m_PendingText += text;
+}
+
+void CppEmitter::flushText(std::ostream &os)
+{
+	if (!m_PendingText.empty())
+	{
+		os << "\tos << \"" << escapeString(m_PendingText) << "\";\n";
+		m_PendingText.clear();
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <unordered_map>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+#include "Term.hpp"
+#include "Program.hpp"
+
+// Translates a program to a standalone C++ translation unit which runs on the
+// runtime in NativeRuntime.hpp. Terms are split into blocks like they are for
+// bytecode: function bodies, arguments which become closures, branches of cases
+// and the code that follows a call. Each block becomes a native function, and
+// each argument also gets a function which prints a closure of it the way the
+// machine would. Only the blocks which can be reached from 'main' are emitted.
+class CppEmitter
+{
+public:
+	explicit CppEmitter(const Program &program);
+
+	// The translated program, or nothing if it has no entry point
+	std::optional<std::string> emit();
+
+private:
+	struct Block
+	{
+		TermHandle_t Term;
+		// Closures can be made of the block, so it needs to be printable
+		bool IsArg = false;
+		std::string Comment;
+	};
+
+	// Where a variable of a term being printed is found in the environment of the
+	// closure it belongs to, if it has a value at all. Binders that are passed
+	// over while printing have no value, and the arguments of nested applications
+	// only see what they capture.
+	struct ShowScope
+	{
+		size_t NumVarBinders = 0;
+		size_t NumLocVarBinders = 0;
+
+		// The index in the closure's environment of each captured variable, the
+		// closure's own term uses its environment as it is
+		std::optional<std::vector<std::optional<Index_t>>> Vars;
+		std::optional<std::vector<std::optional<Index_t>>> LocVars;
+
+		std::optional<Index_t> findVar(Index_t index) const;
+		std::optional<Index_t> findLocVar(Index_t index) const;
+	};
+
+	size_t request(const TermHandle_t &term, const std::string &comment = "");
+	size_t requestArg(const TermHandle_t &term);
+
+	void emitCode(std::ostream &os, size_t index);
+	void emitPush(std::ostream &os, std::optional<Index_t> locIndex, Loc_t loc, const std::string &value, bool isLocApp);
+	std::string getLocExpr(std::optional<Index_t> locIndex, Loc_t loc) const;
+	std::string getContinuation(const TermHandle_t &body);
+
+	void emitShow(std::ostream &os, TermHandle_t term, ShowScope scope);
+	void emitShowLoc(std::ostream &os, const ShowScope &scope, std::optional<Index_t> locIndex, Loc_t loc, bool omitLambda);
+	void emitText(std::ostream &os, const std::string &text);
+	void flushText(std::ostream &os);
+
+private:
+	const Program &m_Program;
+
+	std::vector<Block> m_Blocks;
+	std::unordered_map<const Term *, size_t> m_BlockIndices;
+
+	// Text to print is gathered so that consecutive pieces are printed at once
+	std::string m_PendingText;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+
+#include "Config.hpp"
+
+// An immutable environment made from linked frames. Binding a value creates a
+// single new frame which shares all of its parent frames, so extending an
+// environment is O(1) and copying one is just a reference count increment.
+// Frames are addressed by the lexical index assigned by the resolver, where
+// index zero is the most recent binding.
+template<typename Val_t>
+class LinkedEnv
+{
+public:
+	LinkedEnv() = default;
+
+	LinkedEnv bind(Val_t val) const
+	{
+		return LinkedEnv(std::make_shared<const Frame>(
+			Frame{std::move(val), m_Head}
+		));
+	}
+
+	// Binds a frame without a value, this keeps indices lined up when a
+	// binder is passed over without a value for it (e.g. when stringifying)
+	LinkedEnv bindEmpty() const
+	{
+		return LinkedEnv(std::make_shared<const Frame>(
+			Frame{std::nullopt, m_Head}
+		));
+	}
+
+	const Val_t *find(Index_t index) const
+	{
+		const Frame *frame = m_Head.get();
+
+		for (; frame && index > 0; --index)
+		{
+			frame = frame->Parent.get();
+		}
+
+		return (frame && frame->Val) ? &frame->Val.value() : nullptr;
+	}
+
+	bool isEmpty() const
+	{
+		return m_Head == nullptr;
+	}
+
+	// Visits each frame from the most recent binding outwards with the frame's
+	// identity and value (null for empty frames). Returning false from the
+	// visitor skips the rest of the frames, which is useful when the frame has
+	// already been seen through another environment that shares it.
+	template<typename Visitor_t>
+	void visit(Visitor_t &&visitor) const
+	{
+		for (const Frame *frame = m_Head.get(); frame; frame = frame->Parent.get())
+		{
+			if (!visitor(static_cast<const void *>(frame), frame->Val ? &frame->Val.value() : nullptr))
+			{
+				return;
+			}
+		}
+	}
+
+private:
+	struct Frame
+	{
+		std::optional<Val_t> Val;
+		std::shared_ptr<const Frame> Parent;
+	};
+
+	explicit LinkedEnv(std::shared_ptr<const Frame> head)
+		: m_Head(std::move(head))
+	{}
+
+private:
+	std::shared_ptr<const Frame> m_Head;
+};
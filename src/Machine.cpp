@@ -1,8 +1,23 @@
 #include "Machine.hpp"
 
 #include <sstream>
+#include <unordered_set>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
 
 #include "Utils.hpp"
+#include "Resolver.hpp"
+#include "NodeTree.hpp"
+#include "NodeJit.hpp"
+
+// Labels as values are a GCC extension (also supported by Clang), define
+// CFMC_NO_COMPUTED_GOTO to use the portable switch dispatch instead
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CFMC_NO_COMPUTED_GOTO)
+#define CFMC_COMPUTED_GOTO
+#endif
 
 static void machineError(std::string message, const Machine &machine)
 {
@@ -35,42 +50,314 @@ static void machineError(std::string message, const Machine &machine)
 	std::exit(1);
 }
 
-static std::string locGenerator()
+std::optional<Loc_t> LocAllocator::allocate()
+{
+	if (!m_Free.empty())
+	{
+		Loc_t loc = m_Free.back();
+		m_Free.pop_back();
+		return loc;
+	}
+
+	return mint();
+}
+
+void LocAllocator::release(Loc_t loc)
+{
+	m_Free.push_back(loc);
+}
+
+std::optional<Loc_t> LocAllocator::mint()
+{
+	if (m_NextId == std::numeric_limits<Loc_t>::max())
+	{
+		return std::nullopt;
+	}
+
+	return m_NextId++;
+}
+
+bool LocAllocator::reserve(size_t numLocs)
+{
+	if (numLocs >= std::numeric_limits<Loc_t>::max())
+	{
+		return false;
+	}
+
+	m_NextId = std::max(m_NextId, static_cast<Loc_t>(numLocs));
+	return true;
+}
+
+void LocAllocator::reset()
+{
+	m_Free.clear();
+	m_NextId = static_cast<Loc_t>(::getNumLocs());
+}
+
+size_t LocAllocator::getNumLocs() const
+{
+	return m_NextId;
+}
+
+static_assert(sizeof(Prim_t) == sizeof(uint32_t) && sizeof(Loc_t) == sizeof(uint32_t), "Values keep primitives and locations in 32 bits");
+
+Value Value::fromPrim(Prim_t prim)
+{
+	return Value(Kind::Prim, static_cast<uint32_t>(prim), nullptr);
+}
+
+Value Value::fromLoc(Loc_t loc)
+{
+	return Value(Kind::Loc, loc, nullptr);
+}
+
+Value Value::fromClosure(ClosureRef_t closure)
+{
+	return Value(Kind::Closure, 0, std::move(closure));
+}
+
+Value::Value(Kind kind, uint32_t word, ClosureRef_t closure)
+	: m_Kind(kind)
+	, m_Word(word)
+	, m_Closure(std::move(closure))
+{}
+
+bool Value::isPrim() const
+{
+	return m_Kind == Kind::Prim;
+}
+
+bool Value::isLoc() const
+{
+	return m_Kind == Kind::Loc;
+}
+
+bool Value::isClosure() const
+{
+	return m_Kind == Kind::Closure;
+}
+
+Prim_t Value::asPrim() const
+{
+	return static_cast<Prim_t>(m_Word);
+}
+
+Loc_t Value::asLoc() const
+{
+	return m_Word;
+}
+
+const Closure_t &Value::asClosure() const
+{
+	return *m_Closure;
+}
+
+size_t Value::getKindOffset()
+{
+	Value value = fromPrim(0);
+	return static_cast<size_t>(reinterpret_cast<const uint8_t *>(&value.m_Kind) - reinterpret_cast<const uint8_t *>(&value));
+}
+
+size_t Value::getWordOffset()
+{
+	Value value = fromPrim(0);
+	return static_cast<size_t>(reinterpret_cast<const uint8_t *>(&value.m_Word) - reinterpret_cast<const uint8_t *>(&value));
+}
+
+ValueStack_t::ValueStack_t(ValueStack_t &&other) noexcept
+	: Begin(std::exchange(other.Begin, nullptr))
+	, End(std::exchange(other.End, nullptr))
+	, Cap(std::exchange(other.Cap, nullptr))
+{}
+
+ValueStack_t &ValueStack_t::operator=(ValueStack_t &&other) noexcept
+{
+	if (this != &other)
+	{
+		release();
+		Begin = std::exchange(other.Begin, nullptr);
+		End = std::exchange(other.End, nullptr);
+		Cap = std::exchange(other.Cap, nullptr);
+	}
+	return *this;
+}
+
+ValueStack_t::~ValueStack_t()
+{
+	release();
+}
+
+bool ValueStack_t::empty() const
+{
+	return End == Begin;
+}
+
+size_t ValueStack_t::size() const
+{
+	return static_cast<size_t>(End - Begin);
+}
+
+size_t ValueStack_t::capacity() const
+{
+	return static_cast<size_t>(Cap - Begin);
+}
+
+Value &ValueStack_t::back()
+{
+	return End[-1];
+}
+
+const Value &ValueStack_t::back() const
+{
+	return End[-1];
+}
+
+Value &ValueStack_t::operator[](size_t index)
+{
+	return Begin[index];
+}
+
+const Value &ValueStack_t::operator[](size_t index) const
+{
+	return Begin[index];
+}
+
+const Value *ValueStack_t::begin() const
+{
+	return Begin;
+}
+
+const Value *ValueStack_t::end() const
+{
+	return End;
+}
+
+std::reverse_iterator<const Value *> ValueStack_t::rbegin() const
+{
+	return std::reverse_iterator<const Value *>(End);
+}
+
+std::reverse_iterator<const Value *> ValueStack_t::rend() const
+{
+	return std::reverse_iterator<const Value *>(Begin);
+}
+
+void ValueStack_t::push_back(Value value)
+{
+	if (End == Cap)
+	{
+		reserve(std::max<size_t>(4, capacity() * 2));
+	}
+
+	*End = std::move(value);
+	++End;
+}
+
+void ValueStack_t::pop_back()
+{
+	--End;
+
+	// The slot may still hold a closure that was not moved out
+	if (End->isClosure())
+	{
+		*End = Value::fromPrim(0);
+	}
+}
+
+void ValueStack_t::reserve(size_t capacity)
+{
+	if (capacity <= this->capacity())
+	{
+		return;
+	}
+
+	Value *begin = static_cast<Value *>(::operator new(capacity * sizeof(Value)));
+	Value *end = std::uninitialized_move(Begin, End, begin);
+	std::uninitialized_fill(end, begin + capacity, Value::fromPrim(0));
+
+	release();
+	Begin = begin;
+	End = end;
+	Cap = begin + capacity;
+}
+
+void ValueStack_t::release()
+{
+	if (Begin)
+	{
+		std::destroy(Begin, Cap);
+		::operator delete(Begin);
+	}
+	Begin = End = Cap = nullptr;
+}
+
+Env_t captureEnv(const Env_t &env, const AppTerm &app)
 {
-	constexpr const char *k_Src = "xyzwv";
-	static int ptrs[] = {0, 0, 0, 0, 0};
+	std::span<const Index_t> captures = app.getCaptures();
+	std::span<const Index_t> locCaptures = app.getLocCaptures();
 
-	std::string str;
-	str += k_Src[ptrs[0] % 5];
-	str += k_Src[ptrs[1] % 5];
-	str += k_Src[ptrs[2] % 5];
-	str += k_Src[ptrs[3] % 5];
-	str += k_Src[ptrs[4] % 5];
+	// Bound from the last capture so that the first one ends up at index zero
+	Env_t captured;
 
-	if (ptrs[0] < 5 * 5 * 5 * 5 * 5 - 1)
+	for (size_t k = captures.size(); k > 0; --k)
+	{
+		const Value *valuePtr = env.first.find(captures[k - 1]);
+		captured.first = valuePtr ? captured.first.bind(*valuePtr) : captured.first.bindEmpty();
+	}
+	for (size_t k = locCaptures.size(); k > 0; --k)
 	{
-		ptrs[0] = (ptrs[0] + 1); 
-		ptrs[1] = (ptrs[1] + (ptrs[0] % 5 == 0));
-		ptrs[2] = (ptrs[2] + (ptrs[0] % 25 == 0));
-		ptrs[3] = (ptrs[3] + (ptrs[0] % 125 == 0));
-		ptrs[4] = (ptrs[4] + (ptrs[0] % 725 == 0));
+		const Loc_t *locPtr = env.second.find(locCaptures[k - 1]);
+		captured.second = locPtr ? captured.second.bind(*locPtr) : captured.second.bindEmpty();
 	}
 
-	return "loc_" + str;
+	return captured;
 }
 
+Machine::Machine(const MachineOptions &options)
+	: m_Options(options)
+	, m_CallTrace(options.CallTraceDepth)
+{}
+
 void Machine::execute(const Program &program)
 {
+	m_LocAllocator.reset();
+
 	m_Memory.clear();
+	resizeMemory(m_LocAllocator.getNumLocs());
 	m_Control.clear();
+	m_Frames.clear();
+	m_NodeFrames.clear();
+	m_CallTrace.clear();
+	m_Stats = {};
+
+	m_IsDynamicLoc.assign(m_LocAllocator.getNumLocs(), false);
+	m_DynamicLocs.clear();
+	m_AllocsSinceGc = 0;
+	m_NextGc = m_Options.GcThreshold;
+
+	switch (m_Options.Engine)
+	{
+	case ExecEngine::Tree:
+		executeTree(program);
+		break;
+	case ExecEngine::Bytecode:
+		executeBytecode(program);
+		break;
+	// The tiered engine shares the handlers of the node engine
+	case ExecEngine::Nodes:
+	case ExecEngine::Tiered:
+		executeNodes(program);
+		break;
+	}
+}
 
+void Machine::executeTree(const Program &program)
+{
 	if (auto termOpt = program.load("main"))
 	{
-		m_Control.push_back(
-			std::make_pair(Env_t{}, termOpt.value())
-		);
+		m_Control.emplace_back(Env_t{}, termOpt.value());
 
-		m_CallStack.push_back({"main", termOpt.value()});
+		m_CallTrace.push(CallTrace::CallKind::Main, nullptr, termOpt.value());
 	}
 	else
 	{
@@ -80,549 +367,2336 @@ void Machine::execute(const Program &program)
 
 	while (!m_Control.empty())
 	{
-		// Get the next environment and term
-		Closure_t closure = m_Control.back();
-		Env_t env = Env_t(closure.first);
-		TermHandle_t term = closure.second;
-		m_Control.pop_back();
-
-		if (term->isNil())
+		if (m_Options.MaxSteps > 0 && m_Stats.Steps >= m_Options.MaxSteps)
 		{
-			if (!m_CallStack.empty())
-			{
-				m_CallStack.pop_back();
-			}
+			break;
 		}
-		else if (term->isVar())
+
+		m_Stats.Steps++;
+
+		// Collect between steps so that every live environment is on the control stack
+		if (m_Options.GcThreshold > 0 && m_AllocsSinceGc >= m_NextGc)
 		{
-			const VarTerm &var = term->asVar();
+			collectGarbage();
+		}
+
+		stepTree(program);
+	}
+}
 
-			// Push continuation term
-			m_Control.push_back(std::make_pair(env, var.getBody()));
+void Machine::stepTree(const Program &program)
+{
+	// Get the next environment and term, environments are shared so
+	// this never copies the bindings themselves
+	Closure_t closure = std::move(m_Control.back());
+	Env_t env = closure.first;
+	TermHandle_t term = closure.second;
+	m_Control.pop_back();
+
+	if (term->isNil())
+	{
+		m_CallTrace.pop();
+	}
+	else if (term->isVar())
+	{
+		const VarTerm &var = term->asVar();
 
-			// We found term in our environment
-			auto itEnv = env.first.find(var.getVar());
-			if (itEnv != env.first.end())
+		// Push continuation term, unless this is a tail call and there is nothing
+		// left to continue with. The callee then returns straight to our caller,
+		// so it takes over our entry in the call stack as well.
+		auto pushContinuation = [&]() {
+			if (!var.getBody()->isNil())
+			{
+				m_Control.emplace_back(env, var.getBody());
+			}
+			else
 			{
-				// Push bound term
-				auto closurePtr = itEnv->second;
-				Closure_t *closure = reinterpret_cast<Closure_t *>(closurePtr.get());
-				m_Control.push_back(*closure);
-				m_CallStack.push_back({"Binding of '" + var.getVar() + "'", closure->second});
+				m_CallTrace.pop();
 			}
-			// We found term in our program functions
-			else if (auto termOpt = program.load(var.getVar()))
+		};
+
+		// We found term in our environment
+		if (auto indexOpt = var.getIndex())
+		{
+			const Value &value = *env.first.find(indexOpt.value());
+
+			// Push bound term
+			if (value.isClosure())
 			{
-				// Push program function
-				m_Control.push_back(std::make_pair(Env_t{}, termOpt.value()));
-				m_CallStack.push_back({var.getVar(), termOpt.value()});
+				const Closure_t &closure = value.asClosure();
+				pushContinuation();
+				m_Control.push_back(closure);
+				m_CallTrace.push(CallTrace::CallKind::Binding, term, closure.second);
 			}
-			// We didn't find our term anywhere.. error !
 			else
 			{
-				machineError("Variable '" + var.getVar() + "' "
-					+ "is not bound to anything !", *this);
+				machineError("Value '" + stringifyValue(value)
+					+ "' cannot be executed by machine !", *this);
 			}
 		}
-		else if (term->isApp())
+		// The resolver linked our term to a program function
+		else if (auto funcIndexOpt = var.getFuncIndex())
 		{
-			const AppTerm &app = term->asApp();
-
-			m_Control.push_back(std::make_pair(env, app.getBody()));
+			const TermHandle_t &func = program.getFunc(funcIndexOpt.value());
 
-			auto appActionWithLoc = [&](Loc_t loc) {
-				// New stream
-				if (loc == k_NewLoc)
-				{
-					machineError("Application cannot push to 'new' location !", *this);
-				}
-				// Input stream
-				else if (loc == k_InputLoc)
-				{
-					machineError("Application cannot push to 'input' location !", *this);
-				}
-				// Output stream
-				else if (loc == k_OutputLoc)
-				{
-					std::cout << stringifyClosure(std::make_pair(env, app.getArg())) << std::endl;
-				}
-				// Null stream
-				else if (loc == k_NullLoc)
-				{}
-				// Generic stack
-				else
-				{
-					// If we have variables that are bound to values, then push them directly
-					// instead of as variables. This makes it much easier to deal with values
-					// in binary operations and cases etc.
-
-					bool hasPushedAsValue = false;
-					
-					if (app.getArg()->isVar())
-					{
-						const VarTerm &var = app.getArg()->asVar();
-
-						auto itEnv = env.first.find(var.getVar());
-						if (itEnv != env.first.end())
-						{
-							auto closurePtr = itEnv->second;
-							Closure_t *closure = reinterpret_cast<Closure_t *>(closurePtr.get());
-
-							if (closure->second->isVal())
-							{
-								m_Memory[loc].push_back(*closure);
-								hasPushedAsValue = true;
-							}
-						}
-					}
+			// Push program function
+			pushContinuation();
+			m_Control.emplace_back(Env_t{}, func);
+			m_CallTrace.push(CallTrace::CallKind::Func, term, func);
+		}
+		// We didn't find our term anywhere.. error !
+		else
+		{
+			machineError("Variable '" + var.getVar() + "' "
+				+ "is not bound to anything !", *this);
+		}
+	}
+	else if (term->isApp())
+	{
+		const AppTerm &app = term->asApp();
 
-					if (!hasPushedAsValue)
-					{
-						m_Memory[loc].push_back(std::make_pair(env, app.getArg()));
-					}
-				}
-			};
+		m_Control.emplace_back(env, app.getBody());
 
-			auto itEnv = env.second.find(app.getLoc());
-			if (itEnv != env.second.end())
+		auto appActionWithLoc = [&](Loc_t loc) {
+			// New stream
+			if (loc == k_NewLoc)
 			{
-				appActionWithLoc(itEnv->second);
+				machineError("Application cannot push to 'new' location !", *this);
 			}
-			else if (isReservedLoc(app.getLoc()))
+			// Input stream
+			else if (loc == k_InputLoc)
 			{
-				appActionWithLoc(app.getLoc());
+				machineError("Application cannot push to 'input' location !", *this);
 			}
-			else
+			// Output stream
+			else if (loc == k_OutputLoc)
 			{
-				machineError("Application cannot push to (invalid) location '"
-					+ app.getLoc() + "' !", *this);
+				std::cout << stringifyClosure(Closure_t(captureEnv(env, app), app.getArg())) << std::endl;
 			}
-		}
-		else if (term->isAbs())
-		{
-			const AbsTerm &abs = term->asAbs();
+			// Null stream
+			else if (loc == k_NullLoc)
+			{}
+			// Generic stack
+			else
+			{
+				// Literal values and variables that are bound to values are pushed
+				// directly (unboxed) instead of as closures. This makes it much easier
+				// to deal with values in binary operations and cases etc.
 
-			auto absActionWithLoc = [&](Loc_t loc) {
-				// New stream
-				if (loc == k_NewLoc)
+				bool hasPushedAsValue = false;
+				
+				if (app.getArg()->isVal())
 				{
-					Loc_t newLoc = locGenerator();
-					m_Memory[newLoc] = {};
-
-					if (abs.getVar())
-					{
-						env.first[abs.getVar().value()] = std::make_shared<Closure_t>(std::make_pair(
-							Env_t{}, freshTerm(ValTerm(newLoc))
-						));
-					}
+					const ValTerm &val = app.getArg()->asVal();
 
-					m_Control.push_back(std::make_pair(env, abs.getBody()));
+					m_Memory[loc].push_back(val.isPrim()
+						? Value::fromPrim(val.asPrim())
+						: Value::fromLoc(val.asLoc()));
+					hasPushedAsValue = true;
 				}
-				// Input stream
-				else if (loc == k_InputLoc)
+				else if (app.getArg()->isVar())
 				{
-					std::string in;
-					std::cin >> in;
+					const VarTerm &var = app.getArg()->asVar();
 
-					Parser parser;
-					if (auto termOpt = parser.parseTerm(in))
+					if (auto indexOpt = var.getIndex())
 					{
-						if (abs.getVar())
+						// The argument is resolved on its own, so the variable is its only capture
+						const Value &value = *env.first.find(app.getCaptures()[indexOpt.value()]);
+
+						if (!value.isClosure())
 						{
-							env.first[abs.getVar().value()] = std::make_shared<Closure_t>(std::make_pair(
-								Env_t{}, freshTerm(std::move(termOpt.value()))
-							));
+							m_Memory[loc].push_back(value);
+							hasPushedAsValue = true;
 						}
-
-						m_Control.push_back(std::make_pair(env, abs.getBody()));
-					}
-					else
-					{
-						machineError("Cannot parse input '"
-							+ in + "' as term !", *this);
 					}
 				}
-				// Output stream
-				else if (loc == k_OutputLoc)
+
+				if (!hasPushedAsValue)
 				{
-					machineError("Abstraction cannot bind from 'output' location !", *this);
+					m_Memory[loc].push_back(Value::fromClosure(
+						std::make_shared<const Closure_t>(captureEnv(env, app), app.getArg())
+					));
 				}
-				// Null stream
-				else if (loc == k_NullLoc)
+			}
+		};
+
+		if (auto indexOpt = app.getLocIndex())
+		{
+			appActionWithLoc(*env.second.find(indexOpt.value()));
+		}
+		else
+		{
+			appActionWithLoc(app.getLoc());
+		}
+	}
+	else if (term->isAbs())
+	{
+		const AbsTerm &abs = term->asAbs();
+
+		auto absActionWithLoc = [&](Loc_t loc) {
+			// New stream
+			if (loc == k_NewLoc)
+			{
+				Loc_t loc = newLoc();
+
+				if (abs.isBinding())
 				{
-					machineError("Abstraction cannot bind from 'null' location !", *this);
+					env.first = env.first.bind(Value::fromLoc(loc));
 				}
-				// Generic stack
-				else
-				{
-					if (auto closureOpt = tryPop(env, loc))
-					{
-						if (abs.getVar())
-						{
-							env.first[abs.getVar().value()] = std::make_shared<Closure_t>(closureOpt.value());
-						}
 
-						m_Control.push_back(std::make_pair(env, abs.getBody()));
-					}
-					else
-					{
-						machineError("Abstraction cannot pop from location '"
-							+ loc + "' !", *this);
-					}
+				m_Control.emplace_back(env, abs.getBody());
+			}
+			// Input stream
+			else if (loc == k_InputLoc)
+			{
+				Value value = readInput(program);
+
+				if (abs.isBinding())
+				{
+					env.first = env.first.bind(std::move(value));
 				}
-			};
 
-			auto itEnv = env.second.find(abs.getLoc());
-			if (itEnv != env.second.end())
+				m_Control.emplace_back(env, abs.getBody());
+			}
+			// Output stream
+			else if (loc == k_OutputLoc)
 			{
-				absActionWithLoc(itEnv->second);
+				machineError("Abstraction cannot bind from 'output' location !", *this);
 			}
-			else if (isReservedLoc(abs.getLoc()))
+			// Null stream
+			else if (loc == k_NullLoc)
 			{
-				absActionWithLoc(abs.getLoc());
+				machineError("Abstraction cannot bind from 'null' location !", *this);
 			}
+			// Generic stack
 			else
 			{
-				machineError("Abstraction cannot pop from (invalid) location '"
-					+ abs.getLoc() + "' !", *this);
-			}
-		}
-		else if (term->isLocApp())
-		{
-			const LocAppTerm &locApp = term->asLocApp();
-
-			m_Control.push_back(std::make_pair(env, locApp.getBody()));
-
-			auto appActionWithLoc = [&](Loc_t loc) {
-				// New stream
-				if (loc == k_NewLoc)
-				{
-					machineError("Location application cannot push to 'new' location ! ", *this);
-				}
-				// Input stream
-				else if (loc == k_InputLoc)
+				if (auto valueOpt = tryPop(loc))
 				{
-					machineError("Location application cannot push to 'input' location ! ", *this);
+					if (abs.isBinding())
+					{
+						env.first = env.first.bind(std::move(valueOpt.value()));
+					}
+
+					m_Control.emplace_back(env, abs.getBody());
 				}
-				// Null stream
-				else if (loc == k_NullLoc)
-				{}
 				else
 				{
-					Loc_t locArg = locApp.getArg();
+					machineError("Abstraction cannot pop from location '"
+						+ getLocName(loc) + "' !", *this);
+				}
+			}
+		};
 
-					auto itEnv = env.second.find(locApp.getArg());
-					if (itEnv != env.second.end())
-					{
-						locArg = itEnv->second;
-					}
+		if (auto indexOpt = abs.getLocIndex())
+		{
+			absActionWithLoc(*env.second.find(indexOpt.value()));
+		}
+		else
+		{
+			absActionWithLoc(abs.getLoc());
+		}
+	}
+	else if (term->isLocApp())
+	{
+		const LocAppTerm &locApp = term->asLocApp();
 
-					// Output stream
-					if (loc == k_OutputLoc)
-					{
-						std::cout << stringifyClosure(std::make_pair(env, freshTerm(ValTerm(locArg)))) << std::endl;
-					}
-					// Generic stack
-					else
-					{
-						m_Memory[loc].push_back(std::make_pair(env, freshTerm(ValTerm(locArg))));
-					}
-				}
-			};
+		m_Control.emplace_back(env, locApp.getBody());
 
-			auto itEnv = env.second.find(locApp.getLoc());
-			if (itEnv != env.second.end())
+		auto appActionWithLoc = [&](Loc_t loc) {
+			// New stream
+			if (loc == k_NewLoc)
 			{
-				appActionWithLoc(itEnv->second);
+				machineError("Location application cannot push to 'new' location ! ", *this);
 			}
-			else if (isReservedLoc(locApp.getLoc()))
+			// Input stream
+			else if (loc == k_InputLoc)
 			{
-				appActionWithLoc(locApp.getLoc());
+				machineError("Location application cannot push to 'input' location ! ", *this);
 			}
+			// Null stream
+			else if (loc == k_NullLoc)
+			{}
 			else
 			{
-				machineError("Location application cannot push to (invalid) location '"
-					+ locApp.getLoc() + "' !", *this);
-			}
-		}
-		else if (term->isLocAbs())
-		{
-			const LocAbsTerm &locAbs = term->asLocAbs();
-			
-			auto absActionWithLoc = [&](Loc_t loc) {
-				// New stream
-				if (loc == k_NewLoc)
+				Loc_t locArg = locApp.getArg();
+
+				if (auto indexOpt = locApp.getArgIndex())
 				{
-					Loc_t newLoc = locGenerator();
-					m_Memory[newLoc] = {};
+					locArg = *env.second.find(indexOpt.value());
+				}
 
+				// Output stream
+				if (loc == k_OutputLoc)
+				{
+					std::cout << stringifyValue(Value::fromLoc(locArg)) << std::endl;
+				}
+				// Generic stack
+				else
+				{
+					m_Memory[loc].push_back(Value::fromLoc(locArg));
+				}
+			}
+		};
+
+		if (auto indexOpt = locApp.getLocIndex())
+		{
+			appActionWithLoc(*env.second.find(indexOpt.value()));
+		}
+		else
+		{
+			appActionWithLoc(locApp.getLoc());
+		}
+	}
+	else if (term->isLocAbs())
+	{
+		const LocAbsTerm &locAbs = term->asLocAbs();
+		
+		auto absActionWithLoc = [&](Loc_t loc) {
+			// New stream
+			if (loc == k_NewLoc)
+			{
+				Loc_t loc = newLoc();
+
+				if (locAbs.getLocVar())
+				{
+					env.second = env.second.bind(loc);
+				}
+
+				m_Control.emplace_back(env, locAbs.getBody());
+			}
+			// Input stream
+			else if (loc == k_InputLoc)
+			{
+				machineError("Location abstraction cannot pop from 'input' location !", *this);
+			}
+			// Output stream
+			else if (loc == k_OutputLoc)
+			{
+				machineError("Location abstraction cannot pop from 'output' location !", *this);
+			}
+			// Null stream
+			else if (loc == k_NullLoc)
+			{
+				machineError("Location abstraction cannot pop from 'null' location !", *this);
+			}
+			// Generic stack
+			else
+			{
+				if (auto locOpt = tryPopLoc(loc))
+				{
 					if (locAbs.getLocVar())
 					{
-						env.second[locAbs.getLocVar().value()] = newLoc;
+						env.second = env.second.bind(locOpt.value());
 					}
 
-					m_Control.push_back(std::make_pair(env, locAbs.getBody()));
+					m_Control.emplace_back(env, locAbs.getBody());
 				}
-				// Input stream
-				else if (loc == k_InputLoc)
+				else
 				{
-					machineError("Location abstraction cannot pop from 'input' location !", *this);
+					machineError("Location abstraction cannot pop from location '"
+						+ getLocName(loc) + "' !", *this);
 				}
-				// Output stream
-				else if (loc == k_OutputLoc)
+			}
+		};
+
+		if (auto indexOpt = locAbs.getLocIndex())
+		{
+			absActionWithLoc(*env.second.find(indexOpt.value()));
+		}
+		else
+		{
+			absActionWithLoc(locAbs.getLoc());
+		}
+	}
+	else if (term->isVal())
+	{
+		machineError("Value '" + stringifyClosure(closure)
+			+ "' cannot be executed by machine !", *this);
+	}
+	else if (term->isBinOp())
+	{
+		const BinOpTerm &binOp = term->asBinOp();
+
+		m_Control.emplace_back(env, binOp.getBody());
+
+		if (auto prim1Opt = tryPopPrim(k_LambdaLoc))
+		{
+			if (auto prim2Opt = tryPopPrim(k_LambdaLoc))
+			{
+				auto prim1 = prim1Opt.value();
+				auto prim2 = prim2Opt.value();
+
+				if (binOp.isOp(BinOpTerm::Plus))
 				{
-					machineError("Location abstraction cannot pop from 'output' location !", *this);
+					m_Memory[k_LambdaLoc].push_back(Value::fromPrim(addPrims(prim2, prim1)));
 				}
-				// Null stream
-				else if (loc == k_NullLoc)
+				else if (binOp.isOp(BinOpTerm::Minus))
 				{
-					machineError("Location abstraction cannot pop from 'null' location !", *this);
+					m_Memory[k_LambdaLoc].push_back(Value::fromPrim(subPrims(prim2, prim1)));
 				}
-				// Generic stack
-				else
-				{
-					if (auto locOpt = tryPopLoc(env, loc))
-					{
-						if (locAbs.getLocVar())
-						{
-							env.second[locAbs.getLocVar().value()] = locOpt.value();
-						}
+			}
+			else
+			{
+				machineError("Binary operation cannot use a non-primitive-value as second operand !", *this);
+			}
+		}
+		else
+		{
+			machineError("Binary operation cannot use a non-primitive-value as first operand !", *this);
+		}
+	}
+	else if (term->isPrimCases())
+	{
+		const CasesTerm<Prim_t> &cases = term->asPrimCases();
+
+		if (auto primOpt = tryPopPrim(k_LambdaLoc))
+		{
+			// Like calls, a cases in tail position doesn't need its continuation,
+			// its branch ends the enclosing call instead
+			bool isTail = cases.getBody()->isNil();
+
+			if (!isTail)
+			{
+				m_Control.emplace_back(env, cases.getBody());
+			}
+
+			uint32_t branch = cases.selectBranch(primOpt.value());
+			m_Control.emplace_back(env, cases.getBranch(branch));
+
+			if (!cases.isOtherwise(branch))
+			{
+				m_CallTrace.push(CallTrace::CallKind::PrimCase, nullptr, closure.second, static_cast<uint32_t>(primOpt.value()), isTail);
+			}
+			else
+			{
+				m_CallTrace.push(CallTrace::CallKind::Otherwise, nullptr, closure.second, 0, isTail);
+			}
+		}
+		else
+		{
+			machineError("Primitive cases cannot match a non-primitive value !", *this);
+		}
+	}
+	else if (term->isLocCases())
+	{
+		const CasesTerm<Loc_t> &cases = term->asLocCases();
+
+		if (auto locOpt = tryPopLoc(k_LambdaLoc))
+		{
+			bool isTail = cases.getBody()->isNil();
+
+			if (!isTail)
+			{
+				m_Control.emplace_back(env, cases.getBody());
+			}
+
+			uint32_t branch = cases.selectBranch(locOpt.value());
+			m_Control.emplace_back(env, cases.getBranch(branch));
+
+			if (!cases.isOtherwise(branch))
+			{
+				m_CallTrace.push(CallTrace::CallKind::LocCase, nullptr, closure.second, locOpt.value(), isTail);
+			}
+			else
+			{
+				m_CallTrace.push(CallTrace::CallKind::Otherwise, nullptr, closure.second, 0, isTail);
+			}
+		}
+		else
+		{
+			machineError("Location cases cannot match a non-location value !", *this);
+		}
+	}
+}
+
+void Machine::executeBytecode(const Program &program)
+{
+	// Profiling counts adjacent instructions as they were compiled, so nothing
+	// is fused while doing so
+	Bytecode bytecode(program, m_Options.Superinstructions && !m_Options.ProfileOps);
+
+	auto entryOpt = bytecode.getEntry();
+	if (!entryOpt)
+	{
+		machineError("Program has no entry point ('main' is not defined)!", *this);
+		return;
+	}
+
+	// Locations that are bounded get all the room they need up front
+	for (Loc_t loc = 0; loc < m_Memory.size(); ++loc)
+	{
+		if (auto depthOpt = bytecode.getMaxDepth(loc))
+		{
+			m_Memory[loc].reserve(depthOpt.value());
+		}
+	}
+
+	m_CallTrace.push(CallTrace::CallKind::Main, nullptr, bytecode.getFunction(0).Term);
+
+	// The current closure is kept in registers, only continuations are pushed
+	// to the frame stack
+	Env_t env;
+	CodeAddr_t pc = entryOpt.value();
+	const Instr *code = bytecode.getCode();
+
+	auto resolveLoc = [&](const Instr &instr) -> Loc_t {
+		return instr.IsLocIndex ? *env.second.find(instr.Loc) : instr.Loc;
+	};
+
+	auto isStackLoc = [](Loc_t loc) {
+		return loc == k_LambdaLoc || loc >= k_NumReservedLocs;
+	};
+
+	// Pushes to reserved locations are rare, so they share one slow path
+	auto pushReserved = [&](const Instr &instr, Loc_t loc) {
+		const TermHandle_t &source = bytecode.getSource(pc);
+		const std::string kind = source->isLocApp() ? "Location application" : "Application";
+
+		// New stream
+		if (loc == k_NewLoc)
+		{
+			machineError(kind + " cannot push to 'new' location !", *this);
+		}
+		// Input stream
+		else if (loc == k_InputLoc)
+		{
+			machineError(kind + " cannot push to 'input' location !", *this);
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			if (source->isLocApp())
+			{
+				Loc_t locArg = instr.Op == OpCode::PushLocVar ? *env.second.find(instr.Arg) : instr.Arg;
+				std::cout << stringifyValue(Value::fromLoc(locArg)) << std::endl;
+			}
+			else
+			{
+				std::cout << stringifyClosure(Closure_t(captureEnv(env, source->asApp()), source->asApp().getArg())) << std::endl;
+			}
+		}
+		// Null stream is discarded
+	};
+
+	auto collectIfNeeded = [&]() {
+		if (m_Options.GcThreshold > 0 && m_AllocsSinceGc >= m_NextGc)
+		{
+			// The current environment is a root as well
+			m_Frames.push_back({env, pc});
+			collectGarbage();
+			m_Frames.pop_back();
+		}
+	};
+
+	// Every handler ends by dispatching the next instruction itself. With
+	// computed goto this is an indirect jump straight to the handler stored
+	// for that address (direct threading), which gives each handler its own
+	// branch history, otherwise it falls back to a portable switch.
+	uint64_t steps = 0;
+	const uint64_t maxSteps = m_Options.MaxSteps > 0 ? m_Options.MaxSteps : ~uint64_t(0);
+	const Instr *instr = nullptr;
+
+	// Only pairs where the second instruction is reached by falling through
+	// from the first are counted, as only those could ever be fused
+	auto profileOp = [&]() {
+		if (pc == 0)
+		{
+			return;
+		}
+
+		OpCode prev = code[pc - 1].Op;
+
+		if (isBlockBoundary(prev))
+		{
+			return;
+		}
+
+		m_Stats.OpPairs[static_cast<size_t>(prev) * k_NumOpCodes + static_cast<size_t>(instr->Op)]++;
+	};
+
+	if (m_Options.ProfileOps)
+	{
+		m_Stats.OpPairs.assign(k_NumOpCodes * k_NumOpCodes, 0);
+	}
+
+#if defined(CFMC_COMPUTED_GOTO)
+	static void *const k_Handlers[] = {
+		&&op_Ret, &&op_Call, &&op_CallVar, &&op_TailCall, &&op_TailCallVar,
+		&&op_PushPrim, &&op_PushLoc, &&op_PushLocVar, &&op_PushVar, &&op_PushClosure,
+		&&op_Pop, &&op_PopBind, &&op_PopLoc, &&op_PopLocBind,
+		&&op_Add, &&op_Sub,
+		&&op_PrimCases, &&op_LocCases, &&op_TailPrimCases, &&op_TailLocCases,
+		&&op_Fail,
+		&&op_PushVarVar, &&op_PushVarCall, &&op_PushPrimCall, &&op_PushLocCall,
+		&&op_PushVarTailCall, &&op_PushPrimTailCall, &&op_PushLocTailCall, &&op_PushVarRet,
+		&&op_AddVarVar, &&op_SubVarVar, &&op_AddVarPrim, &&op_SubVarPrim,
+		&&op_PopBindTwice, &&op_PeekBind, &&op_BindVar
+	};
+	static_assert(sizeof(k_Handlers) / sizeof(k_Handlers[0]) == k_NumOpCodes);
+
+	std::vector<void *> threaded;
+	void *const *threadedCode = nullptr;
+	void *const profileHandler = &&op_Profile;
+
+	// Code may grow while running (input terms are compiled when called), so
+	// this threads any instructions that have been added since. When profiling
+	// every instruction goes through the profiler first, so that the cost is
+	// only paid when asked for.
+	auto threadCode = [&]() {
+		for (size_t addr = threaded.size(); addr < bytecode.getCodeSize(); ++addr)
+		{
+			threaded.push_back(m_Options.ProfileOps ? profileHandler : k_Handlers[static_cast<size_t>(code[addr].Op)]);
+		}
+		threadedCode = threaded.data();
+	};
+	threadCode();
+
+	#define VM_CASE(op) op_##op
+	#define VM_NEXT()                                            \
+		do                                                       \
+		{                                                        \
+			if (steps >= maxSteps) goto halt;                    \
+			steps++;                                             \
+			instr = &code[pc];                                   \
+			goto *threadedCode[pc];                              \
+		} while (false)
+	#define VM_UNFUSED()                                         \
+		do                                                       \
+		{                                                        \
+			instr = &bytecode.getOriginal(pc);                   \
+			goto *k_Handlers[static_cast<size_t>(instr->Op)];    \
+		} while (false)
+
+	VM_NEXT();
+
+op_Profile:
+	profileOp();
+	goto *k_Handlers[static_cast<size_t>(instr->Op)];
+#else
+	#define VM_CASE(op) case OpCode::op
+	#define VM_NEXT() break
+	#define VM_UNFUSED()                                         \
+		do                                                       \
+		{                                                        \
+			instr = &bytecode.getOriginal(pc);                   \
+			goto dispatch;                                       \
+		} while (false)
+
+	auto threadCode = []() {};
+
+	while (true)
+	{
+		if (steps >= maxSteps)
+		{
+			goto halt;
+		}
+
+		steps++;
+		instr = &code[pc];
+
+		if (m_Options.ProfileOps)
+		{
+			profileOp();
+		}
+
+	dispatch:
+		switch (instr->Op)
+		{
+#endif
+	VM_CASE(Ret):
+	{
+		m_CallTrace.pop();
+
+		if (m_Frames.empty())
+		{
+			goto halt;
+		}
+
+		env = std::move(m_Frames.back().Env);
+		pc = m_Frames.back().Pc;
+		m_Frames.pop_back();
+		VM_NEXT();
+	}
+	VM_CASE(Call):
+	VM_CASE(TailCall):
+	{
+		const Function &func = bytecode.getFunction(instr->Arg);
+
+		// A tail call returns straight to our caller, so it takes over our entry
+		// in the call stack instead of saving a continuation
+		if (instr->Op == OpCode::Call)
+		{
+			m_Frames.push_back({std::move(env), pc + 1});
+		}
+		else
+		{
+			m_CallTrace.pop();
+		}
+
+		m_CallTrace.push(CallTrace::CallKind::Func, bytecode.getSource(pc), func.Term);
+
+		env = {};
+		pc = func.Entry;
+		VM_NEXT();
+	}
+	VM_CASE(CallVar):
+	VM_CASE(TailCallVar):
+	{
+		const Value &value = *env.first.find(instr->Arg);
+
+		if (!value.isClosure())
+		{
+			machineError("Value '" + stringifyValue(value)
+				+ "' cannot be executed by machine !", *this);
+		}
+
+		// Hold on to the closure, it may only be referenced by the environment
+		// which is about to be replaced
+		Closure_t closure = value.asClosure();
+
+		if (instr->Op == OpCode::CallVar)
+		{
+			m_Frames.push_back({std::move(env), pc + 1});
+		}
+		else
+		{
+			m_CallTrace.pop();
+		}
+
+		m_CallTrace.push(CallTrace::CallKind::Binding, bytecode.getSource(pc), closure.second);
+
+		// Closures of input terms are compiled the first time they are called
+		pc = bytecode.compile(closure.second);
+		code = bytecode.getCode();
+		threadCode();
+		env = std::move(closure.first);
+		VM_NEXT();
+	}
+	VM_CASE(PushPrim):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (isStackLoc(loc))
+		{
+			m_Memory[loc].push_back(Value::fromPrim(static_cast<Prim_t>(instr->Arg)));
+		}
+		else
+		{
+			pushReserved(*instr, loc);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(PushLoc):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (isStackLoc(loc))
+		{
+			m_Memory[loc].push_back(Value::fromLoc(instr->Arg));
+		}
+		else
+		{
+			pushReserved(*instr, loc);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(PushLocVar):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (isStackLoc(loc))
+		{
+			m_Memory[loc].push_back(Value::fromLoc(*env.second.find(instr->Arg)));
+		}
+		else
+		{
+			pushReserved(*instr, loc);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(PushVar):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (isStackLoc(loc))
+		{
+			m_Memory[loc].push_back(*env.first.find(instr->Arg));
+		}
+		else
+		{
+			pushReserved(*instr, loc);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(PushClosure):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (isStackLoc(loc))
+		{
+			const AppTerm &app = bytecode.getTerm(instr->Arg)->asApp();
+
+			m_Memory[loc].push_back(Value::fromClosure(
+				std::make_shared<const Closure_t>(captureEnv(env, app), app.getArg())
+			));
+		}
+		else
+		{
+			pushReserved(*instr, loc);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(Pop):
+	VM_CASE(PopBind):
+	{
+		Loc_t loc = resolveLoc(*instr);
+		bool isBind = instr->Op == OpCode::PopBind;
+
+		// Stacks known to hold a value, the location variable may still be a stream
+		if (instr->IsSafe && isStackLoc(loc))
+		{
+			ValueStack_t &stack = m_Memory[loc];
+
+			if (isBind)
+			{
+				env.first = env.first.bind(std::move(stack.back()));
+			}
+			stack.pop_back();
+		}
+		// New stream
+		else if (loc == k_NewLoc)
+		{
+			Loc_t newLocation = newLoc();
+
+			if (isBind)
+			{
+				env.first = env.first.bind(Value::fromLoc(newLocation));
+			}
+
+			collectIfNeeded();
+		}
+		// Input stream
+		else if (loc == k_InputLoc)
+		{
+			Value value = readInput(program);
+
+			if (isBind)
+			{
+				env.first = env.first.bind(std::move(value));
+			}
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			machineError("Abstraction cannot bind from 'output' location !", *this);
+		}
+		// Null stream
+		else if (loc == k_NullLoc)
+		{
+			machineError("Abstraction cannot bind from 'null' location !", *this);
+		}
+		// Generic stack
+		else if (auto valueOpt = tryPop(loc))
+		{
+			if (isBind)
+			{
+				env.first = env.first.bind(std::move(valueOpt.value()));
+			}
+		}
+		else
+		{
+			machineError("Abstraction cannot pop from location '"
+				+ getLocName(loc) + "' !", *this);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(PopLoc):
+	VM_CASE(PopLocBind):
+	{
+		Loc_t loc = resolveLoc(*instr);
+		bool isBind = instr->Op == OpCode::PopLocBind;
+
+		// Stacks known to hold a value, as long as it is a location
+		if (instr->IsSafe && isStackLoc(loc) && (instr->IsSorted || m_Memory[loc].back().isLoc()))
+		{
+			ValueStack_t &stack = m_Memory[loc];
+
+			if (isBind)
+			{
+				env.second = env.second.bind(stack.back().asLoc());
+			}
+			stack.pop_back();
+		}
+		// New stream
+		else if (loc == k_NewLoc)
+		{
+			Loc_t newLocation = newLoc();
+
+			if (isBind)
+			{
+				env.second = env.second.bind(newLocation);
+			}
+
+			collectIfNeeded();
+		}
+		// Input stream
+		else if (loc == k_InputLoc)
+		{
+			machineError("Location abstraction cannot pop from 'input' location !", *this);
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			machineError("Location abstraction cannot pop from 'output' location !", *this);
+		}
+		// Null stream
+		else if (loc == k_NullLoc)
+		{
+			machineError("Location abstraction cannot pop from 'null' location !", *this);
+		}
+		// Generic stack
+		else if (auto locOpt = tryPopLoc(loc))
+		{
+			if (isBind)
+			{
+				env.second = env.second.bind(locOpt.value());
+			}
+		}
+		else
+		{
+			machineError("Location abstraction cannot pop from location '"
+				+ getLocName(loc) + "' !", *this);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(Add):
+	VM_CASE(Sub):
+	{
+		ValueStack_t &stack = m_Memory[k_LambdaLoc];
+		size_t size = stack.size();
+
+		// Both operands are known to be there, so the result replaces the second
+		if (instr->IsSorted || (instr->IsSafe && stack[size - 1].isPrim() && stack[size - 2].isPrim()))
+		{
+			Prim_t prim1 = stack[size - 1].asPrim();
+			Prim_t prim2 = stack[size - 2].asPrim();
+
+			stack.pop_back();
+			stack.back() = Value::fromPrim(instr->Op == OpCode::Add ? addPrims(prim2, prim1) : subPrims(prim2, prim1));
+		}
+		else if (auto prim1Opt = tryPopPrim(k_LambdaLoc))
+		{
+			if (auto prim2Opt = tryPopPrim(k_LambdaLoc))
+			{
+				auto prim1 = prim1Opt.value();
+				auto prim2 = prim2Opt.value();
+
+				m_Memory[k_LambdaLoc].push_back(Value::fromPrim(
+					instr->Op == OpCode::Add ? addPrims(prim2, prim1) : subPrims(prim2, prim1)
+				));
+			}
+			else
+			{
+				machineError("Binary operation cannot use a non-primitive-value as second operand !", *this);
+			}
+		}
+		else
+		{
+			machineError("Binary operation cannot use a non-primitive-value as first operand !", *this);
+		}
+		pc++;
+		VM_NEXT();
+	}
+	VM_CASE(PrimCases):
+	VM_CASE(TailPrimCases):
+	{
+		const CasesTable<Prim_t> &table = bytecode.getPrimCases(instr->Arg);
+		ValueStack_t &stack = m_Memory[k_LambdaLoc];
+
+		std::optional<Prim_t> primOpt;
+		if (instr->IsSorted || (instr->IsSafe && stack.back().isPrim()))
+		{
+			primOpt = stack.back().asPrim();
+			stack.pop_back();
+		}
+		else
+		{
+			primOpt = tryPopPrim(k_LambdaLoc);
+		}
+
+		if (primOpt)
+		{
+			bool isTail = instr->Op == OpCode::TailPrimCases || instr->Op == OpCode::TailLocCases;
+
+			if (!isTail)
+			{
+				m_Frames.push_back({env, pc + 1});
+			}
+
+			CodeAddr_t target = table.find(primOpt.value());
+
+			// Every branch is a block of its own, so only 'otherwise' starts there
+			if (target != table.getOtherwise())
+			{
+				m_CallTrace.push(CallTrace::CallKind::PrimCase, nullptr, bytecode.getSource(pc), static_cast<uint32_t>(primOpt.value()), isTail);
+			}
+			else
+			{
+				m_CallTrace.push(CallTrace::CallKind::Otherwise, nullptr, bytecode.getSource(pc), 0, isTail);
+			}
+			pc = target;
+		}
+		else
+		{
+			machineError("Primitive cases cannot match a non-primitive value !", *this);
+		}
+		VM_NEXT();
+	}
+	VM_CASE(LocCases):
+	VM_CASE(TailLocCases):
+	{
+		const CasesTable<Loc_t> &table = bytecode.getLocCases(instr->Arg);
+		ValueStack_t &stack = m_Memory[k_LambdaLoc];
+
+		std::optional<Loc_t> locOpt;
+		if (instr->IsSorted || (instr->IsSafe && stack.back().isLoc()))
+		{
+			locOpt = stack.back().asLoc();
+			stack.pop_back();
+		}
+		else
+		{
+			locOpt = tryPopLoc(k_LambdaLoc);
+		}
+
+		if (locOpt)
+		{
+			bool isTail = instr->Op == OpCode::TailPrimCases || instr->Op == OpCode::TailLocCases;
+
+			if (!isTail)
+			{
+				m_Frames.push_back({env, pc + 1});
+			}
+
+			CodeAddr_t target = table.find(locOpt.value());
+
+			// Every branch is a block of its own, so only 'otherwise' starts there
+			if (target != table.getOtherwise())
+			{
+				m_CallTrace.push(CallTrace::CallKind::LocCase, nullptr, bytecode.getSource(pc), locOpt.value(), isTail);
+			}
+			else
+			{
+				m_CallTrace.push(CallTrace::CallKind::Otherwise, nullptr, bytecode.getSource(pc), 0, isTail);
+			}
+			pc = target;
+		}
+		else
+		{
+			machineError("Location cases cannot match a non-location value !", *this);
+		}
+		VM_NEXT();
+	}
+	VM_CASE(Fail):
+	{
+		machineError("Value '" + stringifyClosure(Closure_t(env, bytecode.getSource(pc)))
+			+ "' cannot be executed by machine !", *this);
+		VM_NEXT();
+	}
+	// A superinstruction counts as every step it stands for, if that would go
+	// over the step limit the sequence is run unfused so it stops exactly
+	#define VM_FUSED_STEPS(length)                               \
+		do                                                       \
+		{                                                        \
+			if (maxSteps - steps < (length) - 1) VM_UNFUSED();   \
+			steps += (length) - 1;                               \
+		} while (false)
+
+	VM_CASE(PushVarVar):
+	{
+		VM_FUSED_STEPS(2);
+
+		ValueStack_t &stack = m_Memory[k_LambdaLoc];
+		stack.push_back(*env.first.find(instr->Loc));
+		stack.push_back(*env.first.find(instr->Arg));
+		pc += 2;
+		VM_NEXT();
+	}
+	VM_CASE(PushVarCall):
+	VM_CASE(PushPrimCall):
+	VM_CASE(PushLocCall):
+	VM_CASE(PushVarTailCall):
+	VM_CASE(PushPrimTailCall):
+	VM_CASE(PushLocTailCall):
+	{
+		VM_FUSED_STEPS(2);
+
+		if (instr->Op == OpCode::PushVarCall || instr->Op == OpCode::PushVarTailCall)
+		{
+			m_Memory[k_LambdaLoc].push_back(*env.first.find(instr->Arg));
+		}
+		else if (instr->Op == OpCode::PushPrimCall || instr->Op == OpCode::PushPrimTailCall)
+		{
+			m_Memory[k_LambdaLoc].push_back(Value::fromPrim(static_cast<Prim_t>(instr->Arg)));
+		}
+		else
+		{
+			m_Memory[k_LambdaLoc].push_back(Value::fromLoc(instr->Arg));
+		}
+
+		const Function &func = bytecode.getFunction(instr->Loc);
+
+		bool isTail = instr->Op == OpCode::PushVarTailCall || instr->Op == OpCode::PushPrimTailCall
+			|| instr->Op == OpCode::PushLocTailCall;
+
+		if (!isTail)
+		{
+			m_Frames.push_back({std::move(env), pc + 2});
+		}
+		else
+		{
+			m_CallTrace.pop();
+		}
+
+		// The call is the second instruction of the sequence
+		m_CallTrace.push(CallTrace::CallKind::Func, bytecode.getSource(pc + 1), func.Term);
+
+		env = {};
+		pc = func.Entry;
+		VM_NEXT();
+	}
+	VM_CASE(PushVarRet):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (!isStackLoc(loc))
+		{
+			VM_UNFUSED();
+		}
+
+		VM_FUSED_STEPS(2);
+
+		m_Memory[loc].push_back(*env.first.find(instr->Arg));
+
+		m_CallTrace.pop();
+
+		if (m_Frames.empty())
+		{
+			goto halt;
+		}
+
+		env = std::move(m_Frames.back().Env);
+		pc = m_Frames.back().Pc;
+		m_Frames.pop_back();
+		VM_NEXT();
+	}
+	VM_CASE(AddVarVar):
+	VM_CASE(SubVarVar):
+	VM_CASE(AddVarPrim):
+	VM_CASE(SubVarPrim):
+	{
+		const Value &value1 = *env.first.find(instr->Loc);
+
+		bool isVarVar = instr->Op == OpCode::AddVarVar || instr->Op == OpCode::SubVarVar;
+		const Value *value2 = isVarVar ? env.first.find(instr->Arg) : nullptr;
+
+		// Operands which are not primitives report their error unfused
+		if (!instr->IsSorted && (!value1.isPrim() || (value2 && !value2->isPrim())))
+		{
+			VM_UNFUSED();
+		}
+
+		VM_FUSED_STEPS(3);
+
+		Prim_t prim1 = value1.asPrim();
+		Prim_t prim2 = value2 ? value2->asPrim() : static_cast<Prim_t>(instr->Arg);
+		bool isAdd = instr->Op == OpCode::AddVarVar || instr->Op == OpCode::AddVarPrim;
+
+		m_Memory[k_LambdaLoc].push_back(Value::fromPrim(isAdd ? addPrims(prim1, prim2) : subPrims(prim1, prim2)));
+		pc += 3;
+		VM_NEXT();
+	}
+	VM_CASE(PopBindTwice):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (!isStackLoc(loc) || (!instr->IsSafe && m_Memory[loc].size() < 2))
+		{
+			VM_UNFUSED();
+		}
+
+		VM_FUSED_STEPS(2);
+
+		ValueStack_t &stack = m_Memory[loc];
+		env.first = env.first.bind(std::move(stack.back()));
+		stack.pop_back();
+		env.first = env.first.bind(std::move(stack.back()));
+		stack.pop_back();
+		pc += 2;
+		VM_NEXT();
+	}
+	VM_CASE(PeekBind):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (!isStackLoc(loc) || (!instr->IsSafe && m_Memory[loc].empty()))
+		{
+			VM_UNFUSED();
+		}
+
+		VM_FUSED_STEPS(2);
+
+		env.first = env.first.bind(m_Memory[loc].back());
+		pc += 2;
+		VM_NEXT();
+	}
+	VM_CASE(BindVar):
+	{
+		Loc_t loc = resolveLoc(*instr);
+
+		if (!isStackLoc(loc))
+		{
+			VM_UNFUSED();
+		}
+
+		VM_FUSED_STEPS(2);
+
+		env.first = env.first.bind(Value(*env.first.find(instr->Arg)));
+		pc += 2;
+		VM_NEXT();
+	}
+#if !defined(CFMC_COMPUTED_GOTO)
+		}
+	}
+#endif
+
+	#undef VM_CASE
+	#undef VM_NEXT
+	#undef VM_UNFUSED
+	#undef VM_FUSED_STEPS
+
+halt:
+	m_Stats.Steps = steps;
+}
+
+void Machine::executeNodes(const Program &program)
+{
+	// Handlers are plain functions so that each node can point straight to its
+	// own, they mirror the tree walker term for term (and so take the same steps)
+	static constexpr auto resolveLoc = [](const Env_t &env, const ExecNode &node) -> Loc_t {
+		return node.IsLocIndex ? *env.second.find(node.Loc) : node.Loc;
+	};
+
+	static constexpr auto isStackLoc = [](Loc_t loc) {
+		return loc == k_LambdaLoc || loc >= k_NumReservedLocs;
+	};
+
+	// Calls in tail position return straight to our caller, so they take over
+	// our entry in the call stack as well
+	static constexpr auto pushContinuation = [](Machine &machine, Env_t &env, const ExecNode &node) {
+		if (!node.IsTail)
+		{
+			machine.m_NodeFrames.push_back({env, node.Next});
+		}
+		else
+		{
+			machine.m_CallTrace.pop();
+		}
+	};
+
+	// Pushes to reserved locations are rare, so they share one slow path
+	static constexpr auto pushReserved = [](Machine &machine, const Env_t &env, const ExecNode &node, Loc_t loc) {
+		const std::string kind = node.Kind == NodeKind::PushLocArg ? "Location application" : "Application";
+		const std::string space = node.Kind == NodeKind::PushLocArg ? " " : "";
+
+		// New stream
+		if (loc == k_NewLoc)
+		{
+			machineError(kind + " cannot push to 'new' location !" + space, machine);
+		}
+		// Input stream
+		else if (loc == k_InputLoc)
+		{
+			machineError(kind + " cannot push to 'input' location !" + space, machine);
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			if (node.Kind == NodeKind::PushLocArg)
+			{
+				Loc_t locArg = node.IsArgIndex ? *env.second.find(node.Arg) : node.Arg;
+				std::cout << stringifyValue(Value::fromLoc(locArg)) << std::endl;
+			}
+			else
+			{
+				const AppTerm &app = node.Source->asApp();
+				std::cout << stringifyClosure(Closure_t(captureEnv(env, app), app.getArg())) << std::endl;
+			}
+		}
+		// Null stream is discarded
+	};
+
+	// Cases share entering the branch they matched, which compiled code that
+	// matches cases natively calls as well (see NodeJit)
+	static constexpr BranchHandler_t enterBranch = [](Machine &machine, Env_t &env, const ExecNode &node, uint32_t branch, uint32_t value) -> const ExecNode * {
+		// A branch in tail position ends the enclosing call instead of returning
+		if (!node.IsTail)
+		{
+			machine.m_NodeFrames.push_back({env, node.Next});
+		}
+
+		// The otherwise branch comes last
+		if (branch + 1 < node.Branches.size())
+		{
+			CallTrace::CallKind kind = node.Kind == NodeKind::PrimCases ? CallTrace::CallKind::PrimCase : CallTrace::CallKind::LocCase;
+			machine.m_CallTrace.push(kind, nullptr, node.Source, value, node.IsTail);
+		}
+		else
+		{
+			machine.m_CallTrace.push(CallTrace::CallKind::Otherwise, nullptr, node.Source, 0, node.IsTail);
+		}
+		return node.Branches[branch];
+	};
+
+	NodeHandler_t onRet = [](Machine &machine, NodeTree &, Env_t &, const ExecNode &) -> const ExecNode * {
+		machine.m_CallTrace.pop();
+		return nullptr;
+	};
+
+	NodeHandler_t onFail = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		machineError("Value '" + stringifyClosure(Closure_t(env, node.Source))
+			+ "' cannot be executed by machine !", machine);
+		return nullptr;
+	};
+
+	NodeHandler_t onCall = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		if (!node.Target)
+		{
+			machineError("Variable '" + node.Source->asVar().getVar() + "' "
+				+ "is not bound to anything !", machine);
+		}
+
+		pushContinuation(machine, env, node);
+		machine.m_CallTrace.push(CallTrace::CallKind::Func, node.Source, node.Target->Source);
+
+		if (machine.m_NodeJit && !node.Target->JitEntry)
+		{
+			machine.m_NodeJit->noteCall(*node.Target);
+		}
+
+		env = {};
+		return node.Target;
+	};
+
+	NodeHandler_t onCallVar = [](Machine &machine, NodeTree &tree, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		const Value &value = *env.first.find(node.Arg);
+
+		if (!value.isClosure())
+		{
+			machineError("Value '" + stringifyValue(value)
+				+ "' cannot be executed by machine !", machine);
+		}
+
+		// Hold on to the closure, it may only be referenced by the environment
+		// which is about to be replaced
+		Closure_t closure = value.asClosure();
+
+		pushContinuation(machine, env, node);
+		machine.m_CallTrace.push(CallTrace::CallKind::Binding, node.Source, closure.second);
+
+		// Closures of input terms are converted the first time they are called
+		const ExecNode *target = tree.find(closure.second);
+		env = std::move(closure.first);
+		return target;
+	};
+
+	NodeHandler_t onPushPrim = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+
+		if (isStackLoc(loc))
+		{
+			machine.m_Memory[loc].push_back(Value::fromPrim(static_cast<Prim_t>(node.Arg)));
+		}
+		else
+		{
+			pushReserved(machine, env, node, loc);
+		}
+		return node.Next;
+	};
+
+	NodeHandler_t onPushLoc = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+
+		if (isStackLoc(loc))
+		{
+			machine.m_Memory[loc].push_back(Value::fromLoc(node.Arg));
+		}
+		else
+		{
+			pushReserved(machine, env, node, loc);
+		}
+		return node.Next;
+	};
+
+	NodeHandler_t onPushVar = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+
+		if (isStackLoc(loc))
+		{
+			const Value &value = *env.first.find(node.Arg);
+
+			// Like the tree walker, closures are pushed as a closure of the variable
+			if (!value.isClosure())
+			{
+				machine.m_Memory[loc].push_back(value);
+			}
+			else
+			{
+				const AppTerm &app = node.Source->asApp();
+
+				machine.m_Memory[loc].push_back(Value::fromClosure(
+					std::make_shared<const Closure_t>(captureEnv(env, app), app.getArg())
+				));
+			}
+		}
+		else
+		{
+			pushReserved(machine, env, node, loc);
+		}
+		return node.Next;
+	};
+
+	NodeHandler_t onPushClosure = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+
+		if (isStackLoc(loc))
+		{
+			const AppTerm &app = node.Source->asApp();
+
+			machine.m_Memory[loc].push_back(Value::fromClosure(
+				std::make_shared<const Closure_t>(captureEnv(env, app), app.getArg())
+			));
+		}
+		else
+		{
+			pushReserved(machine, env, node, loc);
+		}
+		return node.Next;
+	};
+
+	NodeHandler_t onPushLocArg = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+
+		if (isStackLoc(loc))
+		{
+			machine.m_Memory[loc].push_back(Value::fromLoc(node.IsArgIndex ? *env.second.find(node.Arg) : node.Arg));
+		}
+		else
+		{
+			pushReserved(machine, env, node, loc);
+		}
+		return node.Next;
+	};
+
+	NodeHandler_t onPop = [](Machine &machine, NodeTree &tree, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+		Value value = Value::fromPrim(0);
+
+		// Generic stack
+		if (isStackLoc(loc))
+		{
+			auto valueOpt = machine.tryPop(loc);
+
+			if (!valueOpt)
+			{
+				machineError("Abstraction cannot pop from location '"
+					+ getLocName(loc) + "' !", machine);
+			}
+
+			value = std::move(valueOpt.value());
+		}
+		// New stream
+		else if (loc == k_NewLoc)
+		{
+			value = Value::fromLoc(machine.newLoc());
+		}
+		// Input stream
+		else if (loc == k_InputLoc)
+		{
+			value = machine.readInput(tree.getProgram());
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			machineError("Abstraction cannot bind from 'output' location !", machine);
+		}
+		// Null stream
+		else
+		{
+			machineError("Abstraction cannot bind from 'null' location !", machine);
+		}
+
+		if (node.IsBinding)
+		{
+			env.first = env.first.bind(std::move(value));
+		}
+		return node.Next;
+	};
+
+	NodeHandler_t onPopLoc = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		Loc_t loc = resolveLoc(env, node);
+		Loc_t locVal = 0;
+
+		// Generic stack
+		if (isStackLoc(loc))
+		{
+			auto locOpt = machine.tryPopLoc(loc);
+
+			if (!locOpt)
+			{
+				machineError("Location abstraction cannot pop from location '"
+					+ getLocName(loc) + "' !", machine);
+			}
+
+			locVal = locOpt.value();
+		}
+		// New stream
+		else if (loc == k_NewLoc)
+		{
+			locVal = machine.newLoc();
+		}
+		// Input stream
+		else if (loc == k_InputLoc)
+		{
+			machineError("Location abstraction cannot pop from 'input' location !", machine);
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			machineError("Location abstraction cannot pop from 'output' location !", machine);
+		}
+		// Null stream
+		else
+		{
+			machineError("Location abstraction cannot pop from 'null' location !", machine);
+		}
+
+		if (node.IsBinding)
+		{
+			env.second = env.second.bind(locVal);
+		}
+		return node.Next;
+	};
+
+	// Pops both operands of a binary operation, the first operand is on top
+	static constexpr auto popOperands = [](Machine &machine) -> std::pair<Prim_t, Prim_t> {
+		auto prim1Opt = machine.tryPopPrim(k_LambdaLoc);
+
+		if (!prim1Opt)
+		{
+			machineError("Binary operation cannot use a non-primitive-value as first operand !", machine);
+		}
+
+		auto prim2Opt = machine.tryPopPrim(k_LambdaLoc);
+
+		if (!prim2Opt)
+		{
+			machineError("Binary operation cannot use a non-primitive-value as second operand !", machine);
+		}
+
+		return {prim1Opt.value(), prim2Opt.value()};
+	};
+
+	NodeHandler_t onAdd = [](Machine &machine, NodeTree &, Env_t &, const ExecNode &node) -> const ExecNode * {
+		auto [prim1, prim2] = popOperands(machine);
+		machine.m_Memory[k_LambdaLoc].push_back(Value::fromPrim(addPrims(prim2, prim1)));
+		return node.Next;
+	};
+
+	NodeHandler_t onSub = [](Machine &machine, NodeTree &, Env_t &, const ExecNode &node) -> const ExecNode * {
+		auto [prim1, prim2] = popOperands(machine);
+		machine.m_Memory[k_LambdaLoc].push_back(Value::fromPrim(subPrims(prim2, prim1)));
+		return node.Next;
+	};
+
+	NodeHandler_t onPrimCases = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		auto primOpt = machine.tryPopPrim(k_LambdaLoc);
+
+		if (!primOpt)
+		{
+			machineError("Primitive cases cannot match a non-primitive value !", machine);
+		}
+
+		uint32_t branch = node.Source->asPrimCases().selectBranch(primOpt.value());
+		return enterBranch(machine, env, node, branch, static_cast<uint32_t>(primOpt.value()));
+	};
+
+	NodeHandler_t onLocCases = [](Machine &machine, NodeTree &, Env_t &env, const ExecNode &node) -> const ExecNode * {
+		auto locOpt = machine.tryPopLoc(k_LambdaLoc);
+
+		if (!locOpt)
+		{
+			machineError("Location cases cannot match a non-location value !", machine);
+		}
+
+		uint32_t branch = node.Source->asLocCases().selectBranch(locOpt.value());
+		return enterBranch(machine, env, node, branch, locOpt.value());
+	};
+
+	const NodeHandlers_t handlers = {
+		onRet, onFail, onCall, onCallVar,
+		onPushPrim, onPushLoc, onPushVar, onPushClosure, onPushLocArg,
+		onPop, onPopLoc,
+		onAdd, onSub,
+		onPrimCases, onLocCases
+	};
+
+	NodeTree tree(program, handlers);
+
+	const ExecNode *node = tree.getEntry();
+	if (!node)
+	{
+		machineError("Program has no entry point ('main' is not defined)!", *this);
+		return;
+	}
+
+	if (m_Options.Engine == ExecEngine::Tiered)
+	{
+		executeTiered(program, tree);
+		return;
+	}
+
+	m_CallTrace.push(CallTrace::CallKind::Main, nullptr, node->Source);
+
+	std::optional<NodeJit> jit;
+	if (m_Options.Jit)
+	{
+		bool isGcEnabled = m_Options.GcThreshold > 0;
+
+		JitContext context;
+		context.Stacks = &m_Stacks;
+		context.AllocsSinceGc = isGcEnabled ? &m_AllocsSinceGc : nullptr;
+		context.NextGc = isGcEnabled ? &m_NextGc : nullptr;
+		context.EnterBranch = enterBranch;
+		context.IsTracing = m_CallTrace.isEnabled();
+
+		jit.emplace(tree, m_Options.JitThreshold, context);
+		m_NodeJit = &jit.value();
+	}
+
+	// The current environment and node are kept in locals, only continuations
+	// are pushed to the frame stack
+	Env_t env;
+	uint64_t steps = 0;
+	const uint64_t maxSteps = m_Options.MaxSteps > 0 ? m_Options.MaxSteps : ~uint64_t(0);
+
+	while (true)
+	{
+		if (!node)
+		{
+			if (m_NodeFrames.empty())
+			{
+				break;
+			}
+
+			env = std::move(m_NodeFrames.back().Env);
+			node = m_NodeFrames.back().Node;
+			m_NodeFrames.pop_back();
+		}
+
+		if (steps >= maxSteps)
+		{
+			break;
+		}
+
+		// Collect between steps, the current environment is a root as well
+		if (m_Options.GcThreshold > 0 && m_AllocsSinceGc >= m_NextGc)
+		{
+			m_NodeFrames.push_back({env, node});
+			collectGarbage();
+			m_NodeFrames.pop_back();
+		}
+
+		// Compiled code runs until it leaves its function, needs a collection
+		// or reaches the step limit, and counts its own steps
+		if (node->JitEntry)
+		{
+			node = node->JitEntry(this, &tree, &env, &steps, maxSteps);
+			continue;
+		}
+
+		steps++;
+		node = node->Handler(*this, tree, env, *node);
+	}
+
+	m_Stats.Steps = steps;
+
+	if (jit)
+	{
+		m_Stats.JitFunctions = jit->getNumCompiled();
+		m_Stats.JitCodeBytes = jit->getCodeSize();
+		m_NodeJit = nullptr;
+	}
+}
 
-						m_Control.push_back(std::make_pair(env, locAbs.getBody()));
-					}
-					else
-					{
-						machineError("Location abstraction cannot pop from location '"
-							+ loc + "' !", *this);
-					}
-				}
-			};
+void Machine::executeTiered(const Program &program, NodeTree &tree)
+{
+	// Terms belong to the function they were written in, including arguments
+	// that closures are made of. Terms that were read as input belong to none
+	// and are always walked.
+	std::unordered_map<const Term *, FuncIndex_t> termFuncs;
 
-			auto itEnv = env.second.find(locAbs.getLoc());
-			if (itEnv != env.second.end())
+	std::function<void(const TermHandle_t &, FuncIndex_t)> assign = [&](const TermHandle_t &term, FuncIndex_t func) {
+		for (TermHandle_t t = term; t; )
+		{
+			termFuncs.emplace(t.get(), func);
+
+			if (t->isVar())
+			{
+				t = t->asVar().getBody();
+			}
+			else if (t->isApp())
+			{
+				assign(t->asApp().getArg(), func);
+				t = t->asApp().getBody();
+			}
+			else if (t->isAbs())
+			{
+				t = t->asAbs().getBody();
+			}
+			else if (t->isLocApp())
 			{
-				absActionWithLoc(itEnv->second);
+				t = t->asLocApp().getBody();
 			}
-			else if (isReservedLoc(locAbs.getLoc()))
+			else if (t->isLocAbs())
 			{
-				absActionWithLoc(locAbs.getLoc());
+				t = t->asLocAbs().getBody();
 			}
+			else if (t->isBinOp())
+			{
+				t = t->asBinOp().getBody();
+			}
+			else if (t->isPrimCases() || t->isLocCases())
+			{
+				auto assignCases = [&](const auto &cases) {
+					uint32_t numBranches = static_cast<uint32_t>(std::distance(cases.begin(), cases.end())) + 1;
+
+					for (uint32_t branch = 0; branch < numBranches; ++branch)
+					{
+						assign(cases.getBranch(branch), func);
+					}
+					return cases.getBody();
+				};
+
+				t = t->isPrimCases() ? assignCases(t->asPrimCases()) : assignCases(t->asLocCases());
+			}
+			// Nil and values end the term
 			else
 			{
-				machineError("Location abstraction cannot pop from (invalid) location '"
-					+ locAbs.getLoc() + "' !", *this);
+				t = nullptr;
 			}
 		}
-		else if (term->isVal())
+	};
+
+	for (FuncIndex_t func = 0; func < program.getNumFuncs(); ++func)
+	{
+		assign(program.getFunc(func), func);
+	}
+
+	std::vector<uint64_t> calls(program.getNumFuncs(), 0);
+	std::vector<bool> isPromoted(program.getNumFuncs(), false);
+	bool hasPromoted = false;
+
+	auto isNodeTerm = [&](const Term *term) {
+		auto it = termFuncs.find(term);
+		return it != termFuncs.end() && isPromoted[it->second];
+	};
+
+	auto isControlNode = [](const ExecNode &node) {
+		switch (node.Kind)
 		{
-			machineError("Value '" + stringifyClosure(closure)
-				+ "' cannot be executed by machine !", *this);
+		case NodeKind::Call:
+		case NodeKind::CallVar:
+		case NodeKind::PrimCases:
+		case NodeKind::LocCases:
+			return true;
+		default:
+			return false;
+		}
+	};
+
+	auto countCalls = [](uint64_t count) {
+		return std::to_string(count) + (count == 1 ? " call" : " calls");
+	};
+
+	// Promotion only changes where the function's terms run from then on, as
+	// frames on the control stack are the same closures in either tier
+	auto countCall = [&](FuncIndex_t func, uint64_t steps) {
+		if (isPromoted[func] || ++calls[func] < m_Options.TierThreshold)
+		{
+			return;
 		}
-		else if (term->isBinOp())
+
+		isPromoted[func] = true;
+		hasPromoted = true;
+
+		size_t numFrames = std::count_if(m_Control.begin(), m_Control.end(), [&](const Closure_t &frame) {
+			auto it = termFuncs.find(frame.second.get());
+			return it != termFuncs.end() && it->second == func;
+		});
+
+		m_Stats.TierPromotions++;
+		m_Stats.TierFramesReplaced += numFrames;
+
+		if (m_Options.TierLog)
 		{
-			const BinOpTerm &binOp = term->asBinOp();
+			std::cerr << "[Tier] Step " << steps << ": promoted '" << program.getFuncName(func)
+				<< "' to nodes after " << countCalls(calls[func]) << ", replacing " << numFrames
+				<< " of its frames on the control stack" << std::endl;
+		}
+	};
 
-			m_Control.push_back(std::make_pair(env, binOp.getBody()));
+	if (m_Options.TierLog)
+	{
+		std::cerr << "[Tier] Functions are promoted to nodes after " << countCalls(m_Options.TierThreshold) << std::endl;
+	}
 
-			if (auto prim1Opt = tryPopPrim(env, k_LambdaLoc))
-			{
-				if (auto prim2Opt = tryPopPrim(env, k_LambdaLoc))
-				{
-					auto prim1 = prim1Opt.value();
-					auto prim2 = prim2Opt.value();
+	m_Control.emplace_back(Env_t{}, tree.getEntry()->Source);
+	m_CallTrace.push(CallTrace::CallKind::Main, nullptr, tree.getEntry()->Source);
 
-					if (binOp.isOp(BinOpTerm::Plus))
-					{
-						m_Memory[k_LambdaLoc].push_back(std::make_pair(env, freshTerm(ValTerm(prim2 + prim1))));
-					}
-					else if (binOp.isOp(BinOpTerm::Minus))
-					{
-						m_Memory[k_LambdaLoc].push_back(std::make_pair(env, freshTerm(ValTerm(prim2 - prim1))));
-					}
-				}
-				else
-				{
-					machineError("Binary operation cannot use a non-primitive-value as second operand !", *this);
-				}
+	// While running nodes the current environment and node are kept in locals,
+	// continuations are always pushed to the control stack
+	Env_t env;
+	const ExecNode *node = nullptr;
+	uint64_t steps = 0;
+	const uint64_t maxSteps = m_Options.MaxSteps > 0 ? m_Options.MaxSteps : ~uint64_t(0);
+
+	while (true)
+	{
+		// Whatever comes off the control stack runs in the tier of its function
+		if (!node)
+		{
+			if (m_Control.empty())
+			{
+				break;
 			}
-			else
+
+			if (hasPromoted && isNodeTerm(m_Control.back().second.get()))
 			{
-				machineError("Binary operation cannot use a non-primitive-value as first operand !", *this);
+				env = std::move(m_Control.back().first);
+				node = tree.find(m_Control.back().second);
+				m_Control.pop_back();
 			}
 		}
-		else if (term->isPrimCases())
+
+		if (steps >= maxSteps)
 		{
-			const CasesTerm<Prim_t> &cases = term->asPrimCases();
+			break;
+		}
 
-			m_Control.push_back(std::make_pair(env, cases.getBody()));
+		steps++;
 
-			if (auto primOpt = tryPopPrim(env, k_LambdaLoc))
+		// Collect between steps, the current environment is a root as well
+		if (m_Options.GcThreshold > 0 && m_AllocsSinceGc >= m_NextGc)
+		{
+			if (node)
 			{
-				auto itCase = cases.find(primOpt.value());
-				if (itCase != cases.end())
-				{
-					m_Control.push_back(std::make_pair(env, itCase->second));
-					
-					m_CallStack.push_back({"Case '" + std::to_string(primOpt.value()) + "'", closure.second});
-				}
-				else
-				{
-					m_Control.push_back(std::make_pair(env, cases.getOtherwise()));
-					
-					m_CallStack.push_back({"Case 'otherwise'", closure.second});
-				}
+				m_Control.emplace_back(env, node->Source);
 			}
-			else
+
+			collectGarbage();
+
+			if (node)
 			{
-				machineError("Primitive cases cannot match a non-primitive value !", *this);
+				m_Control.pop_back();
 			}
 		}
-		else if (term->isLocCases())
+
+		if (node)
 		{
-			const CasesTerm<Loc_t> &cases = term->asLocCases();
+			const ExecNode &curr = *node;
+			node = curr.Handler(*this, tree, env, curr);
 
-			m_Control.push_back(std::make_pair(env, cases.getBody()));
+			// Only calls and cases push continuations or enter other functions,
+			// every other node runs exactly as in the node engine
+			if (!isControlNode(curr))
+			{
+				continue;
+			}
 
-			if (auto locOpt = tryPopLoc(env, k_LambdaLoc))
+			if (curr.Kind == NodeKind::Call)
 			{
-				auto itCase = cases.find(locOpt.value());
-				if (itCase != cases.end())
-				{
-					m_Control.push_back(std::make_pair(env, itCase->second));
-					m_CallStack.push_back({"Case '" + locOpt.value() + "'", closure.second});
-				}
-				else
-				{
-					m_Control.push_back(std::make_pair(env, cases.getOtherwise()));	
-					m_CallStack.push_back({"Case 'otherwise'", closure.second});
-				}
+				countCall(curr.Arg, steps);
 			}
-			else
+
+			if (!m_NodeFrames.empty())
+			{
+				m_Control.emplace_back(std::move(m_NodeFrames.back().Env), m_NodeFrames.back().Node->Source);
+				m_NodeFrames.pop_back();
+			}
+
+			// Calls into code that is still walked leave the node engine, calls
+			// of program functions know their function without looking it up
+			bool isWalked = false;
+
+			if (node && curr.Kind == NodeKind::Call)
+			{
+				isWalked = !isPromoted[curr.Arg];
+			}
+			else if (node && curr.Kind == NodeKind::CallVar)
+			{
+				isWalked = !isNodeTerm(node->Source.get());
+			}
+
+			if (isWalked)
+			{
+				m_Control.emplace_back(std::move(env), node->Source);
+				env = {};
+				node = nullptr;
+			}
+		}
+		else
+		{
+			const Term &term = *m_Control.back().second;
+
+			if (term.isVar() && !term.asVar().getIndex() && term.asVar().getFuncIndex())
+			{
+				countCall(term.asVar().getFuncIndex().value(), steps);
+			}
+
+			stepTree(program);
+		}
+	}
+
+	m_Stats.Steps = steps;
+
+	if (m_Options.TierLog)
+	{
+		for (FuncIndex_t func = 0; func < program.getNumFuncs(); ++func)
+		{
+			if (calls[func] > 0)
 			{
-				machineError("Location cases cannot match a non-location value !", *this);
+				std::cerr << "[Tier] '" << program.getFuncName(func) << "' "
+					<< (isPromoted[func] ? "was promoted to nodes" : "stayed in the tree walker")
+					<< " after " << countCalls(calls[func]) << std::endl;
 			}
 		}
 	}
 }
 
-std::optional<Closure_t> Machine::tryPop(Env_t env, Loc_t loc)
+Value Machine::readInput(const Program &program)
+{
+	std::string in;
+	std::cin >> in;
+
+	auto terms = std::make_unique<TermArena>();
+	TermArena::Scope scope(*terms);
+
+	// Names first seen in the input must not take an ID already handed out
+	skipLocIds(m_LocAllocator.getNumLocs());
+
+	Parser parser;
+	auto termOpt = parser.parseTerm(in);
+
+	if (!termOpt)
+	{
+		machineError("Cannot parse input '"
+			+ in + "' as term !", *this);
+	}
+
+	Resolver resolver([&](const Var_t &var) {
+		return program.findFunc(var);
+	});
+
+	if (!resolver.resolve("input", termOpt.value()))
+	{
+		machineError(resolver.getErrors().front(), *this);
+	}
+
+	// Input may have introduced new location names
+	if (!m_LocAllocator.reserve(::getNumLocs()))
+	{
+		machineError("Ran out of location IDs for the names in input '"
+			+ in + "' !", *this);
+	}
+
+	resizeMemory(m_LocAllocator.getNumLocs());
+	m_IsDynamicLoc.resize(m_LocAllocator.getNumLocs());
+
+	const Term &inTerm = termOpt.value();
+
+	if (inTerm.isVal() && inTerm.asVal().isPrim())
+	{
+		return Value::fromPrim(inTerm.asVal().asPrim());
+	}
+
+	Value value = Value::fromClosure(std::make_shared<const Closure_t>(
+		Env_t{}, newTerm(std::move(termOpt.value()))
+	));
+
+	// Inputs count towards the next collection like new locations do
+	m_InputTerms.push_back(std::move(terms));
+	m_AllocsSinceGc++;
+
+	return value;
+}
+
+std::optional<Value> Machine::tryPop(Loc_t loc)
 {
-	if (!m_Memory[loc].empty())
+	ValueStack_t &stack = m_Memory[loc];
+
+	if (!stack.empty())
 	{
-		Closure_t closure = m_Memory[loc].back();
-		m_Memory[loc].pop_back();
-		return closure;
+		Value value = std::move(stack.back());
+		stack.pop_back();
+		return value;
 	}
 	else
 	{
 		machineError("Cannot pop from empty stack  '"
-			+ loc + "' !", *this);
+			+ getLocName(loc) + "' !", *this);
 	}
 
 	return std::nullopt;
 }
 
-std::optional<Prim_t> Machine::tryPopPrim(Env_t env, Loc_t loc)
+std::optional<Prim_t> Machine::tryPopPrim(Loc_t loc)
 {
-	if (!m_Memory[loc].empty())
+	ValueStack_t &stack = m_Memory[loc];
+
+	if (!stack.empty())
 	{
-		if (m_Memory[loc].back().second->isVal())
+		if (stack.back().isPrim())
 		{
-			const ValTerm &val = m_Memory[loc].back().second->asVal();
-			m_Memory[loc].pop_back();
-
-			if (val.isPrim())
-			{
-				return val.asPrim();
-			}
+			Prim_t prim = stack.back().asPrim();
+			stack.pop_back();
+			return prim;
 		}
 	}
 	else
 	{
 		machineError("Cannot pop from empty stack  '"
-			+ loc + "' !", *this);
+			+ getLocName(loc) + "' !", *this);
 	}
 
 	return std::nullopt;
 }
 
-std::optional<Loc_t> Machine::tryPopLoc(Env_t env, Loc_t loc)
+std::optional<Loc_t> Machine::tryPopLoc(Loc_t loc)
 {
-	if (!m_Memory[loc].empty())
+	ValueStack_t &stack = m_Memory[loc];
+
+	if (!stack.empty())
 	{
-		if (m_Memory[loc].back().second->isVal())
+		if (stack.back().isLoc())
 		{
-			const ValTerm &val = m_Memory[loc].back().second->asVal();
-			m_Memory[loc].pop_back();
-
-			if (val.isLoc())
-			{
-				return val.asLoc();
-			}
+			Loc_t locVal = stack.back().asLoc();
+			stack.pop_back();
+			return locVal;
 		}
 	}
 	else
 	{
 		machineError("Cannot pop from empty stack  '"
-			+ loc + "' !", *this);
+			+ getLocName(loc) + "' !", *this);
 	}
 
 	return std::nullopt;
 }
 
-TermHandle_t Machine::freshTerm(Term &&term)
+Loc_t Machine::newLoc()
+{
+	std::optional<Loc_t> locOpt = m_LocAllocator.allocate();
+	if (!locOpt)
+	{
+		machineError("Ran out of location IDs for 'new'!", *this);
+	}
+
+	Loc_t loc = *locOpt;
+
+	if (loc < m_Memory.size())
+	{
+		m_Stats.LocsRecycled++;
+	}
+	else
+	{
+		resizeMemory(m_LocAllocator.getNumLocs());
+		m_IsDynamicLoc.resize(m_LocAllocator.getNumLocs());
+	}
+
+	m_IsDynamicLoc[loc] = true;
+	m_DynamicLocs.push_back(loc);
+
+	m_Stats.LocsAllocated++;
+	m_AllocsSinceGc++;
+
+	return loc;
+}
+
+void Machine::resizeMemory(size_t numLocs)
 {
-	m_FreshTerms.push_back(newTerm(std::move(term)));	
-	return m_FreshTerms.back();
+	m_Memory.resize(numLocs);
+	m_Stacks = m_Memory.data();
 }
 
-std::string Machine::getStackDebug() const
+void Machine::collectGarbage()
 {
-	std::stringstream ss;
+	std::vector<bool> isMarked(m_Memory.size(), false);
+	std::unordered_set<const void *> seenFrames;
 
-	ss << "---- Stacks ----" << '\n';
+	std::vector<Loc_t> pendingLocs;
+	std::vector<const Closure_t *> pendingClosures;
+
+	// Input terms can only be released by the tree walker, the other engines
+	// keep the code they made of every term they ran (keyed by the term). The
+	// arena of a term is found from the chunks of the arenas.
+	struct InputChunk
+	{
+		uintptr_t Begin;
+		uintptr_t End;
+		size_t Input;
+	};
+
+	std::vector<InputChunk> inputChunks;
+	std::vector<bool> isInputMarked(m_InputTerms.size(), false);
+
+	if (m_Options.Engine == ExecEngine::Tree)
+	{
+		for (size_t input = 0; input < m_InputTerms.size(); ++input)
+		{
+			m_InputTerms[input]->visitChunks([&](const std::byte *begin, const std::byte *end) {
+				inputChunks.push_back({reinterpret_cast<uintptr_t>(begin), reinterpret_cast<uintptr_t>(end), input});
+			});
+		}
+
+		std::sort(inputChunks.begin(), inputChunks.end(), [](const InputChunk &a, const InputChunk &b) {
+			return a.Begin < b.Begin;
+		});
+	}
+
+	auto markTerm = [&](const Term *term) {
+		if (inputChunks.empty())
+		{
+			return;
+		}
+
+		uintptr_t addr = reinterpret_cast<uintptr_t>(term);
+		auto it = std::upper_bound(inputChunks.begin(), inputChunks.end(), addr, [](uintptr_t addr, const InputChunk &chunk) {
+			return addr < chunk.Begin;
+		});
+
+		if (it != inputChunks.begin() && addr < std::prev(it)->End)
+		{
+			isInputMarked[std::prev(it)->Input] = true;
+		}
+	};
+
+	auto markLoc = [&](Loc_t loc) {
+		if (m_IsDynamicLoc[loc] && !isMarked[loc])
+		{
+			isMarked[loc] = true;
+			pendingLocs.push_back(loc);
+		}
+	};
+
+	auto markValue = [&](const Value &value) {
+		if (value.isLoc())
+		{
+			markLoc(value.asLoc());
+		}
+		else if (value.isClosure())
+		{
+			pendingClosures.push_back(&value.asClosure());
+		}
+	};
+
+	auto markEnv = [&](const Env_t &env) {
+		env.first.visit([&](const void *frame, const Value *value) {
+			if (!seenFrames.insert(frame).second)
+			{
+				return false;
+			}
+			if (value)
+			{
+				markValue(*value);
+			}
+			return true;
+		});
+
+		env.second.visit([&](const void *frame, const Loc_t *loc) {
+			if (!seenFrames.insert(frame).second)
+			{
+				return false;
+			}
+			if (loc)
+			{
+				markLoc(*loc);
+			}
+			return true;
+		});
+	};
+
+	// Roots are the control stack and every named location, a location created by
+	// 'new' has no name so it can only be reached through the values that hold it
+	for (const Closure_t &closure : m_Control)
+	{
+		markEnv(closure.first);
+		markTerm(closure.second.get());
+	}
+
+	m_CallTrace.visitTerms(markTerm);
 
-	for (auto itMemory = m_Memory.begin(); itMemory != m_Memory.end(); ++itMemory)
+	for (const CodeFrame_t &frame : m_Frames)
 	{
-		if (auto idOpt = getIdFromReservedLoc(itMemory->first))
+		markEnv(frame.Env);
+	}
+
+	for (const NodeFrame_t &frame : m_NodeFrames)
+	{
+		markEnv(frame.Env);
+	}
+
+	for (Loc_t loc = 0; loc < m_Memory.size(); ++loc)
+	{
+		if (!m_IsDynamicLoc[loc])
+		{
+			for (const Value &value : m_Memory[loc])
+			{
+				markValue(value);
+			}
+		}
+	}
+
+	while (!pendingLocs.empty() || !pendingClosures.empty())
+	{
+		if (!pendingClosures.empty())
 		{
-			ss << "  -- (Reserved) Location " << idOpt.value() << '\n';
+			const Closure_t *closure = pendingClosures.back();
+			pendingClosures.pop_back();
+
+			markEnv(closure->first);
+			markTerm(closure->second.get());
 		}
 		else
 		{
-			ss << "  -- Location " << itMemory->first << '\n';
+			Loc_t loc = pendingLocs.back();
+			pendingLocs.pop_back();
+
+			for (const Value &value : m_Memory[loc])
+			{
+				markValue(value);
+			}
 		}
+	}
 
-		for (auto itStack = itMemory->second.rbegin(); itStack != itMemory->second.rend(); ++itStack)
+	// Release the stacks of every location that can no longer be reached
+	size_t numLive = 0;
+
+	for (Loc_t loc : m_DynamicLocs)
+	{
+		if (isMarked[loc])
 		{
-			ss << "    " << stringifyClosure(*itStack) << '\n';
+			m_DynamicLocs[numLive++] = loc;
+		}
+		else
+		{
+			m_Stats.LocsReclaimed++;
+			m_Stats.BytesReclaimed += sizeof(ValueStack_t) + m_Memory[loc].capacity() * sizeof(Value);
+
+			m_Memory[loc] = ValueStack_t();
+			m_IsDynamicLoc[loc] = false;
+			m_LocAllocator.release(loc);
 		}
+	}
+
+	m_DynamicLocs.resize(numLive);
+
+	if (!inputChunks.empty())
+	{
+		size_t numLiveInputs = 0;
 
-		auto itMemoryCopy = itMemory;
-		if (!(++itMemoryCopy == m_Memory.end()))
+		for (size_t input = 0; input < m_InputTerms.size(); ++input)
 		{
-			ss << '\n';
+			if (isInputMarked[input])
+			{
+				m_InputTerms[numLiveInputs++] = std::move(m_InputTerms[input]);
+			}
+			else
+			{
+				m_Stats.BytesReclaimed += m_InputTerms[input]->getNumBytes();
+			}
 		}
+
+		m_InputTerms.resize(numLiveInputs);
 	}
 
-	ss << "--------------------";
+	m_Stats.GcRuns++;
+	m_AllocsSinceGc = 0;
+	// Scale the next threshold by everything that was traced, not just the live
+	// locations, so a deep control stack does not make collection quadratic
+	uint64_t numTraced = numLive + m_InputTerms.size() + seenFrames.size() + m_Control.size() + m_Frames.size() + m_NodeFrames.size();
+	m_NextGc = std::max<uint64_t>(m_Options.GcThreshold, static_cast<uint64_t>(numTraced * m_Options.GcGrowth));
+}
 
-	return ss.str();
+const MachineStats &Machine::getStats() const
+{
+	return m_Stats;
 }
 
-std::string Machine::getCallstackDebug() const
+std::string Machine::getStackDebug() const
 {
 	std::stringstream ss;
 
-	ss << "---- Call Stack ----" << '\n';
+	ss << "---- Stacks ----" << '\n';
+
+	// Every interned name has a slot in memory, so only list the locations
+	// which actually hold something
+	bool isFirst = true;
 
-	for (auto itCallStack = m_CallStack.rbegin(); itCallStack != m_CallStack.rend(); ++itCallStack)
+	for (Loc_t loc = 0; loc < m_Memory.size(); ++loc)
 	{
-		ss << std::string(m_CallStack.size() - (m_CallStack.rend() - itCallStack), ' ');
-		ss << "> " << itCallStack->first << " => " << stringifyTerm(itCallStack->second) << "\n";
+		const ValueStack_t &stack = m_Memory[loc];
+
+		if (stack.empty())
+		{
+			continue;
+		}
+
+		if (!isFirst)
+		{
+			ss << '\n';
+		}
+		isFirst = false;
+
+		if (isReservedLoc(loc))
+		{
+			ss << "  -- (Reserved) Location " << getLocName(loc) << '\n';
+		}
+		else
+		{
+			ss << "  -- Location " << getLocName(loc) << '\n';
+		}
+
+		for (auto itStack = stack.rbegin(); itStack != stack.rend(); ++itStack)
+		{
+			ss << "    " << stringifyValue(*itStack) << '\n';
+		}
 	}
 
-	ss << "---------------";
+	ss << "--------------------";
 
 	return ss.str();
+}
+
+std::string Machine::getCallstackDebug() const
+{
+	return m_CallTrace.format();
 }
\ No newline at end of file
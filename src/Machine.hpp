@@ -3,41 +3,295 @@
 #include <unordered_map>
 #include <vector>
 #include <utility>
+#include <iterator>
+#include <cstdint>
 
 #include "Term.hpp"
 #include "Parser.hpp"
+#include "Env.hpp"
+#include "Bytecode.hpp"
+#include "CallTrace.hpp"
 
-// Ouch.. using a void pointer here is rough :/
-using VarEnv_t = std::unordered_map<Var_t, std::shared_ptr<void>>;
-using LocVarEnv_t = std::unordered_map<LocVar_t, Loc_t>;
+struct Closure_t;
+struct ExecNode;
+class NodeTree;
+class NodeJit;
+
+using ClosureRef_t = std::shared_ptr<const Closure_t>;
+
+// A value held by a location stack or bound in an environment. Primitives
+// and locations are stored unboxed so pushing and popping them never
+// allocates, anything else is a reference to a shared closure.
+class Value
+{
+public:
+	// Compiled code reads and writes the kind of values directly (see NodeJit)
+	enum class Kind : uint8_t
+	{
+		Prim,
+		Loc,
+		Closure
+	};
+
+	static Value fromPrim(Prim_t prim);
+	static Value fromLoc(Loc_t loc);
+	static Value fromClosure(ClosureRef_t closure);
+
+	bool isPrim() const;
+	bool isLoc() const;
+	bool isClosure() const;
+
+	Prim_t asPrim() const;
+	Loc_t asLoc() const;
+	const Closure_t &asClosure() const;
+
+	// Where a value keeps its kind and the 32 bits of its primitive or location
+	static size_t getKindOffset();
+	static size_t getWordOffset();
+
+private:
+	Value(Kind kind, uint32_t word, ClosureRef_t closure);
+
+private:
+	Kind m_Kind;
+	uint32_t m_Word;
+	// Null unless this is a closure
+	ClosureRef_t m_Closure;
+};
+
+using VarEnv_t = LinkedEnv<Value>;
+using LocVarEnv_t = LinkedEnv<Loc_t>;
 using Env_t = std::pair<VarEnv_t, LocVarEnv_t>;
 
-using Closure_t = std::pair<Env_t, TermHandle_t>;
-using ClosureStack_t = std::vector<Closure_t>;
-using ClosureMemory_t = std::unordered_map<Loc_t, ClosureStack_t>;
+// A closure is declared as a struct (rather than an alias) so that values
+// above can refer to it before it is defined
+struct Closure_t : public std::pair<Env_t, TermHandle_t>
+{
+	using std::pair<Env_t, TermHandle_t>::pair;
+};
+
+// The environment a closure of an application's argument is made with, holding
+// only the variables it captures (frames without a value stay empty)
+Env_t captureEnv(const Env_t &env, const AppTerm &app);
+
+// A location stack. It owns its storage rather than being a std::vector so that
+// compiled code can push and pop through its pointers (see NodeJit). Every slot
+// up to the capacity holds a constructed value and the slots past the end never
+// hold a closure, so pushing a primitive or a location only writes its kind and
+// its word, and popping one only moves the end.
+struct ValueStack_t
+{
+	Value *Begin = nullptr;
+	Value *End = nullptr;
+	Value *Cap = nullptr;
+
+	ValueStack_t() = default;
+	ValueStack_t(ValueStack_t &&other) noexcept;
+	ValueStack_t &operator=(ValueStack_t &&other) noexcept;
+	~ValueStack_t();
+
+	ValueStack_t(const ValueStack_t &) = delete;
+	ValueStack_t &operator=(const ValueStack_t &) = delete;
+
+	bool empty() const;
+	size_t size() const;
+	size_t capacity() const;
+
+	Value &back();
+	const Value &back() const;
+	Value &operator[](size_t index);
+	const Value &operator[](size_t index) const;
+
+	const Value *begin() const;
+	const Value *end() const;
+	std::reverse_iterator<const Value *> rbegin() const;
+	std::reverse_iterator<const Value *> rend() const;
+
+	void push_back(Value value);
+	void pop_back();
+	void reserve(size_t capacity);
+
+private:
+	void release();
+};
+
+// Location stacks indexed directly by location ID
+using Memory_t = std::vector<ValueStack_t>;
+
+using ControlStack_t = std::vector<Closure_t>;
+
+// A continuation of compiled code, the environment to restore and the address
+// to return to
+struct CodeFrame_t
+{
+	Env_t Env;
+	CodeAddr_t Pc;
+};
+
+using FrameStack_t = std::vector<CodeFrame_t>;
+
+// A continuation of the node engine, the environment to restore and the node
+// to continue with
+struct NodeFrame_t
+{
+	Env_t Env;
+	const ExecNode *Node;
+};
+
+using NodeFrameStack_t = std::vector<NodeFrame_t>;
+
+// Hands out IDs for locations created by 'new', which follow the IDs of the
+// named locations. IDs released by the collector are reused before any fresh
+// ones are minted, so both paths are O(1).
+class LocAllocator
+{
+public:
+	std::optional<Loc_t> allocate();
+	void release(Loc_t loc);
+	// Mints an ID that was not handed out since the last reset
+	std::optional<Loc_t> mint();
+	// Never mints IDs below 'numLocs', which were given to names read while the
+	// machine runs. Fails if that would leave no IDs to mint
+	bool reserve(size_t numLocs);
+
+	// Forgets every location handed out and restarts after the named locations
+	void reset();
+
+	// One past the highest ID minted, memory is indexed by IDs below this
+	size_t getNumLocs() const;
+
+private:
+	std::vector<Loc_t> m_Free;
+	Loc_t m_NextId = k_NumReservedLocs;
+};
+
+enum class ExecEngine
+{
+	// Walks the term tree directly
+	Tree,
+	// Compiles the program to bytecode first and executes that
+	Bytecode,
+	// Converts each term to a node with its own handler and executes those
+	Nodes,
+	// Walks the terms of each function until it has been called often enough,
+	// then runs it as nodes
+	Tiered
+};
+
+struct MachineOptions
+{
+	ExecEngine Engine = ExecEngine::Tree;
+
+	// Stop after this many steps, zero means run until the control stack is empty
+	uint64_t MaxSteps = 0;
+
+	// Keep this many of the innermost calls to show in errors, zero records nothing
+	size_t CallTraceDepth = 0;
+
+	// Fuse common sequences of bytecode into superinstructions
+	bool Superinstructions = true;
+
+	// Compile functions of the node engine to native code once they have been
+	// called 'JitThreshold' times (x86-64 Linux only)
+	bool Jit = false;
+	uint64_t JitThreshold = 64;
 
-using Callstack_t = std::vector<std::pair<std::string, TermHandle_t>>;
+	// Promote a function from the tree walker to the node engine once it has
+	// been called this many times (tiered engine only)
+	uint64_t TierThreshold = 64;
+	// Report promotions and the tier each function ended up in
+	bool TierLog = false;
+
+	// Count how often each pair of adjacent instructions of a block is executed
+	// (bytecode engine only), this is what superinstructions are chosen from
+	bool ProfileOps = false;
+
+	// Collect unreachable locations after this many have been created by 'new',
+	// zero disables collection
+	uint64_t GcThreshold = 4096;
+	// Wait for at least this many times the amount of traced state to be created
+	// before collecting again, so that large live heaps are not rescanned often
+	double GcGrowth = 1.0;
+};
+
+struct MachineStats
+{
+	uint64_t Steps = 0;
+
+	uint64_t LocsAllocated = 0;
+	uint64_t LocsRecycled = 0;
+
+	uint64_t GcRuns = 0;
+	uint64_t LocsReclaimed = 0;
+	uint64_t BytesReclaimed = 0;
+
+	uint64_t TierPromotions = 0;
+	// Frames of promoted functions that were already on the control stack,
+	// these resume as nodes once they are returned to
+	uint64_t TierFramesReplaced = 0;
+
+	uint64_t JitFunctions = 0;
+	uint64_t JitCodeBytes = 0;
+
+	// Indexed by the first opcode times the number of opcodes plus the second
+	std::vector<uint64_t> OpPairs;
+};
 
 class Machine
 {
 public:
+	Machine(const MachineOptions &options = {});
+
 	void execute(const Program &funcs);
 
+	const MachineStats &getStats() const;
+
 	std::string getStackDebug() const;
 	std::string getCallstackDebug() const;
 
 private:
-	std::optional<Closure_t> tryPop(Env_t env, Loc_t loc);
-	std::optional<Prim_t> tryPopPrim(Env_t env, Loc_t loc);
-	std::optional<Loc_t> tryPopLoc(Env_t env, Loc_t loc);
+	void executeTree(const Program &program);
+	void executeBytecode(const Program &program);
+	void executeNodes(const Program &program);
+	void executeTiered(const Program &program, NodeTree &tree);
+
+	// Runs the closure on top of the control stack for a single step
+	void stepTree(const Program &program);
 
-	TermHandle_t freshTerm(Term &&term);
+	Value readInput(const Program &program);
+
+	std::optional<Value> tryPop(Loc_t loc);
+	std::optional<Prim_t> tryPopPrim(Loc_t loc);
+	std::optional<Loc_t> tryPopLoc(Loc_t loc);
+
+	Loc_t newLoc();
+	void resizeMemory(size_t numLocs);
+	void collectGarbage();
 
 private:
-	ClosureMemory_t m_Memory;
-	ClosureStack_t m_Control;
+	MachineOptions m_Options;
+	MachineStats m_Stats;
+
+	// Each term read from the input stream has an arena of its own, which is
+	// released by a collection once nothing refers to the term any more
+	std::vector<std::unique_ptr<TermArena>> m_InputTerms;
+
+	// The stacks of memory, kept for compiled code as memory moves when it grows
+	Memory_t m_Memory;
+	ValueStack_t *m_Stacks = nullptr;
+	ControlStack_t m_Control;
+	FrameStack_t m_Frames;
+	NodeFrameStack_t m_NodeFrames;
+	// Only set while the node engine runs with the JIT enabled
+	NodeJit *m_NodeJit = nullptr;
 
-	Callstack_t m_CallStack;
+	// Locations created by 'new', only these can ever be collected as every
+	// named location can be reached from the program text
+	LocAllocator m_LocAllocator;
+	std::vector<bool> m_IsDynamicLoc;
+	std::vector<Loc_t> m_DynamicLocs;
+	uint64_t m_AllocsSinceGc = 0;
+	uint64_t m_NextGc = 0;
 
-	std::vector<TermOwner_t> m_FreshTerms;
+	CallTrace m_CallTrace;
 };
\ No newline at end of file
@@ -3,11 +3,19 @@
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 
 #include "Lexer.hpp"
 #include "Parser.hpp"
 #include "Program.hpp"
 #include "Machine.hpp"
+#include "CppEmitter.hpp"
 #include "Utils.hpp"
 
 // --- Basics ---
@@ -62,6 +70,10 @@ struct Args
 {
 	std::string Source;
 	bool Debug = false;
+	bool Stats = false;
+	bool EmitCpp = false;
+	MachineOptions Options;
+	OptimizerOptions Optimizer;
 };
 
 static std::optional<std::string> readFile(const std::string &path)
@@ -78,14 +90,30 @@ static std::optional<std::string> readFile(const std::string &path)
 	return buffer.str();
 }
 
+static std::optional<long> getPeakMemoryKb()
+{
+#if defined(__APPLE__)
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+#elif defined(__unix__)
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+#else
+	return std::nullopt;
+#endif
+}
+
 static Args parseArgs(int argc, char **argv)
 {
 	Args args;
 	bool isSrcSpecified = false;
+	bool isEngineSpecified = false;
 
 	auto fail = [](std::string msg) {
 		std::cerr << msg << std::endl;
-		std::cerr << "Usage: cfmc [--help] [--debug] [--file path | --source src]" << std::endl;
+		std::cerr << "Usage: cfmc [--help] [--debug] [--call-trace n] [--stats] [--inline n] [--specialize n] [--fold] [--engine tree|bytecode|nodes|tiered] [--tier-threshold n] [--tier-log] [--jit] [--jit-threshold n] [--no-superinstructions] [--profile-ops] [--emit-cpp] [--max-steps n] [--gc-threshold n] [--gc-growth f] [--file path | --source src]" << std::endl;
 		std::exit(1);
 	};
 
@@ -101,6 +129,148 @@ static Args parseArgs(int argc, char **argv)
 		{
 			args.Debug = true;
 		}
+		else if (arg == "--stats")
+		{
+			args.Stats = true;
+		}
+		else if (arg == "--inline")
+		{
+			if (i + 1 < argc)
+			{
+				args.Optimizer.InlineThreshold = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected term count after '--inline'.");
+			}
+		}
+		else if (arg == "--specialize")
+		{
+			if (i + 1 < argc)
+			{
+				args.Optimizer.MaxSpecializations = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected clone count after '--specialize'.");
+			}
+		}
+		else if (arg == "--fold")
+		{
+			args.Optimizer.Fold = true;
+		}
+		else if (arg == "--engine")
+		{
+			std::string engine = i + 1 < argc ? argv[++i] : "";
+			isEngineSpecified = true;
+
+			if (engine == "tree")
+			{
+				args.Options.Engine = ExecEngine::Tree;
+			}
+			else if (engine == "bytecode")
+			{
+				args.Options.Engine = ExecEngine::Bytecode;
+			}
+			else if (engine == "nodes")
+			{
+				args.Options.Engine = ExecEngine::Nodes;
+			}
+			else if (engine == "tiered")
+			{
+				args.Options.Engine = ExecEngine::Tiered;
+			}
+			else
+			{
+				fail("Expected 'tree', 'bytecode', 'nodes' or 'tiered' after '--engine'.");
+			}
+		}
+		else if (arg == "--tier-threshold")
+		{
+			if (i + 1 < argc)
+			{
+				args.Options.TierThreshold = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected call count after '--tier-threshold'.");
+			}
+		}
+		else if (arg == "--tier-log")
+		{
+			args.Options.TierLog = true;
+		}
+		else if (arg == "--jit")
+		{
+			args.Options.Jit = true;
+		}
+		else if (arg == "--jit-threshold")
+		{
+			if (i + 1 < argc)
+			{
+				args.Options.JitThreshold = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected call count after '--jit-threshold'.");
+			}
+		}
+		else if (arg == "--no-superinstructions")
+		{
+			args.Options.Superinstructions = false;
+		}
+		else if (arg == "--profile-ops")
+		{
+			args.Options.ProfileOps = true;
+		}
+		else if (arg == "--emit-cpp")
+		{
+			args.EmitCpp = true;
+		}
+		else if (arg == "--call-trace")
+		{
+			if (i + 1 < argc)
+			{
+				args.Options.CallTraceDepth = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected call count after '--call-trace'.");
+			}
+		}
+		else if (arg == "--max-steps")
+		{
+			if (i + 1 < argc)
+			{
+				args.Options.MaxSteps = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected step count after '--max-steps'.");
+			}
+		}
+		else if (arg == "--gc-threshold")
+		{
+			if (i + 1 < argc)
+			{
+				args.Options.GcThreshold = std::stoull(argv[++i]);
+			}
+			else
+			{
+				fail("Expected location count after '--gc-threshold'.");
+			}
+		}
+		else if (arg == "--gc-growth")
+		{
+			if (i + 1 < argc)
+			{
+				args.Options.GcGrowth = std::stod(argv[++i]);
+			}
+			else
+			{
+				fail("Expected growth factor after '--gc-growth'.");
+			}
+		}
 		if (arg == "--file" && !isSrcSpecified)
 		{
 			if (i + 1 < argc)
@@ -143,6 +313,30 @@ static Args parseArgs(int argc, char **argv)
 		fail("No file or source is specified.");
 	}
 
+	// Compiled functions are part of the node engine, which is used unless
+	// another engine was asked for
+	if (args.Options.Jit)
+	{
+		if (isEngineSpecified && args.Options.Engine != ExecEngine::Nodes)
+		{
+			fail("'--jit' compiles functions of the node engine, it needs '--engine nodes'.");
+		}
+
+		args.Options.Engine = ExecEngine::Nodes;
+	}
+
+	// Only the bytecode engine counts the instructions it executes
+	if (args.Options.ProfileOps && args.Options.Engine != ExecEngine::Bytecode)
+	{
+		fail("'--profile-ops' counts bytecode instructions, it needs '--engine bytecode'.");
+	}
+
+	// Debugging shows where errors happen unless asked for a specific depth
+	if (args.Debug && args.Options.CallTraceDepth == 0)
+	{
+		args.Options.CallTraceDepth = 64;
+	}
+
 	return args;
 }
 
@@ -151,8 +345,28 @@ int main(int argc, char **argv)
 	auto args = parseArgs(argc, argv);
 
 	Parser parser;
-	Machine machine;
-	machine.execute(parser.parseProgram(args.Source));
+
+	// Translating only needs the program, nothing is run
+	if (args.EmitCpp)
+	{
+		const Program program = parser.parseProgram(args.Source, args.Optimizer);
+
+		if (auto codeOpt = CppEmitter(program).emit())
+		{
+			std::cout << codeOpt.value();
+			return 0;
+		}
+
+		std::cerr << "[Emitter Error] Program has no entry point ('main' is not defined)!" << std::endl;
+		return 1;
+	}
+
+	Machine machine(args.Options);
+
+	auto start = std::chrono::steady_clock::now();
+	const Program program = parser.parseProgram(args.Source, args.Optimizer);
+	machine.execute(program);
+	auto end = std::chrono::steady_clock::now();
 	
 	if (args.Debug)
 	{
@@ -160,4 +374,71 @@ int main(int argc, char **argv)
 		std::cout << machine.getStackDebug();
 		std::cout << std::endl;
 	}
+
+	if (args.Stats)
+	{
+		const MachineStats &stats = machine.getStats();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		std::cerr << "---- Stats ----" << std::endl;
+		std::cerr << "  Steps     : " << stats.Steps << std::endl;
+		std::cerr << "  Time (s)  : " << seconds << std::endl;
+		std::cerr << "  Steps/sec : " << static_cast<uint64_t>(seconds > 0.0 ? stats.Steps / seconds : 0.0) << std::endl;
+
+		std::cerr << "  New locs  : " << stats.LocsAllocated << " (" << stats.LocsRecycled << " recycled)" << std::endl;
+		std::cerr << "  GC runs   : " << stats.GcRuns << std::endl;
+		std::cerr << "  GC locs   : " << stats.LocsReclaimed << std::endl;
+		std::cerr << "  GC bytes  : " << stats.BytesReclaimed << std::endl;
+
+		if (args.Optimizer.InlineThreshold > 0 || args.Optimizer.MaxSpecializations > 0 || args.Optimizer.Fold)
+		{
+			const OptimizerStats &optimizerStats = program.getOptimizerStats();
+			std::cerr << "  Inlines   : " << optimizerStats.Inlines << std::endl;
+			std::cerr << "  Clones    : " << optimizerStats.Specializations << std::endl;
+			std::cerr << "  Folds     : " << optimizerStats.Folds << std::endl;
+			std::cerr << "  Saved     : " << optimizerStats.StepsEliminated << " steps each time the optimized terms run" << std::endl;
+		}
+
+		if (args.Options.Engine == ExecEngine::Tiered)
+		{
+			std::cerr << "  Promoted  : " << stats.TierPromotions << " (" << stats.TierFramesReplaced << " frames replaced)" << std::endl;
+		}
+
+		if (args.Options.Jit)
+		{
+			std::cerr << "  JIT funcs : " << stats.JitFunctions << " (" << stats.JitCodeBytes << " bytes)" << std::endl;
+		}
+
+		std::cerr << "  Terms     : " << program.getTerms().getNumTerms() << " (" << program.getTerms().getNumBytes() << " bytes)" << std::endl;
+
+		if (auto peakOpt = getPeakMemoryKb())
+		{
+			std::cerr << "  Peak (KB) : " << peakOpt.value() << std::endl;
+		}
+	}
+
+	if (args.Options.ProfileOps)
+	{
+		const std::vector<uint64_t> &pairs = machine.getStats().OpPairs;
+
+		std::vector<size_t> order;
+		for (size_t i = 0; i < pairs.size(); ++i)
+		{
+			if (pairs[i] > 0)
+			{
+				order.push_back(i);
+			}
+		}
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+			return pairs[a] > pairs[b];
+		});
+
+		std::cerr << "---- Adjacent Ops ----" << std::endl;
+		for (size_t i : order)
+		{
+			std::cerr << "  " << getOpName(static_cast<OpCode>(i / k_NumOpCodes))
+				<< " -> " << getOpName(static_cast<OpCode>(i % k_NumOpCodes))
+				<< " : " << pairs[i] << std::endl;
+		}
+	}
 }
\ No newline at end of file
@@ -0,0 +1,365 @@
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <variant>
+#include <memory>
+#include <utility>
+#include <initializer_list>
+#include <iterator>
+#include <cstdlib>
+#include <cstdint>
+
+#include "Config.hpp"
+#include "Env.hpp"
+
+// The runtime of programs translated to C++ with '--emit-cpp' (see CppEmitter).
+// It is header only so that a translated program only needs this directory on
+// its include path. Values, environments and location stacks work like they do
+// in the machine, while code is split into blocks (function bodies, arguments,
+// branches of cases and the code after a call). Each block is a native function
+// which returns the next block to run, so calls never grow the native stack.
+
+struct NativeBlock;
+struct NativeClosure;
+
+using NativeClosureRef_t = std::shared_ptr<const NativeClosure>;
+using NativeValue_t = std::variant<Prim_t, Loc_t, NativeClosureRef_t>;
+using NativeEnv_t = std::pair<LinkedEnv<NativeValue_t>, LinkedEnv<Loc_t>>;
+
+class NativeMachine;
+
+struct NativeBlock
+{
+	// Runs the block and returns the block to run next, or null to return to
+	// the most recent continuation
+	const NativeBlock *(*Code)(NativeMachine &machine, NativeEnv_t &env);
+	// Prints the term a closure of this block was made from (arguments only)
+	void (*Show)(NativeMachine &machine, std::ostream &os, const NativeEnv_t &env);
+};
+
+struct NativeClosure
+{
+	NativeEnv_t Env;
+	const NativeBlock *Block;
+};
+
+class NativeMachine
+{
+public:
+	// Locations are given the names they had when the program was translated,
+	// any location after those is created by 'new'
+	explicit NativeMachine(std::vector<std::string> locNames)
+		: m_Memory(locNames.size())
+		, m_LocNames(std::move(locNames))
+	{}
+
+	void run(const NativeBlock *block)
+	{
+		NativeEnv_t env;
+
+		while (true)
+		{
+			while (block)
+			{
+				block = block->Code(*this, env);
+			}
+
+			if (m_Frames.empty())
+			{
+				break;
+			}
+
+			env = std::move(m_Frames.back().Env);
+			block = m_Frames.back().Block;
+			m_Frames.pop_back();
+		}
+
+		std::cout.flush();
+	}
+
+	[[noreturn]] void error(const std::string &message)
+	{
+		std::cout.flush();
+		std::cerr << "[Machine Error] " << message << std::endl;
+		std::exit(1);
+	}
+
+	std::vector<NativeValue_t> &getStack(Loc_t loc)
+	{
+		return m_Memory[loc];
+	}
+
+	void push(Loc_t loc, NativeValue_t value, bool isLocApp = false)
+	{
+		if (isStackLoc(loc))
+		{
+			m_Memory[loc].push_back(std::move(value));
+		}
+		// Output stream
+		else if (loc == k_OutputLoc)
+		{
+			std::cout << toString(value) << '\n';
+		}
+		// New and input streams, the null stream is discarded
+		else if (loc != k_NullLoc)
+		{
+			error(std::string(isLocApp ? "Location application" : "Application")
+				+ " cannot push to '" + (loc == k_NewLoc ? "new" : "input") + "' location !"
+				+ (isLocApp ? " " : ""));
+		}
+	}
+
+	// Pops for an abstraction, which can also bind a new location or input
+	NativeValue_t pop(Loc_t loc)
+	{
+		if (isStackLoc(loc))
+		{
+			std::vector<NativeValue_t> &stack = getNonEmptyStack(loc);
+
+			NativeValue_t value = std::move(stack.back());
+			stack.pop_back();
+			return value;
+		}
+
+		switch (loc)
+		{
+		case k_NewLoc:
+			return newLoc();
+		case k_InputLoc:
+			return readInput();
+		case k_OutputLoc:
+			error("Abstraction cannot bind from 'output' location !");
+		default:
+			error("Abstraction cannot bind from 'null' location !");
+		}
+	}
+
+	// Pops for a location abstraction
+	Loc_t popLoc(Loc_t loc)
+	{
+		if (isStackLoc(loc))
+		{
+			std::vector<NativeValue_t> &stack = getNonEmptyStack(loc);
+
+			if (!std::holds_alternative<Loc_t>(stack.back()))
+			{
+				error("Location abstraction cannot pop from location '" + getLocName(loc) + "' !");
+			}
+
+			Loc_t value = std::get<Loc_t>(stack.back());
+			stack.pop_back();
+			return value;
+		}
+
+		switch (loc)
+		{
+		case k_NewLoc:
+			return newLoc();
+		case k_InputLoc:
+			error("Location abstraction cannot pop from 'input' location !");
+		case k_OutputLoc:
+			error("Location abstraction cannot pop from 'output' location !");
+		default:
+			error("Location abstraction cannot pop from 'null' location !");
+		}
+	}
+
+	// Pops a primitive from lambda, failing with the message if it is anything else
+	Prim_t popPrim(const char *message)
+	{
+		std::vector<NativeValue_t> &stack = getNonEmptyStack(k_LambdaLoc);
+
+		if (!std::holds_alternative<Prim_t>(stack.back()))
+		{
+			error(message);
+		}
+
+		Prim_t value = std::get<Prim_t>(stack.back());
+		stack.pop_back();
+		return value;
+	}
+
+	Loc_t popLocValue(const char *message)
+	{
+		std::vector<NativeValue_t> &stack = getNonEmptyStack(k_LambdaLoc);
+
+		if (!std::holds_alternative<Loc_t>(stack.back()))
+		{
+			error(message);
+		}
+
+		Loc_t value = std::get<Loc_t>(stack.back());
+		stack.pop_back();
+		return value;
+	}
+
+	// Primitives wrap around on overflow (see addPrims)
+	void add()
+	{
+		Prim_t prim1 = popPrim("Binary operation cannot use a non-primitive-value as first operand !");
+		Prim_t prim2 = popPrim("Binary operation cannot use a non-primitive-value as second operand !");
+		m_Memory[k_LambdaLoc].push_back(addPrims(prim2, prim1));
+	}
+
+	void sub()
+	{
+		Prim_t prim1 = popPrim("Binary operation cannot use a non-primitive-value as first operand !");
+		Prim_t prim2 = popPrim("Binary operation cannot use a non-primitive-value as second operand !");
+		m_Memory[k_LambdaLoc].push_back(subPrims(prim2, prim1));
+	}
+
+	// A closure holding only the variables its block captures, given by their
+	// index in the current environment
+	NativeValue_t closure(const NativeEnv_t &env, std::initializer_list<Index_t> captures,
+		std::initializer_list<Index_t> locCaptures, const NativeBlock *block)
+	{
+		NativeEnv_t captured;
+
+		for (auto it = std::rbegin(captures); it != std::rend(captures); ++it)
+		{
+			captured.first = captured.first.bind(*env.first.find(*it));
+		}
+		for (auto it = std::rbegin(locCaptures); it != std::rend(locCaptures); ++it)
+		{
+			captured.second = captured.second.bind(*env.second.find(*it));
+		}
+
+		return std::make_shared<const NativeClosure>(NativeClosure{std::move(captured), block});
+	}
+
+	// Calls save the current environment with the block to continue with, calls
+	// in tail position have no continuation
+	const NativeBlock *call(NativeEnv_t &env, const NativeBlock *func, const NativeBlock *cont)
+	{
+		if (cont)
+		{
+			m_Frames.push_back({std::move(env), cont});
+		}
+
+		env = {};
+		return func;
+	}
+
+	const NativeBlock *callVar(NativeEnv_t &env, Index_t index, const NativeBlock *cont)
+	{
+		const NativeValue_t &value = *env.first.find(index);
+
+		if (!std::holds_alternative<NativeClosureRef_t>(value))
+		{
+			error("Value '" + toString(value) + "' cannot be executed by machine !");
+		}
+
+		// Hold on to the closure, it may only be referenced by the environment
+		// which is about to be replaced
+		NativeClosureRef_t closure = std::get<NativeClosureRef_t>(value);
+
+		if (cont)
+		{
+			m_Frames.push_back({std::move(env), cont});
+		}
+
+		env = closure->Env;
+		return closure->Block;
+	}
+
+	// Branches of cases run in the current environment
+	const NativeBlock *branch(const NativeEnv_t &env, const NativeBlock *target, const NativeBlock *cont)
+	{
+		if (cont)
+		{
+			m_Frames.push_back({env, cont});
+		}
+
+		return target;
+	}
+
+	void show(std::ostream &os, const NativeValue_t &value)
+	{
+		if (const Prim_t *prim = std::get_if<Prim_t>(&value))
+		{
+			os << *prim;
+		}
+		else if (const Loc_t *loc = std::get_if<Loc_t>(&value))
+		{
+			os << '#' << getLocName(*loc);
+		}
+		else
+		{
+			const NativeClosure &closure = *std::get<NativeClosureRef_t>(value);
+			closure.Block->Show(*this, os, closure.Env);
+		}
+	}
+
+	std::string toString(const NativeValue_t &value)
+	{
+		std::ostringstream ss;
+		show(ss, value);
+		return ss.str();
+	}
+
+	std::string getLocName(Loc_t loc) const
+	{
+		return loc < m_LocNames.size() ? m_LocNames[loc] : "loc_" + std::to_string(loc);
+	}
+
+private:
+	struct Frame
+	{
+		NativeEnv_t Env;
+		const NativeBlock *Block;
+	};
+
+	static bool isStackLoc(Loc_t loc)
+	{
+		return loc == k_LambdaLoc || loc >= k_NumReservedLocs;
+	}
+
+	std::vector<NativeValue_t> &getNonEmptyStack(Loc_t loc)
+	{
+		std::vector<NativeValue_t> &stack = m_Memory[loc];
+
+		if (stack.empty())
+		{
+			error("Cannot pop from empty stack  '" + getLocName(loc) + "' !");
+		}
+
+		return stack;
+	}
+
+	// Locations are never reused, so they are named like the machine names them
+	// as long as it has not collected any
+	Loc_t newLoc()
+	{
+		m_Memory.emplace_back();
+		return static_cast<Loc_t>(m_Memory.size() - 1);
+	}
+
+	// Only primitives can be read, as running any other term would need the
+	// interpreter
+	NativeValue_t readInput()
+	{
+		std::string in;
+		std::cin >> in;
+
+		bool isPrim = !in.empty();
+		for (char c : in)
+		{
+			isPrim = isPrim && c >= '0' && c <= '9';
+		}
+
+		if (!isPrim)
+		{
+			error("Cannot read input '" + in + "' as a primitive, compiled programs can only read primitives !");
+		}
+
+		return static_cast<Prim_t>(std::stoi(in));
+	}
+
+private:
+	std::vector<std::vector<NativeValue_t>> m_Memory;
+	std::vector<Frame> m_Frames;
+	std::vector<std::string> m_LocNames;
+};
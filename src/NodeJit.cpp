@@ -0,0 +1,954 @@
+#include "NodeJit.hpp"
+
+#include <unordered_set>
+#include <limits>
+#include <cstring>
+
+// Code is emitted for the System V calling convention and made executable with
+// mmap, so compiling is limited to x86-64 Linux
+#if defined(__x86_64__) && defined(__linux__)
+#define CFMC_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	enum Reg : uint8_t
+	{
+		RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+
+	enum Cond : uint8_t
+	{
+		JB  = 0x82,
+		JAE = 0x83,
+		JE  = 0x84,
+		JNE = 0x85
+	};
+
+	using Label_t = size_t;
+
+	// Encodes the handful of instructions the templates need, jumps refer to
+	// labels which are patched once the code is complete
+	class Assembler
+	{
+	public:
+		const std::vector<uint8_t> &getCode() const
+		{
+			return m_Code;
+		}
+
+		size_t getOffset() const
+		{
+			return m_Code.size();
+		}
+
+		Label_t newLabel()
+		{
+			m_Labels.push_back(0);
+			return m_Labels.size() - 1;
+		}
+
+		void bind(Label_t label)
+		{
+			m_Labels[label] = m_Code.size();
+		}
+
+		void patchJumps()
+		{
+			for (auto [offset, label] : m_Fixups)
+			{
+				int32_t rel = static_cast<int32_t>(m_Labels[label] - (offset + 4));
+				std::memcpy(&m_Code[offset], &rel, sizeof(rel));
+			}
+		}
+
+		void push(Reg reg)
+		{
+			rexB(reg, false);
+			byte(0x50 + (reg & 7));
+		}
+
+		void pop(Reg reg)
+		{
+			rexB(reg, false);
+			byte(0x58 + (reg & 7));
+		}
+
+		// mov dst, src
+		void mov(Reg dst, Reg src)
+		{
+			rex(src, dst);
+			byte(0x89);
+			modRm(src, dst);
+		}
+
+		// mov dst, imm64
+		void movImm(Reg dst, uint64_t imm)
+		{
+			rexB(dst, true);
+			byte(0xB8 + (dst & 7));
+			bytes(&imm, sizeof(imm));
+		}
+
+		// Memory operands are [base + disp], where base is neither rsp nor r12
+
+		// mov dst, [base + disp]
+		void load(Reg dst, Reg base, int32_t disp = 0)
+		{
+			rex(dst, base);
+			byte(0x8B);
+			mem(dst, base, disp);
+		}
+
+		// mov [base + disp], src
+		void store(Reg base, int32_t disp, Reg src)
+		{
+			rex(src, base);
+			byte(0x89);
+			mem(src, base, disp);
+		}
+
+		// mov dst32, [base + disp], which clears the upper half of dst
+		void load32(Reg dst, Reg base, int32_t disp)
+		{
+			rex(dst, base, false);
+			byte(0x8B);
+			mem(dst, base, disp);
+		}
+
+		// mov [base + disp], src32
+		void store32(Reg base, int32_t disp, Reg src)
+		{
+			rex(src, base, false);
+			byte(0x89);
+			mem(src, base, disp);
+		}
+
+		// mov byte [base + disp], imm8
+		void storeByteImm(Reg base, int32_t disp, uint8_t imm)
+		{
+			rexB(base, false);
+			byte(0xC6);
+			mem(RAX, base, disp);
+			byte(imm);
+		}
+
+		// mov dword [base + disp], imm32
+		void store32Imm(Reg base, int32_t disp, uint32_t imm)
+		{
+			rexB(base, false);
+			byte(0xC7);
+			mem(RAX, base, disp);
+			bytes(&imm, sizeof(imm));
+		}
+
+		// movzx dst32, byte [base + disp]
+		void loadByte(Reg dst, Reg base, int32_t disp)
+		{
+			rex(dst, base, false);
+			byte(0x0F);
+			byte(0xB6);
+			mem(dst, base, disp);
+		}
+
+		// cmp a, b
+		void cmp(Reg a, Reg b)
+		{
+			rex(b, a);
+			byte(0x39);
+			modRm(b, a);
+		}
+
+		// cmp a, [base + disp]
+		void cmpMem(Reg a, Reg base, int32_t disp = 0)
+		{
+			rex(a, base);
+			byte(0x3B);
+			mem(a, base, disp);
+		}
+
+		// cmp reg32, imm32
+		void cmpImm32(Reg reg, uint32_t imm)
+		{
+			rexB(reg, false);
+			byte(0x81);
+			byte(static_cast<uint8_t>(0xF8 | (reg & 7)));
+			bytes(&imm, sizeof(imm));
+		}
+
+		// add reg, imm32
+		void addImm(Reg reg, int32_t imm)
+		{
+			rexB(reg, true);
+			byte(0x81);
+			byte(static_cast<uint8_t>(0xC0 | (reg & 7)));
+			bytes(&imm, sizeof(imm));
+		}
+
+		// add dst32, src32
+		void add32(Reg dst, Reg src)
+		{
+			rex(src, dst, false);
+			byte(0x01);
+			modRm(src, dst);
+		}
+
+		// sub dst32, src32
+		void sub32(Reg dst, Reg src)
+		{
+			rex(src, dst, false);
+			byte(0x29);
+			modRm(src, dst);
+		}
+
+		void inc(Reg reg)
+		{
+			rexB(reg, true);
+			byte(0xFF);
+			byte(static_cast<uint8_t>(0xC0 | (reg & 7)));
+		}
+
+		void subRsp(uint8_t imm)
+		{
+			byte(0x48);
+			byte(0x83);
+			byte(0xEC);
+			byte(imm);
+		}
+
+		void addRsp(uint8_t imm)
+		{
+			byte(0x48);
+			byte(0x83);
+			byte(0xC4);
+			byte(imm);
+		}
+
+		void call(Reg reg)
+		{
+			rexB(reg, false);
+			byte(0xFF);
+			byte(static_cast<uint8_t>(0xD0 | (reg & 7)));
+		}
+
+		void ret()
+		{
+			byte(0xC3);
+		}
+
+		void jmp(Label_t label)
+		{
+			byte(0xE9);
+			fixup(label);
+		}
+
+		void jcc(Cond cond, Label_t label)
+		{
+			byte(0x0F);
+			byte(cond);
+			fixup(label);
+		}
+
+	private:
+		void byte(uint8_t b)
+		{
+			m_Code.push_back(b);
+		}
+
+		void bytes(const void *data, size_t size)
+		{
+			const uint8_t *begin = static_cast<const uint8_t *>(data);
+			m_Code.insert(m_Code.end(), begin, begin + size);
+		}
+
+		// REX prefix extending the reg and r/m fields as needed, with W set for
+		// 64 bit operands
+		void rex(Reg reg, Reg rm, bool isWide = true)
+		{
+			if (isWide || reg >= R8 || rm >= R8)
+			{
+				byte(static_cast<uint8_t>(0x40 | (isWide ? 8 : 0) | (reg >= R8 ? 4 : 0) | (rm >= R8 ? 1 : 0)));
+			}
+		}
+
+		// REX prefix for instructions which encode a single register, which is
+		// only needed for 64 bit operands or the extended registers
+		void rexB(Reg reg, bool isWide)
+		{
+			if (isWide || reg >= R8)
+			{
+				byte(static_cast<uint8_t>(0x40 | (isWide ? 8 : 0) | (reg >= R8 ? 1 : 0)));
+			}
+		}
+
+		void modRm(Reg reg, Reg rm)
+		{
+			byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+		}
+
+		// [base + disp32], rsp and r12 as base would need a SIB byte
+		void mem(Reg reg, Reg base, int32_t disp)
+		{
+			byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+			bytes(&disp, sizeof(disp));
+		}
+
+		void fixup(Label_t label)
+		{
+			m_Fixups.emplace_back(m_Code.size(), label);
+			bytes("\0\0\0\0", 4);
+		}
+
+	private:
+		std::vector<uint8_t> m_Code;
+		std::vector<size_t> m_Labels;
+		std::vector<std::pair<size_t, Label_t>> m_Fixups;
+	};
+
+	// Registers holding the state of compiled code, all of them callee saved so
+	// handlers leave them alone
+	constexpr Reg k_MachineReg  = R12;
+	constexpr Reg k_TreeReg     = R13;
+	constexpr Reg k_EnvReg      = R14;
+	constexpr Reg k_StepsReg    = R15;
+	constexpr Reg k_MaxStepsReg = RBX;
+	constexpr Reg k_StepsPtrReg = RBP;
+
+	constexpr Reg k_SavedRegs[] = {RBP, RBX, R12, R13, R14, R15};
+
+	// Cases with more keys than this call their handler, to keep the code of a
+	// node short
+	constexpr size_t k_MaxNativeCases = 16;
+
+	uint64_t getAddress(const void *pointer)
+	{
+		return reinterpret_cast<uint64_t>(pointer);
+	}
+
+	int32_t getStackOffset(Value *ValueStack_t::*pointer)
+	{
+		ValueStack_t stack;
+		return static_cast<int32_t>(reinterpret_cast<const uint8_t *>(&(stack.*pointer)) - reinterpret_cast<const uint8_t *>(&stack));
+	}
+
+	// Binds a primitive popped by compiled code, binding allocates a frame so
+	// it is left to C++
+	void bindPrim(Env_t *env, Prim_t prim)
+	{
+		env->first = env->first.bind(Value::fromPrim(prim));
+	}
+
+	// Emits the native code of the nodes which have it. Each of it checks that it
+	// applies before changing anything, and otherwise jumps to the slow path
+	// which calls the handler of the node instead.
+	class FastPaths
+	{
+	public:
+		FastPaths(Assembler &as, const JitContext &context)
+			: m_As(as)
+			, m_Context(context)
+			, m_ValueSize(static_cast<int32_t>(sizeof(Value)))
+			, m_KindOffset(static_cast<int32_t>(Value::getKindOffset()))
+			, m_WordOffset(static_cast<int32_t>(Value::getWordOffset()))
+			, m_BeginOffset(getStackOffset(&ValueStack_t::Begin))
+			, m_EndOffset(getStackOffset(&ValueStack_t::End))
+			, m_CapOffset(getStackOffset(&ValueStack_t::Cap))
+		{}
+
+		bool hasFastPath(const ExecNode &node) const
+		{
+			switch (node.Kind)
+			{
+			case NodeKind::PushPrim:
+			case NodeKind::PushLoc:
+			case NodeKind::Pop:
+				return isFixedStack(node);
+
+			case NodeKind::Add:
+			case NodeKind::Sub:
+				return true;
+
+			case NodeKind::PrimCases:
+			case NodeKind::LocCases:
+				return node.Branches.size() <= k_MaxNativeCases + 1;
+
+			default:
+				return false;
+			}
+		}
+
+		// Whether matching a branch of the cases has to call the branch handler,
+		// otherwise the matched branch is jumped to directly
+		bool needsEnterBranch(const ExecNode &node) const
+		{
+			return !node.IsTail || m_Context.IsTracing;
+		}
+
+		// Falls through once the node has run, except cases which jump to the
+		// label of the branch they match
+		void emit(const ExecNode &node, Label_t slow, const std::vector<Label_t> &branches)
+		{
+			switch (node.Kind)
+			{
+			case NodeKind::PushPrim:
+				emitPush(node.Loc, Value::Kind::Prim, node.Arg, slow);
+				break;
+
+			case NodeKind::PushLoc:
+				emitPush(node.Loc, Value::Kind::Loc, node.Arg, slow);
+				break;
+
+			case NodeKind::Pop:
+				emitPop(node, slow);
+				break;
+
+			case NodeKind::Add:
+			case NodeKind::Sub:
+				emitArithmetic(node, slow);
+				break;
+
+			case NodeKind::PrimCases:
+			case NodeKind::LocCases:
+				emitCases(node, slow, branches);
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		// Enters the branch the cases matched, with the matched value in r8
+		void emitEnterBranch(const ExecNode &node, uint32_t branch, Label_t target)
+		{
+			m_As.mov(RDI, k_MachineReg);
+			m_As.mov(RSI, k_EnvReg);
+			m_As.movImm(RDX, getAddress(&node));
+			m_As.movImm(RCX, branch);
+			m_As.movImm(RAX, reinterpret_cast<uint64_t>(m_Context.EnterBranch));
+			m_As.call(RAX);
+			m_As.jmp(target);
+		}
+
+	private:
+		bool isFixedStack(const ExecNode &node) const
+		{
+			bool isStack = node.Loc == k_LambdaLoc || node.Loc >= k_NumReservedLocs;
+			return !node.IsLocIndex && isStack
+				&& static_cast<uint64_t>(node.Loc) * sizeof(ValueStack_t) <= static_cast<uint64_t>(std::numeric_limits<int32_t>::max());
+		}
+
+		static uint8_t getKindByte(Value::Kind kind)
+		{
+			return static_cast<uint8_t>(kind);
+		}
+
+		// Loads the address of the stack of a location, memory may have grown
+		// since the code was compiled so the stacks are loaded every time
+		void loadStack(Reg dst, Loc_t loc)
+		{
+			m_As.movImm(dst, getAddress(m_Context.Stacks));
+			m_As.load(dst, dst);
+			if (loc > 0)
+			{
+				m_As.addImm(dst, static_cast<int32_t>(loc * sizeof(ValueStack_t)));
+			}
+		}
+
+		// Makes the slot in rcx the new end of the stack in rax
+		void bumpEnd(int32_t delta)
+		{
+			m_As.addImm(RCX, delta);
+			m_As.store(RAX, m_EndOffset, RCX);
+		}
+
+		// The slot past the end holds no closure, so the value is made by
+		// writing its kind and its word
+		void emitPush(Loc_t loc, Value::Kind kind, uint32_t word, Label_t slow)
+		{
+			loadStack(RAX, loc);
+			m_As.load(RCX, RAX, m_EndOffset);
+			m_As.cmpMem(RCX, RAX, m_CapOffset);
+			m_As.jcc(JAE, slow);
+
+			m_As.storeByteImm(RCX, m_KindOffset, getKindByte(kind));
+			m_As.store32Imm(RCX, m_WordOffset, word);
+			bumpEnd(m_ValueSize);
+		}
+
+		// Loads the stack into rax and its end into rcx, leaving for the slow
+		// path if it is empty or its top is of another kind
+		void loadTop(Loc_t loc, Value::Kind kind, Label_t slow)
+		{
+			loadStack(RAX, loc);
+			m_As.load(RCX, RAX, m_EndOffset);
+			m_As.cmpMem(RCX, RAX, m_BeginOffset);
+			m_As.jcc(JE, slow);
+
+			m_As.loadByte(RDX, RCX, m_KindOffset - m_ValueSize);
+			m_As.cmpImm32(RDX, getKindByte(kind));
+			m_As.jcc(JNE, slow);
+		}
+
+		// Popping a primitive only moves the end of the stack, as the slot
+		// it leaves behind holds no closure
+		void emitPop(const ExecNode &node, Label_t slow)
+		{
+			loadTop(node.Loc, Value::Kind::Prim, slow);
+
+			if (node.IsBinding)
+			{
+				m_As.load32(RSI, RCX, m_WordOffset - m_ValueSize);
+				bumpEnd(-m_ValueSize);
+
+				m_As.mov(RDI, k_EnvReg);
+				m_As.movImm(RAX, reinterpret_cast<uint64_t>(&bindPrim));
+				m_As.call(RAX);
+			}
+			else
+			{
+				bumpEnd(-m_ValueSize);
+			}
+		}
+
+		// The result replaces the second operand in place, wrapping around in
+		// 32 bits as the handler does
+		void emitArithmetic(const ExecNode &node, Label_t slow)
+		{
+			const int32_t first = -m_ValueSize;
+			const int32_t second = -2 * m_ValueSize;
+
+			loadStack(RAX, k_LambdaLoc);
+			m_As.load(RCX, RAX, m_EndOffset);
+			m_As.load(RDX, RAX, m_BeginOffset);
+			m_As.addImm(RDX, 2 * m_ValueSize);
+			m_As.cmp(RCX, RDX);
+			m_As.jcc(JB, slow);
+
+			m_As.loadByte(RDX, RCX, first + m_KindOffset);
+			m_As.cmpImm32(RDX, getKindByte(Value::Kind::Prim));
+			m_As.jcc(JNE, slow);
+			m_As.loadByte(RDX, RCX, second + m_KindOffset);
+			m_As.cmpImm32(RDX, getKindByte(Value::Kind::Prim));
+			m_As.jcc(JNE, slow);
+
+			m_As.load32(R8, RCX, first + m_WordOffset);
+			m_As.load32(R9, RCX, second + m_WordOffset);
+			if (node.Kind == NodeKind::Add)
+			{
+				m_As.add32(R9, R8);
+			}
+			else
+			{
+				m_As.sub32(R9, R8);
+			}
+			m_As.store32(RCX, second + m_WordOffset, R9);
+			bumpEnd(first);
+		}
+
+		// Pops the value into r8 and compares it with each key, the otherwise
+		// branch comes last
+		void emitCases(const ExecNode &node, Label_t slow, const std::vector<Label_t> &branches)
+		{
+			bool isPrim = node.Kind == NodeKind::PrimCases;
+
+			loadTop(k_LambdaLoc, isPrim ? Value::Kind::Prim : Value::Kind::Loc, slow);
+			m_As.load32(R8, RCX, m_WordOffset - m_ValueSize);
+			bumpEnd(-m_ValueSize);
+
+			std::vector<uint32_t> keys;
+			if (isPrim)
+			{
+				for (const auto &[key, branch] : node.Source->asPrimCases())
+				{
+					keys.push_back(static_cast<uint32_t>(key));
+				}
+			}
+			else
+			{
+				for (const auto &[key, branch] : node.Source->asLocCases())
+				{
+					keys.push_back(key);
+				}
+			}
+
+			for (size_t i = 0; i < keys.size(); ++i)
+			{
+				m_As.cmpImm32(R8, keys[i]);
+				m_As.jcc(JE, branches[i]);
+			}
+			m_As.jmp(branches.back());
+		}
+
+	private:
+		Assembler &m_As;
+		const JitContext &m_Context;
+
+		const int32_t m_ValueSize;
+		const int32_t m_KindOffset;
+		const int32_t m_WordOffset;
+		const int32_t m_BeginOffset;
+		const int32_t m_EndOffset;
+		const int32_t m_CapOffset;
+	};
+}
+
+NodeJit::NodeJit(NodeTree &tree, uint64_t threshold, const JitContext &context)
+	: m_Tree(tree)
+	, m_Threshold(threshold)
+	, m_Context(context)
+{}
+
+NodeJit::~NodeJit()
+{
+#if defined(CFMC_JIT)
+	for (auto [mapping, size] : m_Mappings)
+	{
+		munmap(mapping, size);
+	}
+#endif
+}
+
+void NodeJit::noteCall(const ExecNode &func)
+{
+	// Compiling only happens once, even if the function could not be compiled
+	if (++m_Calls[&func] == m_Threshold)
+	{
+		compile(func);
+	}
+}
+
+size_t NodeJit::getNumCompiled() const
+{
+	return m_NumCompiled;
+}
+
+size_t NodeJit::getCodeSize() const
+{
+	return m_CodeSize;
+}
+
+bool NodeJit::isSupported()
+{
+#if defined(CFMC_JIT)
+	return true;
+#else
+	return false;
+#endif
+}
+
+void NodeJit::compile(const ExecNode &func)
+{
+#if defined(CFMC_JIT)
+	Assembler as;
+
+	std::unordered_map<const ExecNode *, Label_t> labels;
+	std::unordered_map<const ExecNode *, Label_t> exits;
+	std::vector<const ExecNode *> nodes;
+
+	auto getLabel = [&](const ExecNode *node) {
+		auto [it, isNew] = labels.emplace(node, 0);
+		if (isNew)
+		{
+			it->second = as.newLabel();
+			nodes.push_back(node);
+		}
+		return it->second;
+	};
+
+	// Exits hand the node back to the interpreter without running it
+	auto getExit = [&](const ExecNode *node) {
+		auto [it, isNew] = exits.emplace(node, 0);
+		if (isNew)
+		{
+			it->second = as.newLabel();
+		}
+		return it->second;
+	};
+
+	Label_t epilogue = as.newLabel();
+
+	// The handler of a node returns the node to run next, which for cases is
+	// the branch they took
+	auto emitHandlerCall = [&](const ExecNode &node) {
+		as.mov(RDI, k_MachineReg);
+		as.mov(RSI, k_TreeReg);
+		as.mov(RDX, k_EnvReg);
+		as.movImm(RCX, reinterpret_cast<uint64_t>(&node));
+		as.movImm(RAX, reinterpret_cast<uint64_t>(node.Handler));
+		as.call(RAX);
+	};
+
+	auto emitBranchChain = [&](const ExecNode &node) {
+		std::unordered_set<const ExecNode *> branches;
+
+		for (const ExecNode *branch : node.Branches)
+		{
+			if (branches.insert(branch).second)
+			{
+				as.movImm(RCX, reinterpret_cast<uint64_t>(branch));
+				as.cmp(RAX, RCX);
+				as.jcc(JE, getLabel(branch));
+			}
+		}
+		as.jmp(epilogue);
+	};
+
+	FastPaths fastPaths(as, m_Context);
+
+	struct SlowPath
+	{
+		const ExecNode *Node;
+		Label_t Slow;
+		Label_t Done;
+	};
+
+	struct EnterBranch
+	{
+		const ExecNode *Node;
+		uint32_t Branch;
+		Label_t Label;
+	};
+
+	std::vector<SlowPath> slowPaths;
+	std::vector<EnterBranch> enterBranches;
+
+	getLabel(&func);
+
+	// The function is every node that can be reached from its body without
+	// calling anything, each node is followed by its body where possible so
+	// that it can fall through to it
+	std::unordered_set<const ExecNode *> emitted;
+
+	for (size_t i = 0; i < nodes.size(); ++i)
+	{
+		for (const ExecNode *node = nodes[i]; node && !emitted.count(node); )
+		{
+			emitted.insert(node);
+			as.bind(getLabel(node));
+
+			// Every node is a step
+			as.cmp(k_StepsReg, k_MaxStepsReg);
+			as.jcc(JAE, getExit(node));
+			as.inc(k_StepsReg);
+
+			bool isCases = node->Kind == NodeKind::PrimCases || node->Kind == NodeKind::LocCases;
+			for (const ExecNode *branch : node->Branches)
+			{
+				getLabel(branch);
+			}
+
+			// Nodes with native code only call their handler on their slow path,
+			// which is emitted after the function
+			bool isNative = fastPaths.hasFastPath(*node);
+
+			if (isNative)
+			{
+				std::vector<Label_t> branches;
+
+				for (uint32_t branch = 0; branch < node->Branches.size(); ++branch)
+				{
+					if (fastPaths.needsEnterBranch(*node))
+					{
+						branches.push_back(as.newLabel());
+						enterBranches.push_back({node, branch, branches.back()});
+					}
+					else
+					{
+						branches.push_back(getLabel(node->Branches[branch]));
+					}
+				}
+
+				Label_t slow = as.newLabel();
+				fastPaths.emit(*node, slow, branches);
+
+				Label_t done = as.newLabel();
+				as.bind(done);
+				slowPaths.push_back({node, slow, done});
+			}
+			else
+			{
+				emitHandlerCall(*node);
+				if (isCases)
+				{
+					emitBranchChain(*node);
+				}
+			}
+
+			const ExecNode *next = nullptr;
+
+			switch (node->Kind)
+			{
+			case NodeKind::Ret:
+			case NodeKind::Fail:
+				as.jmp(epilogue);
+				break;
+
+			case NodeKind::CallVar:
+				as.jmp(epilogue);
+
+				if (!node->IsTail)
+				{
+					getLabel(node->Next);
+				}
+				break;
+
+			case NodeKind::Call:
+				// Calls of the function to itself stay in its code, the handler
+				// has already entered it
+				if (node->Target == &func)
+				{
+					as.jmp(getLabel(&func));
+				}
+				else
+				{
+					as.jmp(epilogue);
+				}
+
+				if (!node->IsTail)
+				{
+					getLabel(node->Next);
+				}
+				break;
+
+			case NodeKind::PrimCases:
+			case NodeKind::LocCases:
+				if (!node->IsTail)
+				{
+					getLabel(node->Next);
+				}
+				break;
+
+			case NodeKind::Pop:
+			case NodeKind::PopLoc:
+				// Popping from 'new' may make a collection due, which has to
+				// happen in the interpreter before the next step
+				if (m_Context.AllocsSinceGc && !isNative)
+				{
+					as.movImm(RCX, reinterpret_cast<uint64_t>(m_Context.AllocsSinceGc));
+					as.load(RCX, RCX);
+					as.movImm(RDX, reinterpret_cast<uint64_t>(m_Context.NextGc));
+					as.cmpMem(RCX, RDX);
+					as.jcc(JAE, getExit(node->Next));
+				}
+				next = node->Next;
+				break;
+
+			default:
+				next = node->Next;
+				break;
+			}
+
+			if (next)
+			{
+				getLabel(next);
+
+				if (emitted.count(next))
+				{
+					as.jmp(getLabel(next));
+				}
+			}
+
+			node = next;
+		}
+	}
+
+	// Slow paths return to the code following their fast path, except those of
+	// cases which take the branch their handler returns
+	for (const SlowPath &path : slowPaths)
+	{
+		as.bind(path.Slow);
+		emitHandlerCall(*path.Node);
+
+		if (path.Node->Kind == NodeKind::PrimCases || path.Node->Kind == NodeKind::LocCases)
+		{
+			emitBranchChain(*path.Node);
+		}
+		else
+		{
+			as.jmp(path.Done);
+		}
+	}
+
+	for (const EnterBranch &enter : enterBranches)
+	{
+		as.bind(enter.Label);
+		fastPaths.emitEnterBranch(*enter.Node, enter.Branch, getLabel(enter.Node->Branches[enter.Branch]));
+	}
+
+	for (auto [node, label] : exits)
+	{
+		as.bind(label);
+		as.movImm(RAX, reinterpret_cast<uint64_t>(node));
+		as.jmp(epilogue);
+	}
+
+	as.bind(epilogue);
+	as.mov(RCX, k_StepsPtrReg);
+	as.store(RCX, 0, k_StepsReg);
+	as.addRsp(8);
+	for (auto it = std::rbegin(k_SavedRegs); it != std::rend(k_SavedRegs); ++it)
+	{
+		as.pop(*it);
+	}
+	as.ret();
+
+	// The interpreter can enter at any node, e.g. when returning to a
+	// continuation or after a collection
+	std::vector<std::pair<const ExecNode *, size_t>> entries;
+
+	for (const ExecNode *node : nodes)
+	{
+		entries.emplace_back(node, as.getOffset());
+
+		// Six pushes and the padding keep the stack aligned for calls
+		for (Reg reg : k_SavedRegs)
+		{
+			as.push(reg);
+		}
+		as.subRsp(8);
+
+		as.mov(k_MachineReg, RDI);
+		as.mov(k_TreeReg, RSI);
+		as.mov(k_EnvReg, RDX);
+		as.mov(k_StepsPtrReg, RCX);
+		as.load(k_StepsReg, RCX);
+		as.mov(k_MaxStepsReg, R8);
+		as.jmp(labels.at(node));
+	}
+
+	as.patchJumps();
+
+	const std::vector<uint8_t> &code = as.getCode();
+	size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t size = (code.size() + pageSize - 1) / pageSize * pageSize;
+
+	void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapping == MAP_FAILED)
+	{
+		return;
+	}
+
+	std::memcpy(mapping, code.data(), code.size());
+
+	if (mprotect(mapping, size, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(mapping, size);
+		return;
+	}
+
+	m_Mappings.emplace_back(mapping, size);
+
+	for (auto [node, offset] : entries)
+	{
+		m_Tree.setJitEntry(node, reinterpret_cast<JitEntry_t>(static_cast<uint8_t *>(mapping) + offset));
+	}
+
+	m_NumCompiled++;
+	m_CodeSize += code.size();
+#else
+	(void)func;
+#endif
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "NodeTree.hpp"
+
+// The parts of the machine that compiled code works on directly
+struct JitContext
+{
+	// The stacks of memory, read every time as memory moves when it grows
+	ValueStack_t *const *Stacks = nullptr;
+
+	// The collection counters are checked after any node that may create a
+	// location, they are null when collection is disabled
+	const uint64_t *AllocsSinceGc = nullptr;
+	const uint64_t *NextGc = nullptr;
+
+	BranchHandler_t EnterBranch = nullptr;
+	// Branches in tail position leave nothing to enter unless calls are traced
+	bool IsTracing = false;
+};
+
+// Compiles the nodes of functions that are called often to x86-64 machine code.
+// Pushes of primitives and locations, pops of primitives, additions, subtractions
+// and cases are compiled to native code working on the location stacks through
+// their pointers (see ValueStack_t), which calls their handler only when it does
+// not apply (e.g. a stack that needs to grow, a closure or an error). Other
+// nodes count their step and call their handler with the node baked in. The
+// control flow between the nodes of a function (following bodies, picking the
+// branch of cases and calls of the function to itself) is native. Calls to
+// anything else, returns, reaching the step limit and collections go back to
+// the interpreter, which enters the compiled code of the next node again if it
+// has any. Only x86-64 Linux is supported, elsewhere functions are never
+// compiled and keep being interpreted.
+class NodeJit
+{
+public:
+	NodeJit(NodeTree &tree, uint64_t threshold, const JitContext &context);
+	~NodeJit();
+
+	NodeJit(const NodeJit &) = delete;
+	NodeJit &operator=(const NodeJit &) = delete;
+
+	// Counts a call of the function whose body starts at the node, compiling it
+	// once it has been called 'threshold' times
+	void noteCall(const ExecNode &func);
+
+	size_t getNumCompiled() const;
+	size_t getCodeSize() const;
+
+	static bool isSupported();
+
+private:
+	void compile(const ExecNode &func);
+
+private:
+	NodeTree &m_Tree;
+	uint64_t m_Threshold;
+
+	JitContext m_Context;
+
+	std::unordered_map<const ExecNode *, uint64_t> m_Calls;
+
+	// Each function gets its own mapping, so that code which is running is never
+	// made writable while another function is compiled
+	std::vector<std::pair<void *, size_t>> m_Mappings;
+
+	size_t m_NumCompiled = 0;
+	size_t m_CodeSize = 0;
+};
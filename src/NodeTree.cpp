@@ -0,0 +1,219 @@
+#include "NodeTree.hpp"
+
+#include <iterator>
+
+NodeTree::NodeTree(const Program &program, const NodeHandlers_t &handlers)
+	: m_Program(program)
+	, m_Handlers(handlers)
+{
+	if (auto termOpt = program.load("main"))
+	{
+		m_Entry = request(termOpt.value());
+		convertPending();
+	}
+}
+
+const Program &NodeTree::getProgram() const
+{
+	return m_Program;
+}
+
+const ExecNode *NodeTree::getEntry() const
+{
+	return m_Entry;
+}
+
+const ExecNode *NodeTree::find(const TermHandle_t &term)
+{
+	auto it = m_TermNodes.find(term.get());
+	if (it != m_TermNodes.end())
+	{
+		return it->second;
+	}
+
+	ExecNode *node = request(term);
+	convertPending();
+
+	return node;
+}
+
+size_t NodeTree::getNumNodes() const
+{
+	return m_Nodes.size();
+}
+
+void NodeTree::setJitEntry(const ExecNode *node, JitEntry_t entry)
+{
+	m_TermNodes.at(node->Source.get())->JitEntry = entry;
+}
+
+ExecNode *NodeTree::request(const TermHandle_t &term)
+{
+	auto it = m_TermNodes.find(term.get());
+	if (it != m_TermNodes.end())
+	{
+		return it->second;
+	}
+
+	// The node is filled in later, so that converting a term never recurses
+	// into the terms it refers to
+	ExecNode &node = m_Nodes.emplace_back();
+	m_TermNodes.emplace(term.get(), &node);
+	m_Pending.push_back(term);
+
+	return &node;
+}
+
+void NodeTree::convertPending()
+{
+	while (!m_Pending.empty())
+	{
+		TermHandle_t term = std::move(m_Pending.back());
+		m_Pending.pop_back();
+
+		convert(*m_TermNodes.at(term.get()), term);
+	}
+}
+
+void NodeTree::convert(ExecNode &node, const TermHandle_t &term)
+{
+	node.Source = term;
+
+	auto setLoc = [&](std::optional<Index_t> locIndex, Loc_t loc) {
+		node.IsLocIndex = locIndex.has_value();
+		node.Loc = locIndex ? locIndex.value() : loc;
+	};
+
+	if (term->isNil())
+	{
+		node.Kind = NodeKind::Ret;
+	}
+	else if (term->isVal())
+	{
+		node.Kind = NodeKind::Fail;
+	}
+	else if (term->isVar())
+	{
+		const VarTerm &var = term->asVar();
+
+		// Variables that are not bound to anything were reported by the resolver
+		if (auto indexOpt = var.getIndex())
+		{
+			node.Kind = NodeKind::CallVar;
+			node.Arg = indexOpt.value();
+		}
+		else
+		{
+			node.Kind = NodeKind::Call;
+
+			if (auto funcIndexOpt = var.getFuncIndex())
+			{
+				node.Arg = funcIndexOpt.value();
+				node.Target = request(m_Program.getFunc(funcIndexOpt.value()));
+			}
+		}
+
+		node.IsTail = var.getBody()->isNil();
+
+		if (!node.IsTail)
+		{
+			node.Next = request(var.getBody());
+		}
+	}
+	else if (term->isApp())
+	{
+		const AppTerm &app = term->asApp();
+		TermHandle_t arg = app.getArg();
+
+		setLoc(app.getLocIndex(), app.getLoc());
+
+		if (arg->isVal() && arg->asVal().isPrim())
+		{
+			node.Kind = NodeKind::PushPrim;
+			node.Arg = static_cast<uint32_t>(arg->asVal().asPrim());
+		}
+		else if (arg->isVal())
+		{
+			node.Kind = NodeKind::PushLoc;
+			node.Arg = arg->asVal().asLoc();
+		}
+		else if (arg->isVar() && arg->asVar().getIndex())
+		{
+			// The argument is resolved on its own, so the variable is its only capture
+			node.Kind = NodeKind::PushVar;
+			node.Arg = app.getCaptures()[arg->asVar().getIndex().value()];
+		}
+		else
+		{
+			node.Kind = NodeKind::PushClosure;
+		}
+
+		node.Next = request(app.getBody());
+	}
+	else if (term->isAbs())
+	{
+		const AbsTerm &abs = term->asAbs();
+
+		node.Kind = NodeKind::Pop;
+		node.IsBinding = abs.isBinding();
+		setLoc(abs.getLocIndex(), abs.getLoc());
+		node.Next = request(abs.getBody());
+	}
+	else if (term->isLocApp())
+	{
+		const LocAppTerm &locApp = term->asLocApp();
+
+		node.Kind = NodeKind::PushLocArg;
+		setLoc(locApp.getLocIndex(), locApp.getLoc());
+		node.IsArgIndex = locApp.getArgIndex().has_value();
+		node.Arg = locApp.getArgIndex() ? locApp.getArgIndex().value() : locApp.getArg();
+		node.Next = request(locApp.getBody());
+	}
+	else if (term->isLocAbs())
+	{
+		const LocAbsTerm &locAbs = term->asLocAbs();
+
+		node.Kind = NodeKind::PopLoc;
+		node.IsBinding = locAbs.getLocVar().has_value();
+		setLoc(locAbs.getLocIndex(), locAbs.getLoc());
+		node.Next = request(locAbs.getBody());
+	}
+	else if (term->isBinOp())
+	{
+		const BinOpTerm &binOp = term->asBinOp();
+
+		node.Kind = binOp.isOp(BinOpTerm::Plus) ? NodeKind::Add : NodeKind::Sub;
+		node.Next = request(binOp.getBody());
+	}
+	else if (term->isPrimCases() || term->isLocCases())
+	{
+		auto convertCases = [&](const auto &cases) {
+			uint32_t numBranches = static_cast<uint32_t>(std::distance(cases.begin(), cases.end())) + 1;
+
+			for (uint32_t branch = 0; branch < numBranches; ++branch)
+			{
+				node.Branches.push_back(request(cases.getBranch(branch)));
+			}
+
+			node.IsTail = cases.getBody()->isNil();
+
+			if (!node.IsTail)
+			{
+				node.Next = request(cases.getBody());
+			}
+		};
+
+		if (term->isPrimCases())
+		{
+			node.Kind = NodeKind::PrimCases;
+			convertCases(term->asPrimCases());
+		}
+		else
+		{
+			node.Kind = NodeKind::LocCases;
+			convertCases(term->asLocCases());
+		}
+	}
+
+	node.Handler = m_Handlers[static_cast<size_t>(node.Kind)];
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <unordered_map>
+#include <deque>
+#include <vector>
+#include <array>
+#include <cstdint>
+
+#include "Config.hpp"
+#include "Term.hpp"
+#include "Program.hpp"
+#include "Machine.hpp"
+
+class NodeTree;
+
+// Runs a node in the current environment and returns the node to run next,
+// or null once the current closure has nothing left to run
+using NodeHandler_t = const ExecNode *(*)(Machine &machine, NodeTree &tree, Env_t &env, const ExecNode &node);
+
+// Enters branch 'branch' of cases once the value it matched ('value', unused for
+// the otherwise branch) has been popped, and returns the node of the branch
+using BranchHandler_t = const ExecNode *(*)(Machine &machine, Env_t &env, const ExecNode &node, uint32_t branch, uint32_t value);
+
+// Runs compiled code from a node on, counting the steps it takes without going
+// past the limit, and returns the node the interpreter should continue with
+using JitEntry_t = const ExecNode *(*)(Machine *machine, NodeTree *tree, Env_t *env, uint64_t *steps, uint64_t maxSteps);
+
+enum class NodeKind : uint8_t
+{
+	Ret,         // Nil, return to the most recent continuation
+	Fail,        // Values cannot be executed
+	Call,        // Call program function 'Target'
+	CallVar,     // Call the closure bound at variable index 'Arg'
+
+	PushPrim,    // Push primitive 'Arg' to 'Loc'
+	PushLoc,     // Push location 'Arg' to 'Loc'
+	PushVar,     // Push the argument bound at variable index 'Arg' to 'Loc'
+	PushClosure, // Push a closure of the argument to 'Loc'
+	PushLocArg,  // Push location 'Arg' (or the one bound at index 'Arg') to 'Loc'
+
+	Pop,         // Pop from 'Loc', binding it unless this is a wildcard
+	PopLoc,      // Pop a location from 'Loc', binding it unless this is a wildcard
+
+	Add,
+	Sub,
+
+	PrimCases,
+	LocCases
+};
+
+constexpr size_t k_NumNodeKinds = static_cast<size_t>(NodeKind::LocCases) + 1;
+
+using NodeHandlers_t = std::array<NodeHandler_t, k_NumNodeKinds>;
+
+// A term converted to run directly, with its handler and its operands decoded
+// ahead of time so that running it never inspects the term again. Nodes keep
+// the shape of the term they came from, each one links to the node of its body.
+struct ExecNode
+{
+	NodeHandler_t Handler = nullptr;
+	NodeKind Kind = NodeKind::Ret;
+
+	// The location operand is a location variable index rather than a location
+	bool IsLocIndex = false;
+	// The argument of a location application is a location variable index
+	bool IsArgIndex = false;
+	// Abstractions bind what they pop, rather than discarding it
+	bool IsBinding = false;
+	// Calls and cases in tail position have no continuation to return to
+	bool IsTail = false;
+
+	uint32_t Loc = 0;
+	uint32_t Arg = 0;
+
+	const ExecNode *Next = nullptr;
+	// The body of the function a call enters
+	const ExecNode *Target = nullptr;
+	// The branches of cases, in the order the term keeps them
+	std::vector<const ExecNode *> Branches;
+
+	// The term this node was converted from, used for output, errors and closures
+	TermHandle_t Source;
+
+	// Native code to run from this node on, once the function it belongs to has
+	// been compiled (see NodeJit)
+	JitEntry_t JitEntry = nullptr;
+};
+
+// The terms of a program converted to nodes. A term is converted the first time
+// a node refers to it, or when a closure of a term that was not part of the
+// program (e.g. one that was read as input) is called.
+class NodeTree
+{
+public:
+	NodeTree(const Program &program, const NodeHandlers_t &handlers);
+
+	const Program &getProgram() const;
+
+	// The node of the main function, if there is one
+	const ExecNode *getEntry() const;
+
+	// Finds the node of a term, converting it if it has not been yet
+	const ExecNode *find(const TermHandle_t &term);
+
+	size_t getNumNodes() const;
+
+	void setJitEntry(const ExecNode *node, JitEntry_t entry);
+
+private:
+	ExecNode *request(const TermHandle_t &term);
+	void convertPending();
+	void convert(ExecNode &node, const TermHandle_t &term);
+
+private:
+	const Program &m_Program;
+	NodeHandlers_t m_Handlers;
+
+	// Nodes never move once they are made, so they can point to each other
+	std::deque<ExecNode> m_Nodes;
+	std::unordered_map<const Term *, ExecNode *> m_TermNodes;
+	std::vector<TermHandle_t> m_Pending;
+
+	const ExecNode *m_Entry = nullptr;
+};
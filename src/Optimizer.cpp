@@ -0,0 +1,894 @@
+#include "Optimizer.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <string>
+
+#include "Program.hpp"
+#include "Utils.hpp"
+
+namespace
+{
+	using MapTerm_t = std::function<Term(const Term &)>;
+
+	// The rest of the sequence after a term, null for terms that end one
+	TermHandle_t getNext(const Term &term)
+	{
+		if (term.isVar()) return term.asVar().getBody();
+		if (term.isAbs()) return term.asAbs().getBody();
+		if (term.isApp()) return term.asApp().getBody();
+		if (term.isLocAbs()) return term.asLocAbs().getBody();
+		if (term.isLocApp()) return term.asLocApp().getBody();
+		if (term.isBinOp()) return term.asBinOp().getBody();
+		if (term.isPrimCases()) return term.asPrimCases().getBody();
+		if (term.isLocCases()) return term.asLocCases().getBody();
+		return nullptr;
+	}
+
+	// Visits the terms nested inside of a term, i.e. arguments and branches
+	void forEachNested(const Term &term, const std::function<void(const Term &)> &visit)
+	{
+		auto visitCases = [&](const auto &cases) {
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				visit(*itCases->second);
+			}
+			visit(*cases.getOtherwise());
+		};
+
+		if (term.isApp())
+		{
+			visit(*term.asApp().getArg());
+		}
+		else if (term.isPrimCases())
+		{
+			visitCases(term.asPrimCases());
+		}
+		else if (term.isLocCases())
+		{
+			visitCases(term.asLocCases());
+		}
+	}
+
+	template<typename Case_t>
+	Term rebuildCases(const CasesTerm<Case_t> &cases, const MapTerm_t &mapNested, Term &&next)
+	{
+		typename CasesTerm<Case_t>::Cases_t branches;
+		for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+		{
+			branches[itCases->first] = newTerm(mapNested(*itCases->second));
+		}
+
+		return Term(CasesTerm<Case_t>(std::move(branches), newTerm(mapNested(*cases.getOtherwise())), std::move(next)));
+	}
+
+	// Copies a single term of a sequence with a new rest of the sequence, the
+	// terms nested inside of it (arguments and branches) are mapped separately
+	Term rebuildTerm(const Term &term, const MapTerm_t &mapNested, Term &&next)
+	{
+		if (term.isVar())
+		{
+			return Term(VarTerm(term.asVar().getVar(), std::move(next)));
+		}
+		else if (term.isAbs())
+		{
+			const AbsTerm &abs = term.asAbs();
+			return Term(AbsTerm(abs.getLoc(), abs.getVar(), std::move(next)));
+		}
+		else if (term.isApp())
+		{
+			const AppTerm &app = term.asApp();
+			return Term(AppTerm(app.getLoc(), mapNested(*app.getArg()), std::move(next)));
+		}
+		else if (term.isLocAbs())
+		{
+			const LocAbsTerm &locAbs = term.asLocAbs();
+			return Term(LocAbsTerm(locAbs.getLoc(), locAbs.getLocVar(), std::move(next)));
+		}
+		else if (term.isLocApp())
+		{
+			const LocAppTerm &locApp = term.asLocApp();
+			return Term(LocAppTerm(locApp.getLoc(), locApp.getArg(), std::move(next)));
+		}
+		else if (term.isBinOp())
+		{
+			const BinOpTerm &binOp = term.asBinOp();
+			return Term(BinOpTerm(binOp.isOp(BinOpTerm::Plus) ? BinOpTerm::Plus : BinOpTerm::Minus, std::move(next)));
+		}
+		else if (term.isPrimCases())
+		{
+			return rebuildCases(term.asPrimCases(), mapNested, std::move(next));
+		}
+		else if (term.isLocCases())
+		{
+			return rebuildCases(term.asLocCases(), mapNested, std::move(next));
+		}
+		else if (term.isVal())
+		{
+			const ValTerm &val = term.asVal();
+			return val.isPrim() ? Term(ValTerm(val.asPrim())) : Term(ValTerm(val.asLoc()));
+		}
+
+		return Term();
+	}
+
+	Term cloneTerm(const Term &term)
+	{
+		TermHandle_t next = getNext(term);
+		return rebuildTerm(term, cloneTerm, next ? cloneTerm(*next) : Term());
+	}
+
+	// Copies a sequence with another sequence in place of the nil it ends with
+	std::optional<Term> appendTerm(const Term &term, const Term &rest)
+	{
+		if (term.isNil())
+		{
+			return cloneTerm(rest);
+		}
+
+		TermHandle_t next = getNext(term);
+		if (!next)
+		{
+			return std::nullopt;
+		}
+
+		if (auto nextOpt = appendTerm(*next, rest))
+		{
+			return rebuildTerm(term, cloneTerm, std::move(nextOpt.value()));
+		}
+		return std::nullopt;
+	}
+
+	bool isPushOf(const Term &arg, const Var_t &var)
+	{
+		return arg.isVar() && arg.asVar().getVar() == var && arg.asVar().getBody()->isNil();
+	}
+
+	// Whether a variable is only ever pushed (as in '[x]') while it is in scope,
+	// so its uses can be replaced by the value it is bound to
+	bool isOnlyPushed(const Term &term, const Var_t &var)
+	{
+		if (term.isVar() && term.asVar().getVar() == var)
+		{
+			return false;
+		}
+		if (term.isAbs() && term.asAbs().getVar() == var)
+		{
+			return true;
+		}
+
+		bool isPushed = true;
+		forEachNested(term, [&](const Term &nested) {
+			isPushed = isPushed && (isPushOf(nested, var) || isOnlyPushed(nested, var));
+		});
+
+		TermHandle_t next = getNext(term);
+		return isPushed && (!next || isOnlyPushed(*next, var));
+	}
+
+	Term substituteVar(const Term &term, const Var_t &var, Prim_t prim)
+	{
+		if (term.isAbs() && term.asAbs().getVar() == var)
+		{
+			return cloneTerm(term);
+		}
+
+		auto mapNested = [&](const Term &nested) {
+			return isPushOf(nested, var) ? Term(ValTerm(prim)) : substituteVar(nested, var, prim);
+		};
+
+		TermHandle_t next = getNext(term);
+		return rebuildTerm(term, mapNested, next ? substituteVar(*next, var, prim) : Term());
+	}
+
+	Term substituteLoc(const Term &term, LocVar_t locVar, Loc_t loc)
+	{
+		auto replace = [&](Loc_t l) {
+			return l == locVar ? loc : l;
+		};
+
+		auto mapNested = [&](const Term &nested) {
+			return substituteLoc(nested, locVar, loc);
+		};
+
+		TermHandle_t next = getNext(term);
+
+		if (term.isAbs())
+		{
+			const AbsTerm &abs = term.asAbs();
+			return Term(AbsTerm(replace(abs.getLoc()), abs.getVar(), substituteLoc(*next, locVar, loc)));
+		}
+		else if (term.isApp())
+		{
+			const AppTerm &app = term.asApp();
+			return Term(AppTerm(replace(app.getLoc()), mapNested(*app.getArg()), substituteLoc(*next, locVar, loc)));
+		}
+		else if (term.isLocAbs())
+		{
+			const LocAbsTerm &locAbs = term.asLocAbs();
+
+			// Rebinding the variable shadows it for the rest of the sequence
+			Term rest = locAbs.getLocVar() == locVar ? cloneTerm(*next) : substituteLoc(*next, locVar, loc);
+			return Term(LocAbsTerm(replace(locAbs.getLoc()), locAbs.getLocVar(), std::move(rest)));
+		}
+		else if (term.isLocApp())
+		{
+			const LocAppTerm &locApp = term.asLocApp();
+			return Term(LocAppTerm(replace(locApp.getLoc()), replace(locApp.getArg()), substituteLoc(*next, locVar, loc)));
+		}
+
+		return rebuildTerm(term, mapNested, next ? substituteLoc(*next, locVar, loc) : Term());
+	}
+
+	void collectNames(const Term &term, std::set<Var_t> &vars, std::set<Loc_t> &locs)
+	{
+		if (term.isVar())
+		{
+			vars.insert(term.asVar().getVar());
+		}
+		else if (term.isAbs())
+		{
+			locs.insert(term.asAbs().getLoc());
+		}
+		else if (term.isApp())
+		{
+			locs.insert(term.asApp().getLoc());
+		}
+		else if (term.isLocAbs())
+		{
+			locs.insert(term.asLocAbs().getLoc());
+		}
+		else if (term.isLocApp())
+		{
+			locs.insert(term.asLocApp().getLoc());
+			locs.insert(term.asLocApp().getArg());
+		}
+
+		forEachNested(term, [&](const Term &nested) {
+			collectNames(nested, vars, locs);
+		});
+
+		if (TermHandle_t next = getNext(term))
+		{
+			collectNames(*next, vars, locs);
+		}
+	}
+
+	// Whether a location variable is bound anywhere in a term
+	bool bindsLoc(const Term &term, LocVar_t locVar)
+	{
+		if (term.isLocAbs() && term.asLocAbs().getLocVar() == locVar)
+		{
+			return true;
+		}
+
+		bool isBound = false;
+		forEachNested(term, [&](const Term &nested) {
+			isBound = isBound || bindsLoc(nested, locVar);
+		});
+
+		TermHandle_t next = getNext(term);
+		return isBound || (next && bindsLoc(*next, locVar));
+	}
+
+	// Names can't contain quotes, so a renamed binder is renamed again from the
+	// name it had in the source (x'3 becomes x'5 rather than x'3'5)
+	std::string renameBinder(const std::string &name, uint32_t numRenames)
+	{
+		return name.substr(0, name.find('\'')) + "'" + std::to_string(numRenames);
+	}
+}
+
+Optimizer::Optimizer(const OptimizerOptions &options)
+	: m_Options(options)
+{}
+
+void Optimizer::optimize(const Program &program, std::vector<TermOwner_t> &funcs)
+{
+	if (m_Options.InlineThreshold > 0)
+	{
+		inlineFunctions(program, funcs);
+	}
+
+	if (m_Options.MaxSpecializations > 0)
+	{
+		specializeFunctions(program, funcs);
+	}
+
+	if (m_Options.Fold)
+	{
+		for (size_t index = 0; index < funcs.size(); ++index)
+		{
+			funcs[index] = newTerm(foldTerm(*funcs[index]));
+		}
+	}
+}
+
+const OptimizerStats &Optimizer::getStats() const
+{
+	return m_Stats;
+}
+
+const std::vector<std::string> &Optimizer::getNewFuncNames() const
+{
+	return m_NewFuncNames;
+}
+
+void Optimizer::inlineFunctions(const Program &program, std::vector<TermOwner_t> &funcs)
+{
+	m_FuncInfos.clear();
+
+	for (FuncIndex_t index = 0; index < program.getNumFuncs(); ++index)
+	{
+		m_FuncInfos.push_back(getFuncInfo(*funcs[index]));
+	}
+
+	// A function is recursive when it can reach itself through the functions it calls
+	for (FuncIndex_t index = 0; index < program.getNumFuncs(); ++index)
+	{
+		std::vector<bool> isReached(program.getNumFuncs(), false);
+		std::vector<FuncIndex_t> pending = {index};
+
+		while (!pending.empty() && !m_FuncInfos[index].IsRecursive)
+		{
+			FuncIndex_t caller = pending.back();
+			pending.pop_back();
+
+			for (const Var_t &var : m_FuncInfos[caller].FreeVars)
+			{
+				FuncIndex_t callee = program.findFunc(var).value();
+
+				if (callee == index)
+				{
+					m_FuncInfos[index].IsRecursive = true;
+				}
+				else if (!isReached[callee])
+				{
+					isReached[callee] = true;
+					pending.push_back(callee);
+				}
+			}
+		}
+	}
+
+	for (FuncIndex_t index = 0; index < program.getNumFuncs(); ++index)
+	{
+		inlineFunction(program, funcs, index);
+	}
+}
+
+void Optimizer::inlineFunction(const Program &program, std::vector<TermOwner_t> &funcs, FuncIndex_t index)
+{
+	if (m_FuncInfos[index].IsInlined)
+	{
+		return;
+	}
+	m_FuncInfos[index].IsInlined = true;
+
+	// Callees are inlined into first, so their bodies are final by the time
+	// they are inlined here. Only recursive functions can lead back to a caller.
+	for (const Var_t &var : m_FuncInfos[index].FreeVars)
+	{
+		FuncIndex_t callee = program.findFunc(var).value();
+
+		if (!m_FuncInfos[callee].IsRecursive)
+		{
+			inlineFunction(program, funcs, callee);
+		}
+	}
+
+	funcs[index] = newTerm(inlineTerm(program, funcs, *funcs[index]));
+
+	FuncInfo info = getFuncInfo(*funcs[index]);
+	info.IsRecursive = m_FuncInfos[index].IsRecursive;
+	info.IsInlined = true;
+	m_FuncInfos[index] = std::move(info);
+}
+
+Term Optimizer::inlineTerm(const Program &program, std::vector<TermOwner_t> &funcs, const Term &term)
+{
+	TermHandle_t next = getNext(term);
+
+	if (term.isVar() && std::find(m_Vars.begin(), m_Vars.end(), term.asVar().getVar()) == m_Vars.end())
+	{
+		FuncIndex_t callee = program.findFunc(term.asVar().getVar()).value();
+		const FuncInfo &info = m_FuncInfos[callee];
+
+		bool canInline = !info.IsRecursive && info.EndsWithNil && info.Size <= m_Options.InlineThreshold;
+
+		// Names the body uses freely must mean the same thing at the call site
+		for (const Var_t &var : info.FreeVars)
+		{
+			canInline = canInline && std::find(m_Vars.begin(), m_Vars.end(), var) == m_Vars.end();
+		}
+		for (Loc_t loc : info.FreeLocs)
+		{
+			canInline = canInline && std::find(m_LocVars.begin(), m_LocVars.end(), loc) == m_LocVars.end();
+		}
+
+		if (canInline)
+		{
+			Term rest = inlineTerm(program, funcs, *next);
+
+			// The call and the end of the body, a tail call still ends with nil
+			m_Stats.Inlines++;
+			m_Stats.StepsEliminated += rest.isNil() ? 1 : 2;
+
+			return renameTerm(*funcs[callee], {}, {}, &rest);
+		}
+	}
+
+	size_t numVars = m_Vars.size();
+	size_t numLocVars = m_LocVars.size();
+
+	if (term.isAbs() && term.asAbs().getVar())
+	{
+		m_Vars.push_back(term.asAbs().getVar().value());
+	}
+	if (term.isLocAbs() && term.asLocAbs().getLocVar())
+	{
+		m_LocVars.push_back(term.asLocAbs().getLocVar().value());
+	}
+
+	Term rest = next ? inlineTerm(program, funcs, *next) : Term();
+
+	m_Vars.resize(numVars);
+	m_LocVars.resize(numLocVars);
+
+	return rebuildTerm(term, [&](const Term &nested) { return inlineTerm(program, funcs, nested); }, std::move(rest));
+}
+
+Term Optimizer::renameTerm(const Term &term, std::vector<std::pair<Var_t, Var_t>> vars, std::vector<std::pair<Loc_t, Loc_t>> locs, const Term *rest)
+{
+	auto renameVar = [&](const Var_t &var) {
+		auto it = std::find_if(vars.rbegin(), vars.rend(), [&](const auto &rename) { return rename.first == var; });
+		return it != vars.rend() ? it->second : var;
+	};
+	auto renameLoc = [&](Loc_t loc) {
+		auto it = std::find_if(locs.rbegin(), locs.rend(), [&](const auto &rename) { return rename.first == loc; });
+		return it != locs.rend() ? it->second : loc;
+	};
+
+	if (term.isNil())
+	{
+		return rest ? cloneTerm(*rest) : Term();
+	}
+
+	TermHandle_t next = getNext(term);
+
+	if (term.isVar())
+	{
+		return Term(VarTerm(renameVar(term.asVar().getVar()), renameTerm(*next, vars, locs, rest)));
+	}
+	else if (term.isAbs())
+	{
+		const AbsTerm &abs = term.asAbs();
+		Loc_t loc = renameLoc(abs.getLoc());
+		std::optional<Var_t> var;
+
+		if (abs.getVar())
+		{
+			var = renameBinder(abs.getVar().value(), ++m_NumRenames);
+			vars.emplace_back(abs.getVar().value(), var.value());
+		}
+
+		return Term(AbsTerm(loc, var, renameTerm(*next, vars, locs, rest)));
+	}
+	else if (term.isApp())
+	{
+		const AppTerm &app = term.asApp();
+		Term arg = renameTerm(*app.getArg(), vars, locs, nullptr);
+		return Term(AppTerm(renameLoc(app.getLoc()), std::move(arg), renameTerm(*next, vars, locs, rest)));
+	}
+	else if (term.isLocAbs())
+	{
+		const LocAbsTerm &locAbs = term.asLocAbs();
+		Loc_t loc = renameLoc(locAbs.getLoc());
+		std::optional<LocVar_t> locVar;
+
+		if (locAbs.getLocVar())
+		{
+			locVar = internLoc(renameBinder(getLocName(locAbs.getLocVar().value()), ++m_NumRenames));
+			locs.emplace_back(locAbs.getLocVar().value(), locVar.value());
+		}
+
+		return Term(LocAbsTerm(loc, locVar, renameTerm(*next, vars, locs, rest)));
+	}
+	else if (term.isLocApp())
+	{
+		const LocAppTerm &locApp = term.asLocApp();
+		return Term(LocAppTerm(renameLoc(locApp.getLoc()), renameLoc(locApp.getArg()), renameTerm(*next, vars, locs, rest)));
+	}
+
+	// Cases match on literal locations, so only their branches are renamed
+	auto renameNested = [&](const Term &nested) {
+		return renameTerm(nested, vars, locs, nullptr);
+	};
+	return rebuildTerm(term, renameNested, next ? renameTerm(*next, vars, locs, rest) : Term());
+}
+
+Optimizer::FuncInfo Optimizer::getFuncInfo(const Term &term) const
+{
+	FuncInfo info;
+
+	std::vector<Var_t> vars;
+	std::vector<LocVar_t> locVars;
+
+	auto useLoc = [&](Loc_t loc) {
+		if (std::find(locVars.begin(), locVars.end(), loc) == locVars.end())
+		{
+			info.FreeLocs.insert(loc);
+		}
+	};
+
+	std::function<void(const Term &)> visit = [&](const Term &t) {
+		size_t numVars = vars.size();
+		size_t numLocVars = locVars.size();
+
+		for (const Term *curr = &t; curr; curr = getNext(*curr).get())
+		{
+			if (!curr->isNil())
+			{
+				info.Size++;
+			}
+
+			if (curr->isVar() && std::find(vars.begin(), vars.end(), curr->asVar().getVar()) == vars.end())
+			{
+				info.FreeVars.insert(curr->asVar().getVar());
+			}
+			else if (curr->isAbs())
+			{
+				useLoc(curr->asAbs().getLoc());
+				if (curr->asAbs().getVar())
+				{
+					vars.push_back(curr->asAbs().getVar().value());
+				}
+			}
+			else if (curr->isApp())
+			{
+				useLoc(curr->asApp().getLoc());
+			}
+			else if (curr->isLocAbs())
+			{
+				useLoc(curr->asLocAbs().getLoc());
+				if (curr->asLocAbs().getLocVar())
+				{
+					locVars.push_back(curr->asLocAbs().getLocVar().value());
+				}
+			}
+			else if (curr->isLocApp())
+			{
+				useLoc(curr->asLocApp().getLoc());
+				useLoc(curr->asLocApp().getArg());
+			}
+
+			forEachNested(*curr, visit);
+		}
+
+		vars.resize(numVars);
+		locVars.resize(numLocVars);
+	};
+	visit(term);
+
+	const Term *last = &term;
+	while (TermHandle_t next = getNext(*last))
+	{
+		last = next.get();
+	}
+	info.EndsWithNil = last->isNil();
+
+	return info;
+}
+
+void Optimizer::specializeFunctions(const Program &program, std::vector<TermOwner_t> &funcs)
+{
+	for (FuncIndex_t index = 0; index < program.getNumFuncs(); ++index)
+	{
+		m_FuncLookup[program.getFuncName(index)] = index;
+	}
+
+	// Clones are appended while going through the functions, so they are
+	// specialized in turn (e.g. recursive calls passing the same location)
+	for (size_t index = 0; index < funcs.size(); ++index)
+	{
+		funcs[index] = newTerm(specializeTerm(funcs, *funcs[index]));
+	}
+}
+
+Term Optimizer::specializeTerm(std::vector<TermOwner_t> &funcs, const Term &term)
+{
+	if (auto specializedOpt = trySpecialize(funcs, term))
+	{
+		return std::move(specializedOpt.value());
+	}
+
+	size_t numVars = m_Vars.size();
+	size_t numLocVars = m_LocVars.size();
+
+	if (term.isAbs() && term.asAbs().getVar())
+	{
+		m_Vars.push_back(term.asAbs().getVar().value());
+	}
+	if (term.isLocAbs() && term.asLocAbs().getLocVar())
+	{
+		m_LocVars.push_back(term.asLocAbs().getLocVar().value());
+	}
+
+	TermHandle_t next = getNext(term);
+	Term rest = next ? specializeTerm(funcs, *next) : Term();
+
+	m_Vars.resize(numVars);
+	m_LocVars.resize(numLocVars);
+
+	return rebuildTerm(term, [&](const Term &nested) { return specializeTerm(funcs, nested); }, std::move(rest));
+}
+
+std::optional<Term> Optimizer::trySpecialize(std::vector<TermOwner_t> &funcs, const Term &term)
+{
+	// Find a run of pushes to lambda that ends with a call, the last push is
+	// popped by the first binder of the function and so on
+	std::vector<const Term *> pushes;
+	const Term *call = &term;
+
+	while ((call->isApp() && isLambda(call->asApp().getLoc())) || (call->isLocApp() && isLambda(call->asLocApp().getLoc())))
+	{
+		pushes.push_back(call);
+		call = getNext(*call).get();
+	}
+
+	if (pushes.empty() || !call->isVar() || std::find(m_Vars.begin(), m_Vars.end(), call->asVar().getVar()) != m_Vars.end())
+	{
+		return std::nullopt;
+	}
+
+	const Var_t &funcName = call->asVar().getVar();
+	TermHandle_t body = funcs[m_FuncLookup.at(funcName)];
+
+	// Pair the binders of the function with the pushes that they pop, binders
+	// of location variables given reserved locations can be specialized
+	std::vector<std::optional<Loc_t>> params;
+	std::vector<const Term *> binders;
+	bool isSpecialized = false;
+
+	for (auto itPush = pushes.rbegin(); itPush != pushes.rend() && (body->isAbs() || body->isLocAbs()); ++itPush)
+	{
+		const Term &push = **itPush;
+		std::optional<Loc_t> param;
+
+		// Binders after one that rebinds lambda would no longer pop these pushes
+		if (body->isLocAbs() && body->asLocAbs().getLocVar() == k_LambdaLoc)
+		{
+			break;
+		}
+
+		if (body->isLocAbs() && body->asLocAbs().getLoc() == k_LambdaLoc && body->asLocAbs().getLocVar()
+			&& push.isLocApp() && isLiteralLoc(push.asLocApp().getArg()))
+		{
+			// The location must not be rebound anywhere the parameter is used
+			if (!bindsLoc(*body, push.asLocApp().getArg()))
+			{
+				param = push.asLocApp().getArg();
+				isSpecialized = true;
+			}
+		}
+		else if (body->isAbs() ? body->asAbs().getLoc() != k_LambdaLoc : body->asLocAbs().getLoc() != k_LambdaLoc)
+		{
+			break;
+		}
+
+		params.push_back(param);
+		binders.push_back(body.get());
+		body = getNext(*body);
+	}
+
+	if (!isSpecialized)
+	{
+		return std::nullopt;
+	}
+
+	// Only the binders up to the last specialized one are part of the name
+	while (!params.back())
+	{
+		params.pop_back();
+		binders.pop_back();
+	}
+
+	std::string cloneName = funcName;
+	for (const std::optional<Loc_t> &param : params)
+	{
+		cloneName += "#" + (param ? getLocName(param.value()) : "_");
+	}
+
+	if (m_FuncLookup.find(cloneName) == m_FuncLookup.end())
+	{
+		if (m_Stats.Specializations >= m_Options.MaxSpecializations)
+		{
+			return std::nullopt;
+		}
+
+		// Rebuild the binders from the innermost one, dropping the specialized
+		// ones and substituting their location into everything after them
+		TermOwner_t clone = newTerm(cloneTerm(*getNext(*binders.back())));
+
+		for (size_t i = binders.size(); i-- > 0; )
+		{
+			if (params[i])
+			{
+				clone = newTerm(substituteLoc(*clone, binders[i]->asLocAbs().getLocVar().value(), params[i].value()));
+			}
+			else
+			{
+				clone = newTerm(rebuildTerm(*binders[i], cloneTerm, std::move(*clone)));
+			}
+		}
+
+		m_Stats.Specializations++;
+		m_FuncLookup[cloneName] = funcs.size();
+		m_NewFuncNames.push_back(cloneName);
+		funcs.push_back(clone);
+	}
+
+	// The call site keeps every push that is not specialized away, each of the
+	// others saves its push and its pop
+	TermOwner_t rest = newTerm(VarTerm(cloneName, specializeTerm(funcs, *getNext(*call))));
+
+	for (size_t param = 0; param < pushes.size(); ++param)
+	{
+		const Term &push = *pushes[pushes.size() - 1 - param];
+
+		if (param < params.size() && params[param])
+		{
+			m_Stats.StepsEliminated += 2;
+		}
+		else
+		{
+			rest = newTerm(rebuildTerm(push, [&](const Term &nested) { return specializeTerm(funcs, nested); }, std::move(*rest)));
+		}
+	}
+
+	return std::move(*rest);
+}
+
+Term Optimizer::foldTerm(const Term &term)
+{
+	// Fold the rest of the sequence first, so that folding this term can make
+	// use of everything that was folded after it
+	size_t numLocVars = m_LocVars.size();
+
+	if (term.isLocAbs() && term.asLocAbs().getLocVar())
+	{
+		m_LocVars.push_back(term.asLocAbs().getLocVar().value());
+	}
+
+	TermHandle_t next = getNext(term);
+	Term rest = next ? foldTerm(*next) : Term();
+
+	m_LocVars.resize(numLocVars);
+
+	Term folded = rebuildTerm(term, [this](const Term &nested) { return foldTerm(nested); }, std::move(rest));
+
+	if (auto foldedOpt = tryFold(folded))
+	{
+		return foldTerm(foldedOpt.value());
+	}
+	return folded;
+}
+
+std::optional<Term> Optimizer::tryFold(const Term &term)
+{
+	TermHandle_t next = getNext(term);
+
+	if (term.isApp() && isLambda(term.asApp().getLoc()) && term.asApp().getArg()->isVal()
+		&& term.asApp().getArg()->asVal().isPrim())
+	{
+		Prim_t prim = term.asApp().getArg()->asVal().asPrim();
+
+		// [5] . <x> . M
+		if (next->isAbs() && isLambda(next->asAbs().getLoc()))
+		{
+			const AbsTerm &abs = next->asAbs();
+
+			if (!abs.getVar() || isOnlyPushed(*abs.getBody(), abs.getVar().value()))
+			{
+				m_Stats.Folds++;
+				m_Stats.StepsEliminated += 2;
+
+				return abs.getVar()
+					? substituteVar(*abs.getBody(), abs.getVar().value(), prim)
+					: cloneTerm(*abs.getBody());
+			}
+		}
+		// [2] . [3] . +
+		else if (next->isApp() && isLambda(next->asApp().getLoc()) && next->asApp().getArg()->isVal()
+			&& next->asApp().getArg()->asVal().isPrim() && next->asApp().getBody()->isBinOp())
+		{
+			const BinOpTerm &binOp = next->asApp().getBody()->asBinOp();
+			Prim_t second = next->asApp().getArg()->asVal().asPrim();
+
+			// Wraps around like the machine does on overflow
+			Prim_t result = binOp.isOp(BinOpTerm::Plus) ? addPrims(prim, second) : subPrims(prim, second);
+
+			m_Stats.Folds++;
+			m_Stats.StepsEliminated += 2;
+
+			return Term(AppTerm(k_LambdaLoc, Term(ValTerm(result)), cloneTerm(*binOp.getBody())));
+		}
+		// [0] . (0 -> M, ...)
+		else if (next->isPrimCases())
+		{
+			const CasesTerm<Prim_t> &cases = next->asPrimCases();
+			return tryFoldCases(*cases.getBranch(cases.selectBranch(prim)), *cases.getBody());
+		}
+	}
+	else if (term.isLocApp() && isLambda(term.asLocApp().getLoc()))
+	{
+		Loc_t loc = term.asLocApp().getArg();
+
+		// [#p] . <@q> . M
+		if (next->isLocAbs() && isLambda(next->asLocAbs().getLoc()))
+		{
+			const LocAbsTerm &locAbs = next->asLocAbs();
+
+			if (!locAbs.getLocVar() || !bindsLoc(*locAbs.getBody(), loc))
+			{
+				m_Stats.Folds++;
+				m_Stats.StepsEliminated += 2;
+
+				return locAbs.getLocVar()
+					? substituteLoc(*locAbs.getBody(), locAbs.getLocVar().value(), loc)
+					: cloneTerm(*locAbs.getBody());
+			}
+		}
+		// [#null] . (null -> M, ...)
+		else if (next->isLocCases() && isLiteralLoc(loc))
+		{
+			const CasesTerm<Loc_t> &cases = next->asLocCases();
+			return tryFoldCases(*cases.getBranch(cases.selectBranch(loc)), *cases.getBody());
+		}
+	}
+
+	return std::nullopt;
+}
+
+std::optional<Term> Optimizer::tryFoldCases(const Term &branch, const Term &rest)
+{
+	// The branch is followed by the rest of the sequence directly, which is only
+	// possible when none of its binders would capture names used by the rest
+	std::set<Var_t> restVars;
+	std::set<Loc_t> restLocs;
+	collectNames(rest, restVars, restLocs);
+
+	for (const Term *t = &branch; t; t = getNext(*t).get())
+	{
+		if (t->isAbs() && t->asAbs().getVar() && restVars.count(t->asAbs().getVar().value()))
+		{
+			return std::nullopt;
+		}
+		if (t->isLocAbs() && t->asLocAbs().getLocVar() && restLocs.count(t->asLocAbs().getLocVar().value()))
+		{
+			return std::nullopt;
+		}
+	}
+
+	auto appendedOpt = appendTerm(branch, rest);
+
+	if (appendedOpt)
+	{
+		// The pushed value, the cases and the end of the branch
+		m_Stats.Folds++;
+		m_Stats.StepsEliminated += rest.isNil() ? 2 : 3;
+	}
+
+	return appendedOpt;
+}
+
+bool Optimizer::isLambda(Loc_t loc) const
+{
+	return loc == k_LambdaLoc && isLiteralLoc(loc);
+}
+
+bool Optimizer::isLiteralLoc(Loc_t loc) const
+{
+	return isReservedLoc(loc) && std::find(m_LocVars.begin(), m_LocVars.end(), loc) == m_LocVars.end();
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <optional>
+
+#include "Config.hpp"
+#include "Term.hpp"
+
+class Program;
+
+struct OptimizerOptions
+{
+	// Inlines calls to non-recursive functions of at most this many terms,
+	// zero disables inlining
+	size_t InlineThreshold = 0;
+
+	// Clones functions which are passed reserved locations (such as 'out')
+	// for their location parameters, making at most this many clones
+	size_t MaxSpecializations = 0;
+
+	// Partially evaluates terms whose inputs are known before running
+	bool Fold = false;
+};
+
+struct OptimizerStats
+{
+	uint64_t Inlines = 0;
+	uint64_t Specializations = 0;
+	uint64_t Folds = 0;
+	// Steps the tree walker no longer takes each time the optimized terms run
+	uint64_t StepsEliminated = 0;
+};
+
+// Rewrites the functions of a program before it runs. Inlining replaces calls
+// to small functions with their bodies, renaming their binders so they cannot
+// capture anything at the call site. Functions that can reach themselves are
+// never inlined. Specializing clones a function for the reserved locations
+// that call sites pass it, so the location is a constant in the clone
+// (e.g. 'write#out' for '[#out] . write'). Folding then evaluates the parts
+// of a sequence whose inputs are known statically:
+//
+//   [5] . <x> . M          =>  M with [x] replaced by [5]
+//   [#p] . <@q> . M        =>  M with q replaced by p
+//   [2] . [3] . +          =>  [5]
+//   [0] . (0 -> M, ...)    =>  M followed by the rest of the sequence
+//
+// Only pushes and pops on lambda are folded, so reading 'in' and writing to
+// 'out' happen exactly as they were written. Terms are rewritten by name and
+// the program is resolved again afterwards.
+class Optimizer
+{
+public:
+	explicit Optimizer(const OptimizerOptions &options);
+
+	// Rewrites the functions in place, new functions are appended to them
+	void optimize(const Program &program, std::vector<TermOwner_t> &funcs);
+
+	const OptimizerStats &getStats() const;
+	const std::vector<std::string> &getNewFuncNames() const;
+
+private:
+	struct FuncInfo
+	{
+		bool IsRecursive = false;
+		bool IsInlined = false;
+		// Bodies can only be followed by the rest of the call site when they end with nil
+		bool EndsWithNil = false;
+		size_t Size = 0;
+
+		// Names the function uses without binding them, i.e. the functions it
+		// calls and the reserved locations it uses
+		std::set<Var_t> FreeVars;
+		std::set<Loc_t> FreeLocs;
+	};
+
+	void inlineFunctions(const Program &program, std::vector<TermOwner_t> &funcs);
+	void inlineFunction(const Program &program, std::vector<TermOwner_t> &funcs, FuncIndex_t index);
+	Term inlineTerm(const Program &program, std::vector<TermOwner_t> &funcs, const Term &term);
+	Term renameTerm(const Term &term, std::vector<std::pair<Var_t, Var_t>> vars, std::vector<std::pair<Loc_t, Loc_t>> locs, const Term *rest);
+
+	FuncInfo getFuncInfo(const Term &term) const;
+
+	void specializeFunctions(const Program &program, std::vector<TermOwner_t> &funcs);
+	Term specializeTerm(std::vector<TermOwner_t> &funcs, const Term &term);
+	std::optional<Term> trySpecialize(std::vector<TermOwner_t> &funcs, const Term &term);
+
+	Term foldTerm(const Term &term);
+	std::optional<Term> tryFold(const Term &term);
+	std::optional<Term> tryFoldCases(const Term &branch, const Term &rest);
+
+	bool isLambda(Loc_t loc) const;
+	bool isLiteralLoc(Loc_t loc) const;
+
+private:
+	OptimizerOptions m_Options;
+	OptimizerStats m_Stats;
+
+	std::vector<FuncInfo> m_FuncInfos;
+	uint32_t m_NumRenames = 0;
+
+	// Every function by name, including clones, and the clones made so far
+	std::map<std::string, size_t> m_FuncLookup;
+	std::vector<std::string> m_NewFuncNames;
+
+	// Variables and location variables bound around the term being rewritten,
+	// these can shadow function names and the reserved locations
+	std::vector<Var_t> m_Vars;
+	std::vector<LocVar_t> m_LocVars;
+};
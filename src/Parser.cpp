@@ -58,12 +58,19 @@ static void parseError(std::string message, const Lexer &lexer)
 
 Parser::Parser() : m_Lexer(nullptr) {}
 
-Program Parser::parseProgram(const std::string &programSrc)
+Program Parser::parseProgram(const std::string &programSrc, const OptimizerOptions &options)
 {
 	m_Lexer = std::make_unique<Lexer>(programSrc);
 
-	Program::FuncDefs_t funcs = parseFuncDefs();
-	return Program(std::move(funcs));
+	auto terms = std::make_unique<TermArena>();
+	Program::FuncDefs_t funcs;
+	{
+		TermArena::Scope scope(*terms);
+		funcs = parseFuncDefs();
+	}
+
+	// The program resolves, optimizes and links its functions as it is constructed
+	return Program(std::move(terms), std::move(funcs), options);
 }
 
 std::optional<Term> Parser::parseTerm(const std::string &termSrc)
@@ -221,13 +228,13 @@ std::optional<VarTerm> Parser::parseVar()
 
 std::optional<AbsTerm> Parser::parseAbs()
 {
-	std::optional<std::string> locOpt;
+	std::optional<Loc_t> locOpt;
 
 	if (m_Lexer->isPeekToken(Token::Id) &&
 		m_Lexer->isPeekToken(Token::Lab, 1) &&
 		!m_Lexer->isPeekToken(Token::Ampersand, 2))
 	{
-		locOpt = m_Lexer->getPeekBuffer();
+		locOpt = internLoc(m_Lexer->getPeekBuffer().value());
 		m_Lexer->next();
 	}
 
@@ -299,11 +306,11 @@ std::optional<AppTerm> Parser::parseApp()
 			{
 				m_Lexer->next();
 
-				std::optional<std::string> locOpt;
+				std::optional<Loc_t> locOpt;
 
 				if (m_Lexer->isPeekToken(Token::Id))
 				{
-					locOpt = m_Lexer->getPeekBuffer();
+					locOpt = internLoc(m_Lexer->getPeekBuffer().value());
 					m_Lexer->next();
 				}
 
@@ -346,13 +353,13 @@ std::optional<AppTerm> Parser::parseApp()
 
 std::optional<LocAbsTerm> Parser::parseLocAbs()
 {
-	std::optional<std::string> locOpt;
+	std::optional<Loc_t> locOpt;
 
 	if (m_Lexer->isPeekToken(Token::Id) &&
 		m_Lexer->isPeekToken(Token::Lab, 1) &&
 		m_Lexer->isPeekToken(Token::Ampersand, 2))
 	{
-		locOpt = m_Lexer->getPeekBuffer();
+		locOpt = internLoc(m_Lexer->getPeekBuffer().value());
 		m_Lexer->next();
 	}
 
@@ -362,11 +369,11 @@ std::optional<LocAbsTerm> Parser::parseLocAbs()
 		m_Lexer->next();
 		m_Lexer->next();
 
-		std::optional<std::string> varOpt;
+		std::optional<LocVar_t> varOpt;
 		
 		if (m_Lexer->isPeekToken(Token::Id))
 		{
-			varOpt = m_Lexer->getPeekBuffer();
+			varOpt = internLoc(m_Lexer->getPeekBuffer().value());
 			m_Lexer->next();
 		}
 		else if (m_Lexer->isPeekToken(Token::Underscore))
@@ -430,11 +437,11 @@ std::optional<LocAppTerm> Parser::parseLocApp()
 				{
 					m_Lexer->next();
 
-					std::optional<std::string> locOpt;
+					std::optional<Loc_t> locOpt;
 
 					if (m_Lexer->isPeekToken(Token::Id))
 					{
-						locOpt = m_Lexer->getPeekBuffer();
+						locOpt = internLoc(m_Lexer->getPeekBuffer().value());
 						m_Lexer->next();
 					}
 
@@ -446,7 +453,7 @@ std::optional<LocAppTerm> Parser::parseLocApp()
 						{
 							return LocAppTerm(
 								locOpt.value_or(k_LambdaLoc),
-								argOpt.value(),
+								internLoc(argOpt.value()),
 								std::move(bodyOpt.value())
 							);
 						}
@@ -458,7 +465,7 @@ std::optional<LocAppTerm> Parser::parseLocApp()
 
 					return LocAppTerm(
 						locOpt.value_or(k_LambdaLoc),
-						argOpt.value()
+						internLoc(argOpt.value())
 					);
 				}
 				else
@@ -549,7 +556,7 @@ std::optional<std::variant<CasesTerm<Prim_t>, CasesTerm<Loc_t>>> Parser::parseCa
 		while (isCaseRemaining)
 		{
 			std::optional<Prim_t> primOpt;
-			std::optional<Loc_t> locOpt;
+			std::optional<std::string> locOpt;
 			bool isOtherwise = false;
 
 			if (m_Lexer->isPeekToken(Token::Primitive))
@@ -591,7 +598,7 @@ std::optional<std::variant<CasesTerm<Prim_t>, CasesTerm<Loc_t>>> Parser::parseCa
 					}
 					else if (locOpt)
 					{
-						locCases[locOpt.value()] = newTerm(std::move(termOpt.value()));
+						locCases[internLoc(locOpt.value())] = newTerm(std::move(termOpt.value()));
 					}
 
 					if (m_Lexer->isPeekToken(Token::Comma))
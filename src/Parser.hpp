@@ -16,7 +16,9 @@ class Parser
 public:
 	Parser();
 
-	Program parseProgram(const std::string &programSrc);
+	Program parseProgram(const std::string &programSrc, const OptimizerOptions &options = {});
+	// The terms the parsed term is made of are allocated in the arena of the
+	// current scope
 	std::optional<Term> parseTerm(const std::string &termSrc);
 
 private:
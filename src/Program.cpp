@@ -1,15 +1,98 @@
 #include "Program.hpp"
 
-Program::Program(FuncDefs_t &&funcs)
-	: m_Funcs(std::move(funcs))
-{}
+#include <algorithm>
+
+#include "Resolver.hpp"
+
+Program::Program(std::unique_ptr<TermArena> terms, FuncDefs_t &&funcs, const OptimizerOptions &options)
+	: m_Terms(std::move(terms))
+{
+	TermArena::Scope scope(*m_Terms);
+
+	// Number functions in name order so that indices (and errors found while
+	// linking) are the same on every run
+	for (auto itFuncs = funcs.begin(); itFuncs != funcs.end(); ++itFuncs)
+	{
+		m_FuncNames.push_back(itFuncs->first);
+	}
+	std::sort(m_FuncNames.begin(), m_FuncNames.end());
+
+	std::vector<TermOwner_t> owners;
+
+	for (const std::string &funcName : m_FuncNames)
+	{
+		m_FuncIndices[funcName] = static_cast<FuncIndex_t>(m_Funcs.size());
+		m_Funcs.push_back(funcs[funcName]);
+		owners.push_back(std::move(funcs[funcName]));
+	}
+
+	resolveProgram(*this, owners);
+
+	// The optimizer rewrites terms by name, so they are resolved again once it
+	// is done. Errors have already been reported by then.
+	Optimizer optimizer(options);
+	optimizer.optimize(*this, owners);
+	m_OptimizerStats = optimizer.getStats();
+
+	if (m_OptimizerStats.Inlines > 0 || m_OptimizerStats.Specializations > 0 || m_OptimizerStats.Folds > 0)
+	{
+		for (FuncIndex_t index = 0; index < m_Funcs.size(); ++index)
+		{
+			m_Funcs[index] = owners[index];
+		}
+
+		// Specialized clones are numbered after the functions of the program
+		for (const std::string &funcName : optimizer.getNewFuncNames())
+		{
+			m_FuncIndices[funcName] = static_cast<FuncIndex_t>(m_Funcs.size());
+			m_FuncNames.push_back(funcName);
+			m_Funcs.push_back(owners[m_Funcs.size()]);
+		}
+
+		resolveProgram(*this, owners);
+	}
+}
 
 std::optional<TermHandle_t> Program::load(const std::string &funcName) const
 {
-	auto it = m_Funcs.find(funcName);
-	if (it != m_Funcs.end())
+	if (auto indexOpt = findFunc(funcName))
+	{
+		return m_Funcs[indexOpt.value()];
+	}
+	return std::nullopt;
+}
+
+std::optional<FuncIndex_t> Program::findFunc(const std::string &funcName) const
+{
+	auto it = m_FuncIndices.find(funcName);
+	if (it != m_FuncIndices.end())
 	{
 		return it->second;
 	}
 	return std::nullopt;
-}
\ No newline at end of file
+}
+
+const TermHandle_t &Program::getFunc(FuncIndex_t index) const
+{
+	return m_Funcs[index];
+}
+
+const std::string &Program::getFuncName(FuncIndex_t index) const
+{
+	return m_FuncNames[index];
+}
+
+size_t Program::getNumFuncs() const
+{
+	return m_Funcs.size();
+}
+
+const OptimizerStats &Program::getOptimizerStats() const
+{
+	return m_OptimizerStats;
+}
+
+const TermArena &Program::getTerms() const
+{
+	return *m_Terms;
+}
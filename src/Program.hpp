@@ -1,11 +1,18 @@
 #pragma once
 
 #include <unordered_map>
+#include <memory>
 #include <string>
+#include <vector>
 #include <optional>
 
 #include "Term.hpp"
+#include "Optimizer.hpp"
 
+// The functions of a program, numbered in name order (followed by any clones
+// made by the optimizer). Function references
+// are linked to these numbers when the program is loaded, so running the
+// program never has to look a function up by name.
 class Program
 {
 public:
@@ -16,10 +23,27 @@ public:
 	Program(const Program &program) = delete;
 	Program(Program &&program) = delete;
 
-	Program(FuncDefs_t &&funcs);
+	// The terms of the functions must have been allocated in the arena
+	Program(std::unique_ptr<TermArena> terms, FuncDefs_t &&funcs, const OptimizerOptions &options = {});
 
 	std::optional<TermHandle_t> load(const std::string &funcName) const;
 
+	std::optional<FuncIndex_t> findFunc(const std::string &funcName) const;
+
+	const TermHandle_t &getFunc(FuncIndex_t index) const;
+	const std::string &getFuncName(FuncIndex_t index) const;
+	size_t getNumFuncs() const;
+
+	const OptimizerStats &getOptimizerStats() const;
+	const TermArena &getTerms() const;
+
 private:
-	FuncDefs_t m_Funcs;
-};
\ No newline at end of file
+	// Owns every term of the program, including those made by the optimizer
+	std::unique_ptr<TermArena> m_Terms;
+
+	std::vector<std::string> m_FuncNames;
+	std::vector<TermHandle_t> m_Funcs;
+	std::unordered_map<std::string, FuncIndex_t> m_FuncIndices;
+
+	OptimizerStats m_OptimizerStats;
+};
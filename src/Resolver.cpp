@@ -0,0 +1,264 @@
+#include "Resolver.hpp"
+
+#include <iostream>
+#include <algorithm>
+
+#include "Utils.hpp"
+
+Resolver::Resolver(FindFunc_t findFunc)
+	: m_FindFunc(std::move(findFunc))
+{}
+
+bool Resolver::resolve(const std::string &context, Term &term)
+{
+	size_t numErrors = m_Errors.size();
+
+	m_Context = context;
+	m_Scopes.assign(1, Scope{m_Vars.size(), m_LocVars.size(), {}, {}});
+	m_UnboundVars.clear();
+	m_UnboundLocs.clear();
+	resolveTerm(term);
+
+	return m_Errors.size() == numErrors;
+}
+
+const std::vector<std::string> &Resolver::getErrors() const
+{
+	return m_Errors;
+}
+
+void Resolver::resolveTerm(Term &term)
+{
+	size_t numVars = m_Vars.size();
+	size_t numLocVars = m_LocVars.size();
+
+	// Walk along the sequence iteratively, binders stay in scope until the
+	// end of the sequence they appear in
+	Term *curr = &term;
+
+	while (curr)
+	{
+		if (curr->isNil() || curr->isVal())
+		{
+			curr = nullptr;
+		}
+		else if (curr->isVar())
+		{
+			VarTerm &var = curr->asVar();
+
+			var.setIndex(findVar(var.getVarId(), m_Scopes.size() - 1));
+			var.setFuncIndex(var.getIndex() ? std::nullopt : m_FindFunc(var.getVar()));
+
+			if (!var.getIndex() && !var.getFuncIndex() && m_UnboundVars.insert(var.getVarId()).second)
+			{
+				m_Errors.push_back("Variable '" + var.getVar() + "' "
+					+ "is not bound to anything in '" + m_Context + "' !");
+			}
+
+			curr = var.getBody().get();
+		}
+		else if (curr->isAbs())
+		{
+			AbsTerm &abs = curr->asAbs();
+
+			abs.setLocIndex(resolveLoc(abs.getLoc()));
+
+			if (abs.isBinding())
+			{
+				m_Vars.push_back(abs.getVarId().value());
+			}
+
+			curr = abs.getBody().get();
+		}
+		else if (curr->isApp())
+		{
+			AppTerm &app = curr->asApp();
+
+			app.setLocIndex(resolveLoc(app.getLoc()));
+
+			// Values are pushed as they are, anything else can become a closure
+			if (!app.getArg()->isVal())
+			{
+				m_Scopes.push_back(Scope{m_Vars.size(), m_LocVars.size(), {}, {}});
+				resolveTerm(*app.getArg());
+
+				std::vector<Index_t> captures;
+				std::vector<Index_t> locCaptures;
+
+				for (const auto &[var, index] : m_Scopes.back().Captures)
+				{
+					captures.push_back(index);
+				}
+				for (const auto &[locVar, index] : m_Scopes.back().LocCaptures)
+				{
+					locCaptures.push_back(index);
+				}
+
+				app.setCaptures(captures, locCaptures);
+				m_Scopes.pop_back();
+			}
+
+			curr = app.getBody().get();
+		}
+		else if (curr->isLocAbs())
+		{
+			LocAbsTerm &locAbs = curr->asLocAbs();
+
+			locAbs.setLocIndex(resolveLoc(locAbs.getLoc()));
+
+			if (locAbs.getLocVar())
+			{
+				m_LocVars.push_back(locAbs.getLocVar().value());
+			}
+
+			curr = locAbs.getBody().get();
+		}
+		else if (curr->isLocApp())
+		{
+			LocAppTerm &locApp = curr->asLocApp();
+
+			locApp.setLocIndex(resolveLoc(locApp.getLoc()));
+			locApp.setArgIndex(findLocVar(locApp.getArg(), m_Scopes.size() - 1));
+
+			curr = locApp.getBody().get();
+		}
+		else if (curr->isBinOp())
+		{
+			curr = curr->asBinOp().getBody().get();
+		}
+		else if (curr->isPrimCases())
+		{
+			CasesTerm<Prim_t> &cases = curr->asPrimCases();
+
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				resolveTerm(*itCases->second);
+			}
+			resolveTerm(*cases.getOtherwise());
+
+			curr = cases.getBody().get();
+		}
+		else if (curr->isLocCases())
+		{
+			CasesTerm<Loc_t> &cases = curr->asLocCases();
+
+			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
+			{
+				resolveTerm(*itCases->second);
+			}
+			resolveTerm(*cases.getOtherwise());
+
+			curr = cases.getBody().get();
+		}
+	}
+
+	m_Vars.resize(numVars);
+	m_LocVars.resize(numLocVars);
+}
+
+std::optional<Index_t> Resolver::resolveLoc(Loc_t loc)
+{
+	if (auto indexOpt = findLocVar(loc, m_Scopes.size() - 1))
+	{
+		return indexOpt;
+	}
+
+	if (!isReservedLoc(loc) && m_UnboundLocs.insert(loc).second)
+	{
+		m_Errors.push_back("Location '" + getLocName(loc) + "' "
+			+ "is not bound to anything in '" + m_Context + "' !");
+	}
+
+	return std::nullopt;
+}
+
+std::optional<Index_t> Resolver::findVar(VarId_t var, size_t scopeIndex)
+{
+	Scope &scope = m_Scopes[scopeIndex];
+	size_t end = (scopeIndex + 1 < m_Scopes.size()) ? m_Scopes[scopeIndex + 1].NumVars : m_Vars.size();
+
+	auto begin = m_Vars.begin() + static_cast<ptrdiff_t>(scope.NumVars);
+	auto it = std::find(std::make_reverse_iterator(m_Vars.begin() + static_cast<ptrdiff_t>(end)), std::make_reverse_iterator(begin), var);
+	if (it.base() != begin)
+	{
+		return static_cast<Index_t>(m_Vars.begin() + static_cast<ptrdiff_t>(end) - it.base());
+	}
+
+	size_t numLocals = end - scope.NumVars;
+
+	for (size_t k = 0; k < scope.Captures.size(); ++k)
+	{
+		if (scope.Captures[k].first == var)
+		{
+			return static_cast<Index_t>(numLocals + k);
+		}
+	}
+
+	// Captured from the enclosing scope the first time it is used
+	if (scopeIndex > 0)
+	{
+		if (auto indexOpt = findVar(var, scopeIndex - 1))
+		{
+			scope.Captures.emplace_back(var, indexOpt.value());
+			return static_cast<Index_t>(numLocals + scope.Captures.size() - 1);
+		}
+	}
+
+	return std::nullopt;
+}
+
+std::optional<Index_t> Resolver::findLocVar(LocVar_t locVar, size_t scopeIndex)
+{
+	Scope &scope = m_Scopes[scopeIndex];
+	size_t end = (scopeIndex + 1 < m_Scopes.size()) ? m_Scopes[scopeIndex + 1].NumLocVars : m_LocVars.size();
+
+	auto begin = m_LocVars.begin() + static_cast<ptrdiff_t>(scope.NumLocVars);
+	auto it = std::find(std::make_reverse_iterator(m_LocVars.begin() + static_cast<ptrdiff_t>(end)), std::make_reverse_iterator(begin), locVar);
+	if (it.base() != begin)
+	{
+		return static_cast<Index_t>(m_LocVars.begin() + static_cast<ptrdiff_t>(end) - it.base());
+	}
+
+	size_t numLocals = end - scope.NumLocVars;
+
+	for (size_t k = 0; k < scope.LocCaptures.size(); ++k)
+	{
+		if (scope.LocCaptures[k].first == locVar)
+		{
+			return static_cast<Index_t>(numLocals + k);
+		}
+	}
+
+	if (scopeIndex > 0)
+	{
+		if (auto indexOpt = findLocVar(locVar, scopeIndex - 1))
+		{
+			scope.LocCaptures.emplace_back(locVar, indexOpt.value());
+			return static_cast<Index_t>(numLocals + scope.LocCaptures.size() - 1);
+		}
+	}
+
+	return std::nullopt;
+}
+
+void resolveProgram(const Program &program, const std::vector<TermOwner_t> &funcs)
+{
+	Resolver resolver([&](const Var_t &var) {
+		return program.findFunc(var);
+	});
+
+	for (FuncIndex_t index = 0; index < funcs.size(); ++index)
+	{
+		resolver.resolve(program.getFuncName(index), *funcs[index]);
+	}
+
+	if (!resolver.getErrors().empty())
+	{
+		for (const std::string &error : resolver.getErrors())
+		{
+			std::cerr << "[Resolve Error] " << error << std::endl;
+		}
+
+		std::exit(1);
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "Config.hpp"
+#include "Term.hpp"
+#include "Program.hpp"
+
+// Assigns lexical indices to bound variables and location variables, and
+// links free variables to the functions they call, so the machine can find
+// both without hashing names. Names which can never be bound are collected
+// as errors instead of failing at runtime.
+//
+// Arguments of applications which become closures are resolved in a scope of
+// their own, since a closure only captures the variables its term uses. Inside
+// of such a scope the variables bound in it are numbered first as usual, then
+// the captured ones in the order they are first used. The application keeps
+// the index each captured variable has where the closure is made.
+class Resolver
+{
+public:
+	using FindFunc_t = std::function<std::optional<FuncIndex_t>(const Var_t &)>;
+
+public:
+	explicit Resolver(FindFunc_t findFunc);
+
+	bool resolve(const std::string &context, Term &term);
+
+	const std::vector<std::string> &getErrors() const;
+
+private:
+	void resolveTerm(Term &term);
+	std::optional<Index_t> resolveLoc(Loc_t loc);
+
+	std::optional<Index_t> findVar(VarId_t var, size_t scopeIndex);
+	std::optional<Index_t> findLocVar(LocVar_t locVar, size_t scopeIndex);
+
+private:
+	struct Scope
+	{
+		// Where the scope starts in the bound variables
+		size_t NumVars;
+		size_t NumLocVars;
+
+		// Names captured from the enclosing scope with their index there
+		std::vector<std::pair<VarId_t, Index_t>> Captures;
+		std::vector<std::pair<LocVar_t, Index_t>> LocCaptures;
+	};
+
+
+	FindFunc_t m_FindFunc;
+	std::string m_Context;
+
+	std::vector<VarId_t> m_Vars;
+	std::vector<LocVar_t> m_LocVars;
+	std::vector<Scope> m_Scopes;
+
+	std::vector<std::string> m_Errors;
+	// Unbound names already reported in the current definition
+	std::unordered_set<VarId_t> m_UnboundVars;
+	std::unordered_set<Loc_t> m_UnboundLocs;
+};
+
+// Resolves the functions of a program, given in the program's function order
+void resolveProgram(const Program &program, const std::vector<TermOwner_t> &funcs);
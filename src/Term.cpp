@@ -1,21 +1,45 @@
 #include "Term.hpp"
 
+#include <algorithm>
+#include <iostream>
+#include <new>
+#include <cstdlib>
+
+#include "Utils.hpp"
+
+// Releasing an arena relies on this, see TermArena
+static_assert(std::is_trivially_destructible_v<Term>);
+
+namespace
+{
+	TermArena *&getScopedArena()
+	{
+		static TermArena *arena = nullptr;
+		return arena;
+	}
+}
+
 TermOwner_t newTerm(Term &&term)
 {
-	return std::make_shared<Term>(std::move(term));
+	return TermOwner_t(TermArena::getCurrent().add(std::move(term)));
 }
 
 VarTerm::VarTerm(Var_t var)
-	: m_Var(var)
+	: m_Var(internVar(var))
 	, m_Body(newTerm(NilTerm()))
 {}
 
 VarTerm::VarTerm(Var_t var, Term &&body)
-	: m_Var(var)
+	: m_Var(internVar(var))
 	, m_Body(newTerm(std::move(body)))
 {}
 
-Var_t VarTerm::getVar() const
+const Var_t &VarTerm::getVar() const
+{
+	return getVarName(m_Var);
+}
+
+VarId_t VarTerm::getVarId() const
 {
 	return m_Var;
 }
@@ -25,16 +49,41 @@ TermHandle_t VarTerm::getBody() const
 	return m_Body;
 }
 
+TermOwner_t VarTerm::getBody()
+{
+	return m_Body;
+}
+
+std::optional<Index_t> VarTerm::getIndex() const
+{
+	return m_Index;
+}
+
+void VarTerm::setIndex(std::optional<Index_t> index)
+{
+	m_Index = index;
+}
+
+std::optional<FuncIndex_t> VarTerm::getFuncIndex() const
+{
+	return m_FuncIndex;
+}
+
+void VarTerm::setFuncIndex(std::optional<FuncIndex_t> index)
+{
+	m_FuncIndex = index;
+}
+
 AbsTerm::AbsTerm(Loc_t loc, std::optional<Var_t> var)
 	: m_Loc(loc)
-	, m_Var(var)
+	, m_Var(var ? std::optional(internVar(var.value())) : std::nullopt)
 	, m_Body(newTerm(NilTerm()))
 {
 }
 
 AbsTerm::AbsTerm(Loc_t loc, std::optional<Var_t> var, Term &&body)
 	: m_Loc(loc)
-	, m_Var(var)
+	, m_Var(var ? std::optional(internVar(var.value())) : std::nullopt)
 	, m_Body(newTerm(std::move(body)))
 {}
 
@@ -44,15 +93,44 @@ Loc_t AbsTerm::getLoc() const
 }
 
 std::optional<Var_t> AbsTerm::getVar() const
+{
+	if (m_Var)
+	{
+		return getVarName(m_Var.value());
+	}
+	return std::nullopt;
+}
+
+std::optional<VarId_t> AbsTerm::getVarId() const
 {
 	return m_Var;
 }
 
+bool AbsTerm::isBinding() const
+{
+	return m_Var.has_value();
+}
+
 TermHandle_t AbsTerm::getBody() const
 {
 	return m_Body;
 }
 
+TermOwner_t AbsTerm::getBody()
+{
+	return m_Body;
+}
+
+std::optional<Index_t> AbsTerm::getLocIndex() const
+{
+	return m_LocIndex;
+}
+
+void AbsTerm::setLocIndex(std::optional<Index_t> index)
+{
+	m_LocIndex = index;
+}
+
 AppTerm::AppTerm(const Loc_t &loc, Term &&arg)
 	: m_Loc(loc)
 	, m_Arg(newTerm(std::move(arg)))
@@ -75,11 +153,51 @@ TermHandle_t AppTerm::getArg() const
 	return m_Arg;
 }
 
+TermOwner_t AppTerm::getArg()
+{
+	return m_Arg;
+}
+
 TermHandle_t AppTerm::getBody() const
 {
 	return m_Body;
 }
 
+TermOwner_t AppTerm::getBody()
+{
+	return m_Body;
+}
+
+std::optional<Index_t> AppTerm::getLocIndex() const
+{
+	return m_LocIndex;
+}
+
+void AppTerm::setLocIndex(std::optional<Index_t> index)
+{
+	m_LocIndex = index;
+}
+
+std::span<const Index_t> AppTerm::getCaptures() const
+{
+	return std::span<const Index_t>(m_Captures, m_NumCaptures);
+}
+
+std::span<const Index_t> AppTerm::getLocCaptures() const
+{
+	return std::span<const Index_t>(m_Captures + m_NumCaptures, m_NumLocCaptures);
+}
+
+void AppTerm::setCaptures(const std::vector<Index_t> &captures, const std::vector<Index_t> &locCaptures)
+{
+	std::vector<Index_t> indices = captures;
+	indices.insert(indices.end(), locCaptures.begin(), locCaptures.end());
+
+	m_NumCaptures = static_cast<uint32_t>(captures.size());
+	m_NumLocCaptures = static_cast<uint32_t>(locCaptures.size());
+	m_Captures = TermArena::getCurrent().addIndices(indices);
+}
+
 ValTerm::ValTerm(Prim_t prim)
 	: m_Val(prim)
 {}
@@ -115,6 +233,21 @@ TermHandle_t LocAbsTerm::getBody() const
 	return m_Body;
 }
 
+TermOwner_t LocAbsTerm::getBody()
+{
+	return m_Body;
+}
+
+std::optional<Index_t> LocAbsTerm::getLocIndex() const
+{
+	return m_LocIndex;
+}
+
+void LocAbsTerm::setLocIndex(std::optional<Index_t> index)
+{
+	m_LocIndex = index;
+}
+
 LocAppTerm::LocAppTerm(Loc_t loc, LocVar_t arg)
 	: m_Loc(loc)
 	, m_Arg(arg)
@@ -142,6 +275,31 @@ TermHandle_t LocAppTerm::getBody() const
 	return m_Body;
 }
 
+TermOwner_t LocAppTerm::getBody()
+{
+	return m_Body;
+}
+
+std::optional<Index_t> LocAppTerm::getLocIndex() const
+{
+	return m_LocIndex;
+}
+
+void LocAppTerm::setLocIndex(std::optional<Index_t> index)
+{
+	m_LocIndex = index;
+}
+
+std::optional<Index_t> LocAppTerm::getArgIndex() const
+{
+	return m_ArgIndex;
+}
+
+void LocAppTerm::setArgIndex(std::optional<Index_t> index)
+{
+	m_ArgIndex = index;
+}
+
 bool ValTerm::isPrim() const
 {
 	return std::holds_alternative<Prim_t>(m_Val);
@@ -182,42 +340,82 @@ TermHandle_t BinOpTerm::getBody() const
 	return m_Body;
 }
 
+TermOwner_t BinOpTerm::getBody()
+{
+	return m_Body;
+}
+
 template<typename Case_t>
 CasesTerm<Case_t>::CasesTerm(CasesTerm<Case_t>::Cases_t &&cases, TermOwner_t &&otherwise, Term &&body)
-	: m_Cases(std::move(cases))
-	, m_OtherwiseCase(std::move(otherwise))
+	: m_Data(TermArena::getCurrent().addCasesData<Case_t>())
 	, m_Body(newTerm(std::move(body)))
-{}
+{
+	m_Data->Cases = std::move(cases);
+	m_Data->Otherwise = std::move(otherwise);
+
+	std::vector<std::pair<Case_t, uint32_t>> dispatch;
+
+	for (auto itCases = m_Data->Cases.begin(); itCases != m_Data->Cases.end(); ++itCases)
+	{
+		dispatch.emplace_back(itCases->first, static_cast<uint32_t>(m_Data->Branches.size()));
+		m_Data->Branches.push_back(itCases->second);
+	}
+	m_Data->Branches.push_back(m_Data->Otherwise);
+
+	m_Data->Dispatch = CaseDispatch<Case_t, uint32_t>(dispatch, static_cast<uint32_t>(m_Data->Cases.size()));
+}
 
 template<typename Case_t>
 CasesTerm<Case_t>::CasesTerm(CasesTerm<Case_t>::Cases_t &&cases, TermOwner_t &&otherwise)
-	: m_Cases(std::move(cases))
-	, m_OtherwiseCase(std::move(otherwise))
-	, m_Body(newTerm(NilTerm()))
+	: CasesTerm(std::move(cases), std::move(otherwise), NilTerm())
 {}
 
 template<typename Case_t>
 TermHandle_t CasesTerm<Case_t>::getOtherwise() const
 {
-	return m_OtherwiseCase;
+	return m_Data->Otherwise;
+}
+
+template<typename Case_t>
+TermOwner_t CasesTerm<Case_t>::getOtherwise()
+{
+	return m_Data->Otherwise;
 }
 
 template<typename Case_t>
 typename CasesTerm<Case_t>::Cases_t::const_iterator CasesTerm<Case_t>::find(const Case_t &c) const
 {
-	return m_Cases.find(c);
+	return m_Data->Cases.find(c);
 }
 
 template<typename Case_t>
 typename CasesTerm<Case_t>::Cases_t::const_iterator CasesTerm<Case_t>::begin() const
 {
-	return m_Cases.begin();
+	return m_Data->Cases.begin();
 }
 
 template<typename Case_t>
 typename CasesTerm<Case_t>::Cases_t::const_iterator CasesTerm<Case_t>::end() const
 {
-	return m_Cases.end();
+	return m_Data->Cases.end();
+}
+
+template<typename Case_t>
+uint32_t CasesTerm<Case_t>::selectBranch(const Case_t &c) const
+{
+	return m_Data->Dispatch.find(c);
+}
+
+template<typename Case_t>
+const TermHandle_t &CasesTerm<Case_t>::getBranch(uint32_t index) const
+{
+	return m_Data->Branches[index];
+}
+
+template<typename Case_t>
+bool CasesTerm<Case_t>::isOtherwise(uint32_t index) const
+{
+	return index == m_Data->Cases.size();
 }
 
 template<typename Case_t>
@@ -226,6 +424,12 @@ TermHandle_t CasesTerm<Case_t>::getBody() const
 	return m_Body;
 }
 
+template<typename Case_t>
+TermOwner_t CasesTerm<Case_t>::getBody()
+{
+	return m_Body;
+}
+
 template class CasesTerm<Prim_t>;
 template class CasesTerm<Loc_t>;
 
@@ -371,4 +575,149 @@ const CasesTerm<Prim_t> &Term::asPrimCases() const
 const CasesTerm<Loc_t> &Term::asLocCases() const
 {
 	return std::get<CasesTerm<Loc_t>>(m_Term);
-}
\ No newline at end of file
+}
+
+NilTerm &Term::asNil()
+{
+	return std::get<NilTerm>(m_Term);
+}
+
+VarTerm &Term::asVar()
+{
+	return std::get<VarTerm>(m_Term);
+}
+
+AbsTerm &Term::asAbs()
+{
+	return std::get<AbsTerm>(m_Term);
+}
+
+AppTerm &Term::asApp()
+{
+	return std::get<AppTerm>(m_Term);
+}
+
+LocAbsTerm &Term::asLocAbs()
+{
+	return std::get<LocAbsTerm>(m_Term);
+}
+
+LocAppTerm &Term::asLocApp()
+{
+	return std::get<LocAppTerm>(m_Term);
+}
+
+ValTerm &Term::asVal()
+{
+	return std::get<ValTerm>(m_Term);
+}
+
+BinOpTerm &Term::asBinOp()
+{
+	return std::get<BinOpTerm>(m_Term);
+}
+
+CasesTerm<Prim_t> &Term::asPrimCases()
+{
+	return std::get<CasesTerm<Prim_t>>(m_Term);
+}
+
+CasesTerm<Loc_t> &Term::asLocCases()
+{
+	return std::get<CasesTerm<Loc_t>>(m_Term);
+}
+
+TermArena::Scope::Scope(TermArena &arena)
+	: m_Previous(getScopedArena())
+{
+	getScopedArena() = &arena;
+}
+
+TermArena::Scope::~Scope()
+{
+	getScopedArena() = m_Previous;
+}
+
+Term *TermArena::add(Term &&term)
+{
+	void *slot = allocate(sizeof(Term), alignof(Term));
+	++m_NumTerms;
+
+	return new (slot) Term(std::move(term));
+}
+
+const Index_t *TermArena::addIndices(const std::vector<Index_t> &indices)
+{
+	if (indices.empty())
+	{
+		return nullptr;
+	}
+
+	Index_t *copy = static_cast<Index_t *>(allocate(indices.size() * sizeof(Index_t), alignof(Index_t)));
+	std::copy(indices.begin(), indices.end(), copy);
+
+	return copy;
+}
+
+template<typename Case_t>
+CasesData<Case_t> *TermArena::addCasesData()
+{
+	auto &cases = [this]() -> auto & {
+		if constexpr (std::is_same_v<Case_t, Prim_t>)
+		{
+			return m_PrimCases;
+		}
+		else
+		{
+			return m_LocCases;
+		}
+	}();
+
+	cases.push_back(std::make_unique<CasesData<Case_t>>());
+	return cases.back().get();
+}
+
+template CasesData<Prim_t> *TermArena::addCasesData<Prim_t>();
+template CasesData<Loc_t> *TermArena::addCasesData<Loc_t>();
+
+size_t TermArena::getNumTerms() const
+{
+	return m_NumTerms;
+}
+
+size_t TermArena::getNumBytes() const
+{
+	return m_NumBytes;
+}
+
+TermArena &TermArena::getCurrent()
+{
+	TermArena *arena = getScopedArena();
+
+	if (!arena)
+	{
+		std::cerr << "[Term Error] A term was made outside of any arena scope !" << std::endl;
+		std::abort();
+	}
+
+	return *arena;
+}
+
+void *TermArena::allocate(size_t size, size_t align)
+{
+	size_t offset = (m_ChunkUsed + align - 1) / align * align;
+
+	if (m_Chunks.empty() || offset + size > m_Chunks.back().Size)
+	{
+		size_t chunkSize = m_Chunks.empty() ? k_MinChunkSize : std::min(m_Chunks.back().Size * 2, k_MaxChunkSize);
+		chunkSize = std::max(chunkSize, size);
+
+		// Chunks are aligned for any type, so the first allocation needs no padding
+		m_Chunks.push_back({std::make_unique_for_overwrite<std::byte[]>(chunkSize), chunkSize});
+		m_NumBytes += chunkSize;
+		offset = 0;
+	}
+
+	m_ChunkUsed = offset + size;
+	return m_Chunks.back().Bytes.get() + offset;
+}
@@ -5,14 +5,65 @@
 #include <variant>
 #include <string>
 #include <map>
+#include <vector>
+#include <span>
+#include <cstddef>
+#include <type_traits>
 
 #include "Config.hpp"
+#include "CaseDispatch.hpp"
 
 class Term;
 
-using TermOwner_t  = std::shared_ptr<Term>;
-using TermHandle_t = std::shared_ptr<const Term>;
+// Terms are owned by the arena they are allocated in (see TermArena), so the
+// handles they refer to each other with are plain pointers which own nothing
+template<typename T>
+class TermPtr
+{
+public:
+	TermPtr() = default;
+	TermPtr(std::nullptr_t) {}
+
+	explicit TermPtr(T *term)
+		: m_Term(term)
+	{}
+
+	// Terms can always be handed out as constant
+	template<typename U, typename = std::enable_if_t<std::is_convertible_v<U *, T *>>>
+	TermPtr(const TermPtr<U> &term)
+		: m_Term(term.get())
+	{}
+
+	T *get() const
+	{
+		return m_Term;
+	}
+
+	T &operator*() const
+	{
+		return *m_Term;
+	}
+
+	T *operator->() const
+	{
+		return m_Term;
+	}
+
+	explicit operator bool() const
+	{
+		return m_Term != nullptr;
+	}
+
+	bool operator==(const TermPtr &term) const = default;
+
+private:
+	T *m_Term = nullptr;
+};
+
+using TermOwner_t  = TermPtr<Term>;
+using TermHandle_t = TermPtr<const Term>;
 
+// Allocates the term in the arena of the innermost TermArena::Scope
 TermOwner_t newTerm(Term &&term);
 
 class NilTerm
@@ -31,11 +82,24 @@ public:
 	VarTerm &operator=(const VarTerm &term) = delete;
 	VarTerm &operator=(VarTerm &&term) = delete;
 
-	Var_t getVar() const;
+	const Var_t &getVar() const;
+	VarId_t getVarId() const;
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
+
+	// Bound variables are given an index by the resolver, free variables
+	// are left without one and refer to program functions
+	std::optional<Index_t> getIndex() const;
+	void setIndex(std::optional<Index_t> index);
+
+	// Free variables are linked to the index of the function they refer to
+	std::optional<FuncIndex_t> getFuncIndex() const;
+	void setFuncIndex(std::optional<FuncIndex_t> index);
 
 private:
-	Var_t m_Var;
+	VarId_t m_Var;
+	std::optional<Index_t> m_Index;
+	std::optional<FuncIndex_t> m_FuncIndex;
 	TermOwner_t m_Body;
 };
 
@@ -53,11 +117,18 @@ public:
 
 	Loc_t getLoc() const;
 	std::optional<Var_t> getVar() const;
+	std::optional<VarId_t> getVarId() const;
+	bool isBinding() const;
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
+
+	std::optional<Index_t> getLocIndex() const;
+	void setLocIndex(std::optional<Index_t> index);
 
 private:
 	Loc_t m_Loc;
-	std::optional<Var_t> m_Var;
+	std::optional<Index_t> m_LocIndex;
+	std::optional<VarId_t> m_Var;
 	TermOwner_t m_Body;
 };
 
@@ -75,10 +146,26 @@ public:
 
 	Loc_t getLoc() const;
 	TermHandle_t getArg() const;
+	TermOwner_t getArg();
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
+
+	std::optional<Index_t> getLocIndex() const;
+	void setLocIndex(std::optional<Index_t> index);
+
+	// The variables and location variables a closure of the argument captures,
+	// as indices where the closure is made (see Resolver)
+	std::span<const Index_t> getCaptures() const;
+	std::span<const Index_t> getLocCaptures() const;
+	void setCaptures(const std::vector<Index_t> &captures, const std::vector<Index_t> &locCaptures);
 
 private:
 	Loc_t m_Loc;
+	std::optional<Index_t> m_LocIndex;
+	// Both kinds of captures are kept in the arena one after the other
+	uint32_t m_NumCaptures = 0;
+	uint32_t m_NumLocCaptures = 0;
+	const Index_t *m_Captures = nullptr;
 	TermOwner_t m_Arg;
 	TermOwner_t m_Body;
 };
@@ -98,9 +185,14 @@ public:
 	Loc_t getLoc() const;
 	std::optional<LocVar_t> getLocVar() const;
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
+
+	std::optional<Index_t> getLocIndex() const;
+	void setLocIndex(std::optional<Index_t> index);
 
 private:
 	Loc_t m_Loc;
+	std::optional<Index_t> m_LocIndex;
 	std::optional<LocVar_t> m_LocVar;
 	TermOwner_t m_Body;
 };
@@ -120,10 +212,20 @@ public:
 	Loc_t getLoc() const;
 	LocVar_t getArg() const;
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
+
+	std::optional<Index_t> getLocIndex() const;
+	void setLocIndex(std::optional<Index_t> index);
+
+	// Arguments which are not bound location variables are literal locations
+	std::optional<Index_t> getArgIndex() const;
+	void setArgIndex(std::optional<Index_t> index);
 
 private:
 	Loc_t m_Loc;
+	std::optional<Index_t> m_LocIndex;
 	LocVar_t m_Arg;
+	std::optional<Index_t> m_ArgIndex;
 	TermOwner_t m_Body;
 };
 
@@ -149,6 +251,18 @@ private:
 	std::variant<Prim_t, Loc_t> m_Val;
 };
 
+// The cases of a cases term, kept out of line (owned by the arena of the term)
+// so that cases are no bigger than any other term
+template<typename Case_t>
+struct CasesData
+{
+	std::map<Case_t, TermOwner_t> Cases;
+	TermOwner_t Otherwise;
+
+	CaseDispatch<Case_t, uint32_t> Dispatch;
+	std::vector<TermHandle_t> Branches;
+};
+
 template<typename Case_t>
 class CasesTerm
 {
@@ -166,16 +280,23 @@ public:
 	CasesTerm &operator=(CasesTerm &&term) = delete;
 
 	TermHandle_t getOtherwise() const;
+	TermOwner_t getOtherwise();
 
 	typename Cases_t::const_iterator find(const Case_t &c) const;
 	typename Cases_t::const_iterator begin() const;
 	typename Cases_t::const_iterator end() const;
 
+	// The branch taken for a case, without walking the tree of cases. Branches
+	// are numbered in the order of their cases, and 'otherwise' comes last.
+	uint32_t selectBranch(const Case_t &c) const;
+	const TermHandle_t &getBranch(uint32_t index) const;
+	bool isOtherwise(uint32_t index) const;
+
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
 
 private:
-	Cases_t m_Cases;
-	TermOwner_t m_OtherwiseCase;
+	CasesData<Case_t> *m_Data;
 	TermOwner_t m_Body;
 };
 
@@ -199,6 +320,7 @@ public:
 	bool isOp(Op op) const;
 
 	TermHandle_t getBody() const;
+	TermOwner_t getBody();
 
 private:
 	Op m_Op;
@@ -251,9 +373,95 @@ public:
 	const CasesTerm<Prim_t> &asPrimCases() const;
 	const CasesTerm<Loc_t> &asLocCases() const;
 
+	NilTerm &asNil();
+	VarTerm &asVar();
+	AbsTerm &asAbs();
+	AppTerm &asApp();
+	LocAbsTerm &asLocAbs();
+	LocAppTerm &asLocApp();
+
+	ValTerm &asVal();
+	BinOpTerm &asBinOp();
+	CasesTerm<Prim_t> &asPrimCases();
+	CasesTerm<Loc_t> &asLocCases();
+
 private:
 	std::variant<
 		NilTerm, VarTerm, AbsTerm, AppTerm, LocAbsTerm, LocAppTerm, /* FCL-FMC    */
 		ValTerm, BinOpTerm, CasesTerm<Prim_t>, CasesTerm<Loc_t>     /* Extensions */ 
 	> m_Term;
-};
\ No newline at end of file
+};
+
+// Owns the terms of a program, or of a term read as input. Terms are placed in
+// chunks so they never move. They only point to each other and own nothing, so
+// an arena is released by freeing its chunks without visiting any term, only
+// the data of cases (which owns maps and vectors) is destroyed one by one.
+class TermArena
+{
+public:
+	// Makes newTerm allocate in the arena for as long as the scope lasts
+	class Scope
+	{
+	public:
+		explicit Scope(TermArena &arena);
+		~Scope();
+
+		Scope(const Scope &scope) = delete;
+		Scope &operator=(const Scope &scope) = delete;
+
+	private:
+		TermArena *m_Previous;
+	};
+
+public:
+	TermArena() = default;
+
+	TermArena(const TermArena &arena) = delete;
+	TermArena &operator=(const TermArena &arena) = delete;
+
+	Term *add(Term &&term);
+	const Index_t *addIndices(const std::vector<Index_t> &indices);
+
+	template<typename Case_t>
+	CasesData<Case_t> *addCasesData();
+
+	size_t getNumTerms() const;
+	size_t getNumBytes() const;
+
+	// Calls the visitor with the start and end of each chunk, which is how the
+	// arena a term belongs to can be found
+	template<typename Visit_t>
+	void visitChunks(Visit_t visit) const
+	{
+		for (const Chunk &chunk : m_Chunks)
+		{
+			visit(chunk.Bytes.get(), chunk.Bytes.get() + chunk.Size);
+		}
+	}
+
+	// The arena of the innermost scope, making a term outside of any scope is
+	// a bug and aborts
+	static TermArena &getCurrent();
+
+private:
+	void *allocate(size_t size, size_t align);
+
+private:
+	struct Chunk
+	{
+		std::unique_ptr<std::byte[]> Bytes;
+		size_t Size;
+	};
+
+	// Chunks double in size, so that arenas of small input terms stay small
+	static constexpr size_t k_MinChunkSize = 4 * sizeof(Term);
+	static constexpr size_t k_MaxChunkSize = 64 * 1024;
+
+	std::vector<Chunk> m_Chunks;
+	size_t m_ChunkUsed = 0;
+	size_t m_NumTerms = 0;
+	size_t m_NumBytes = 0;
+
+	std::vector<std::unique_ptr<CasesData<Prim_t>>> m_PrimCases;
+	std::vector<std::unique_ptr<CasesData<Loc_t>>> m_LocCases;
+};
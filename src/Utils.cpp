@@ -2,40 +2,109 @@
 
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
 
-#include "Utils.hpp"
+namespace
+{
+	struct LocTable
+	{
+		LocTable()
+		{
+			// Order must match the reserved IDs in Config.hpp
+			for (const char *name : {"lambda", "new", "in", "out", "null"})
+			{
+				Ids[name] = static_cast<Loc_t>(NextId);
+				Names[static_cast<Loc_t>(NextId++)] = name;
+			}
+		}
+
+		// Named and unnamed locations share one dense range of IDs so memory can
+		// be indexed directly, only the named ones are stored here
+		std::unordered_map<std::string, Loc_t> Ids;
+		std::unordered_map<Loc_t, std::string> Names;
+		size_t NextId = 0;
+	};
+
+	LocTable &getLocTable()
+	{
+		static LocTable table;
+		return table;
+	}
+
+	struct VarTable
+	{
+		// Names point into the keys of the map, which never move
+		std::unordered_map<std::string, VarId_t> Ids;
+		std::vector<const std::string *> Names;
+	};
+
+	VarTable &getVarTable()
+	{
+		static VarTable table;
+		return table;
+	}
+}
+
+bool isReservedLoc(Loc_t loc)
+{
+	return loc < k_NumReservedLocs;
+}
 
-bool isReservedLoc(const Loc_t& loc)
+Loc_t internLoc(const std::string_view &name)
 {
-	if      (loc == k_LambdaLoc)  { return true; }
-	else if (loc == k_NewLoc)     { return true; }
-	else if (loc == k_InputLoc)   { return true; }
-	else if (loc == k_OutputLoc)  { return true; }
-	else if (loc == k_NullLoc)    { return true; }
+	LocTable &table = getLocTable();
+
+	auto [it, isNew] = table.Ids.try_emplace(std::string(name), static_cast<Loc_t>(table.NextId));
+	if (isNew)
+	{
+		table.Names[it->second] = it->first;
+		table.NextId++;
+	}
 
-	return false;
+	return it->second;
 }
 
-std::optional<Loc_t> getReservedLocFromId(const std::string_view &id)
+void skipLocIds(size_t numLocs)
 {
-	if      (id == k_LambdaLoc)  { return k_LambdaLoc; }
-	else if (id == k_NewLoc)     { return k_NewLoc; }
-	else if (id == k_InputLoc)   { return k_InputLoc; }
-	else if (id == k_OutputLoc)  { return k_OutputLoc; }
-	else if (id == k_NullLoc)    { return k_NullLoc; }
+	LocTable &table = getLocTable();
+	table.NextId = std::max(table.NextId, numLocs);
+}
+
+std::string getLocName(Loc_t loc)
+{
+	const LocTable &table = getLocTable();
 
-	return std::nullopt;
+	if (auto it = table.Names.find(loc); it != table.Names.end())
+	{
+		return it->second;
+	}
+
+	return "loc_" + std::to_string(loc);
 }
 
-std::optional<std::string> getIdFromReservedLoc(const Loc_t &loc)
+size_t getNumLocs()
 {
-	if      (loc == k_LambdaLoc)  { return std::string(k_LambdaLoc); }
-	else if (loc == k_NewLoc)     { return std::string(k_NewLoc); }
-	else if (loc == k_InputLoc)   { return std::string(k_InputLoc); }
-	else if (loc == k_OutputLoc)  { return std::string(k_OutputLoc); }
-	else if (loc == k_NullLoc)    { return std::string(k_NullLoc); }
+	return getLocTable().NextId;
+}
 
-	return std::nullopt;
+VarId_t internVar(const std::string_view &name)
+{
+	VarTable &table = getVarTable();
+
+	auto [it, isNew] = table.Ids.try_emplace(std::string(name), static_cast<VarId_t>(table.Names.size()));
+	if (isNew)
+	{
+		table.Names.push_back(&it->first);
+	}
+
+	return it->second;
+}
+
+const Var_t &getVarName(VarId_t var)
+{
+	return *getVarTable().Names[var];
 }
 
 std::string stringifyTerm(TermHandle_t term, bool omitNil)
@@ -68,7 +137,7 @@ std::string stringifyTerm(TermHandle_t term, bool omitNil)
 			const AbsTerm &abs = term->asAbs();
 			if (abs.getLoc() != k_LambdaLoc)
 			{
-				ss << abs.getLoc();
+				ss << getLocName(abs.getLoc());
 			}
 			ss << "<" << abs.getVar().value_or("_") << ">";
 			term = abs.getBody();
@@ -79,7 +148,7 @@ std::string stringifyTerm(TermHandle_t term, bool omitNil)
 			ss << "[" << stringifyTerm(app.getArg()) << "]";
 			if (app.getLoc() != k_LambdaLoc)
 			{
-				ss << app.getLoc();
+				ss << getLocName(app.getLoc());
 			}
 			term = app.getBody();
 		}
@@ -88,18 +157,18 @@ std::string stringifyTerm(TermHandle_t term, bool omitNil)
 			const LocAbsTerm &locAbs = term->asLocAbs();
 			if (locAbs.getLoc() != k_LambdaLoc)
 			{
-				ss << locAbs.getLoc();
+				ss << getLocName(locAbs.getLoc());
 			}
-			ss << "<@" << locAbs.getLocVar().value_or("_") << ">";
+			ss << "<@" << (locAbs.getLocVar() ? getLocName(locAbs.getLocVar().value()) : "_") << ">";
 			term = locAbs.getBody();
 		}
 		else if (term->isLocApp())
 		{
 			const LocAppTerm &locApp = term->asLocApp();
-			ss << "[#" << locApp.getArg() << "]";
+			ss << "[#" << getLocName(locApp.getArg()) << "]";
 			if (locApp.getLoc() != k_LambdaLoc)
 			{
-				ss << locApp.getLoc();
+				ss << getLocName(locApp.getLoc());
 			}
 			term = locApp.getBody();
 		}
@@ -112,7 +181,7 @@ std::string stringifyTerm(TermHandle_t term, bool omitNil)
 			}
 			else if (val.isLoc())
 			{
-				ss << "#" << val.asLoc();
+				ss << "#" << getLocName(val.asLoc());
 			}
 			term = nullptr;
 		}
@@ -150,7 +219,7 @@ std::string stringifyTerm(TermHandle_t term, bool omitNil)
 			ss << "(";
 			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
 			{
-				ss << itCases->first;
+				ss << getLocName(itCases->first);
 				ss  << " -> " << stringifyTerm(itCases->second);
 				ss << ", ";
 			}
@@ -188,13 +257,12 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 		{
 			const VarTerm &var = closure.second->asVar();
 
-			auto itEnv = closure.first.first.find(var.getVar());
-			if (itEnv != closure.first.first.end())
+			auto indexOpt = var.getIndex();
+			auto valuePtr = indexOpt ? closure.first.first.find(indexOpt.value()) : nullptr;
+
+			if (valuePtr)
 			{
-				auto closurePtr = itEnv->second;
-				ss << stringifyClosure(
-					*reinterpret_cast<Closure_t *>(closurePtr.get())
-				);
+				ss << stringifyValue(*valuePtr);
 			}
 			else
 			{
@@ -208,22 +276,24 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 			const AppTerm &app = closure.second->asApp();
 			
 			ss << "[";
-			ss << stringifyClosure(std::make_pair(
-				closure.first, app.getArg())
+			ss << stringifyClosure(Closure_t(
+				captureEnv(closure.first, app), app.getArg())
 			);
 			ss << "]";
 
-			auto itEnv = closure.first.second.find(app.getLoc());
-			if (itEnv != closure.first.second.end())
+			auto indexOpt = app.getLocIndex();
+			auto locPtr = indexOpt ? closure.first.second.find(indexOpt.value()) : nullptr;
+
+			if (locPtr)
 			{
-				if (itEnv->second != k_LambdaLoc)
+				if (*locPtr != k_LambdaLoc)
 				{
-					ss << itEnv->second;
+					ss << getLocName(*locPtr);
 				}
 			}
 			else if (app.getLoc() != k_LambdaLoc)
 			{
-				ss << app.getLoc();
+				ss << getLocName(app.getLoc());
 			}
 
 			closure.second = app.getBody();
@@ -233,17 +303,19 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 			const AbsTerm &abs = closure.second->asAbs();
 
 			{
-				auto itEnv = closure.first.second.find(abs.getLoc());
-				if (itEnv != closure.first.second.end())
+				auto indexOpt = abs.getLocIndex();
+				auto locPtr = indexOpt ? closure.first.second.find(indexOpt.value()) : nullptr;
+
+				if (locPtr)
 				{
-					if (itEnv->second != k_LambdaLoc)
+					if (*locPtr != k_LambdaLoc)
 					{
-						ss << itEnv->second;
+						ss << getLocName(*locPtr);
 					}
 				}
 				else if (abs.getLoc() != k_LambdaLoc)
 				{
-					ss << abs.getLoc();
+					ss << getLocName(abs.getLoc());
 				}
 			}
 
@@ -251,11 +323,7 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 
 			if (abs.getVar())
 			{
-				auto itEnv = closure.first.first.find(abs.getVar().value());
-				if (itEnv != closure.first.first.end())
-				{
-					closure.first.first.erase(itEnv);
-				}
+				closure.first.first = closure.first.first.bindEmpty();
 			}
 			
 			closure.second = abs.getBody();
@@ -266,30 +334,34 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 
 			ss << "[#";
 			{
-				auto itEnv = closure.first.second.find(locApp.getArg());
-				if (itEnv != closure.first.second.end())
+				auto indexOpt = locApp.getArgIndex();
+				auto locPtr = indexOpt ? closure.first.second.find(indexOpt.value()) : nullptr;
+
+				if (locPtr)
 				{
-					ss << itEnv->second;
+					ss << getLocName(*locPtr);
 				}
 				else
 				{
-					ss << locApp.getArg();
+					ss << getLocName(locApp.getArg());
 				}
 			}
 			ss << "]";
 
 			{
-				auto itEnv = closure.first.second.find(locApp.getLoc());
-				if (itEnv != closure.first.second.end())
+				auto indexOpt = locApp.getLocIndex();
+				auto locPtr = indexOpt ? closure.first.second.find(indexOpt.value()) : nullptr;
+
+				if (locPtr)
 				{
-					if (itEnv->second != k_LambdaLoc)
+					if (*locPtr != k_LambdaLoc)
 					{
-						ss << itEnv->second;
+						ss << getLocName(*locPtr);
 					}
 				}
 				else if (locApp.getLoc() != k_LambdaLoc)
 				{
-					ss << locApp.getLoc();
+					ss << getLocName(locApp.getLoc());
 				}
 			}
 
@@ -300,30 +372,28 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 			const LocAbsTerm &locAbs = closure.second->asLocAbs();
 
 			{
-				auto itEnv = closure.first.second.find(locAbs.getLoc());
-				if (itEnv != closure.first.second.end())
+				auto indexOpt = locAbs.getLocIndex();
+				auto locPtr = indexOpt ? closure.first.second.find(indexOpt.value()) : nullptr;
+
+				if (locPtr)
 				{
-					if (itEnv->second != k_LambdaLoc)
+					if (*locPtr != k_LambdaLoc)
 					{
-						ss << itEnv->second;
+						ss << getLocName(*locPtr);
 					}
 				}
 				else if (locAbs.getLoc() != k_LambdaLoc)
 				{
-					ss << locAbs.getLoc();
+					ss << getLocName(locAbs.getLoc());
 				}
 			}
 
 			if (locAbs.getLocVar())
 			{
-				auto itEnv = closure.first.second.find(locAbs.getLocVar().value());
-				if (itEnv != closure.first.second.end())
-				{
-					closure.first.second.erase(itEnv);
-				}
+				closure.first.second = closure.first.second.bindEmpty();
 			}
 
-			ss << "<@" << locAbs.getLocVar().value_or("_") << ">";
+			ss << "<@" << (locAbs.getLocVar() ? getLocName(locAbs.getLocVar().value()) : "_") << ">";
 
 			closure.second = locAbs.getBody();
 		}
@@ -337,7 +407,7 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 			}
 			else if (val.isLoc())
 			{
-				ss << "#" << val.asLoc();
+				ss << "#" << getLocName(val.asLoc());
 			}
 
 			closure.second = nullptr;
@@ -366,13 +436,13 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 			{
 				ss << itCases->first;
 				ss  << " -> ";
-				ss << stringifyClosure(std::make_pair(
+				ss << stringifyClosure(Closure_t(
 					closure.first, itCases->second)
 				);
 				ss << ", ";
 			}
 			ss << "otherwise -> ";
-			ss << stringifyClosure(std::make_pair(
+			ss << stringifyClosure(Closure_t(
 				closure.first, cases.getOtherwise())
 			);
 			ss << ")";
@@ -386,15 +456,15 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 			ss << "(";
 			for (auto itCases = cases.begin(); itCases != cases.end(); ++itCases)
 			{
-				ss << itCases->first;
+				ss << getLocName(itCases->first);
 				ss  << " -> ";
-				ss << stringifyClosure(std::make_pair(
+				ss << stringifyClosure(Closure_t(
 					closure.first, itCases->second)
 				);
 				ss << ", ";
 			}
 			ss << "otherwise -> ";
-			ss << stringifyClosure(std::make_pair(
+			ss << stringifyClosure(Closure_t(
 				closure.first, cases.getOtherwise())
 			);
 			ss << ")";
@@ -404,4 +474,18 @@ std::string stringifyClosure(Closure_t closure, bool omitNil)
 	}
 
 	return ss.str();
+}
+
+std::string stringifyValue(const Value &value, bool omitNil)
+{
+	if (value.isPrim())
+	{
+		return std::to_string(value.asPrim());
+	}
+	else if (value.isLoc())
+	{
+		return "#" + getLocName(value.asLoc());
+	}
+
+	return stringifyClosure(value.asClosure(), omitNil);
 }
\ No newline at end of file
@@ -7,9 +7,19 @@
 #include "Term.hpp"
 #include "Machine.hpp"
 
-bool isReservedLoc(const Loc_t& loc);
-std::optional<Loc_t> getReservedLocFromId(const std::string_view &id);
-std::optional<std::string> getIdFromReservedLoc(const Loc_t &loc);
+bool isReservedLoc(Loc_t loc);
+
+Loc_t internLoc(const std::string_view &name);
+// Names first seen from now on take IDs from 'numLocs' on, leaving the IDs below
+// it to whoever handed them out
+void skipLocIds(size_t numLocs);
+std::string getLocName(Loc_t loc);
+// The number of named locations, IDs of unnamed ones are minted by LocAllocator
+size_t getNumLocs();
+
+VarId_t internVar(const std::string_view &name);
+const Var_t &getVarName(VarId_t var);
 
 std::string stringifyTerm(TermHandle_t term, bool omitNil = true);
-std::string stringifyClosure(Closure_t closure, bool omitNil = true);
\ No newline at end of file
+std::string stringifyClosure(Closure_t closure, bool omitNil = true);
+std::string stringifyValue(const Value &value, bool omitNil = true);
\ No newline at end of file